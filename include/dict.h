@@ -2,36 +2,131 @@
 #ifndef MINT_DICT_H
 #define MINT_DICT_H
 
-#define INIT_DICT_CAPACITY 8
+#include "value.h"
 
-typedef struct _DictNode
+#include <stdint.h>
+
+#define INIT_DICT_CAPACITY 4
+
+// The dict keeps its entries in an array in the order they were added, and
+// indexes them with an open addressing table in the style of a swiss table:
+// every slot has a control byte which says whether it's empty, deleted or full
+// (and then holds the low 7 bits of the key's hash). Lookups compare the
+// control bytes of DICT_GROUP_SIZE slots at once (with SSE2 where it's
+// available) and only look at the entries whose byte matches.
+#define DICT_GROUP_SIZE		16
+
+#define DICT_CTRL_EMPTY		((int8_t)-128)
+#define DICT_CTRL_DELETED	((int8_t)-2)
+
+struct _Object;
+
+typedef struct _DictEntry
 {
-	struct _DictNode* next;
-	char* key;
-	void* value;
-	int activeIndex;
-} DictNode;
+	struct _Object* key;			// always an interned string (NULL if the entry was removed)
+	Value value;
+	uint32_t hash;					// hash of the key (so rehashing never has to touch it)
+} DictEntry;
+
+typedef struct _DictTable
+{
+	// one control byte per slot; the first DICT_GROUP_SIZE bytes are repeated
+	// after the last one so a group can be loaded starting at any slot
+	// NOTE: this is allocated along with the slots (right after them)
+	int8_t* ctrl;
+	int32_t* slots;					// index into the dict's entries of every full slot
+
+	int capacity;					// always a power of 2 (or 0 if there is no table)
+} DictTable;
 
 typedef struct _Dict
 {
+	// Removing an entry leaves a hole (a NULL key) behind, so the indices of
+	// the others don't change. Once the array is full, it's compacted if at
+	// least half of it is holes (which is the only time the indices change)
+	// and replaced with one twice as big otherwise.
 	struct
 	{
-		int* data;
-		int length;
+		DictEntry* data;
+		int length;					// including the holes
 		int capacity;
-	} active;
-	
-	DictNode** buckets;
-	int capacity;
-	int used;
-	
-	int numEntries;
+
+		// the entries are copied into a new array DICT_MIGRATE_STEP at a time
+		// (like the table's slots); the ones from 'copied' up to 'oldLength'
+		// are still in 'old'
+		DictEntry* old;
+		int copied;
+		int oldLength;
+	} entries;
+
+	DictTable table;
+
+	// When the table has to be resized the new one is used right away and the
+	// slots are moved over from the old one DICT_MIGRATE_STEP at a time (every
+	// put of a new key moves some) so no single operation has to move all of
+	// them. A key is only ever in one of the two tables.
+	DictTable old;
+	int migrated;					// the old table's slots below this have been moved
+
+	int used;						// full and deleted slots in 'table'
+	int numEntries;					// not counting the holes
+
+	// changes whenever an entry is added, removed or moved (but not when a
+	// value is updated), so an index into the entries which was found at some
+	// version still refers to the same key as long as it's unchanged
+	uint32_t version;
+	uint32_t compactions;			// the number of times the entries were compacted
+
+	// NOTE: this is owned by the vm; it's NULL unless the dict has been used as
+	// a metadict (see GetOverload in vm.c)
+	struct _MetaCache* metaCache;
 } Dict;
 
+#define DICT_MIGRATE_STEP	64
+
+// Every entry can be visited (in the order they were added) by going over each
+// index below GetDictEntryCount and skipping the ones GetDictEntry returns NULL
+// for. Only adding a key can move entries (see Dict.entries), so the indices
+// stay valid while existing entries are updated or removed.
+static inline int GetDictEntryCount(const Dict* dict)
+{
+	return dict->entries.length;
+}
+
+// returns the entry at index even if it's a hole
+static inline DictEntry* LocateDictEntry(const Dict* dict, int index)
+{
+	if(index >= dict->entries.copied && index < dict->entries.oldLength)
+		return &dict->entries.old[index];
+	return &dict->entries.data[index];
+}
+
+static inline DictEntry* GetDictEntry(const Dict* dict, int index)
+{
+	DictEntry* entry = LocateDictEntry(dict, index);
+	return entry->key ? entry : NULL;
+}
+
 void InitDict(Dict* dict);
-void DictPut(Dict* dict, const char* key, void* value);
-void* DictRemove(Dict* dict, const char* key);
-void* DictGet(Dict* dict, const char* key);
+// NOTE: key must be an interned string object (see InternStringObject)
+void DictPut(Dict* dict, struct _Object* key, Value value);
+char DictRemove(Dict* dict, struct _Object* key, Value* removed);
+// removes every entry for which 'shouldRemove' returns true; returns the number removed
+int DictRemoveWhere(Dict* dict, char (*shouldRemove)(const DictEntry* entry, void* data), void* data);
+// returns a pointer to the value stored under key (or NULL if there is no such key);
+// the key can be any string object
+// NOTE: the pointer is only valid until something is put into or removed from the dict
+Value* DictGet(Dict* dict, struct _Object* key);
+// same as DictGet but also sets *index to the index of the key's entry
+// NOTE: since the holes have a NULL key, the index stays valid for as long as
+// it's below GetDictEntryCount and the key of LocateDictEntry is still key
+Value* DictGetIndexed(Dict* dict, struct _Object* key, int* index);
+// same as DictGet but the key has to be hashed
+Value* DictGetString(Dict* dict, const char* key);
+// same as DictGetIndexed but the key has to be hashed
+Value* DictGetStringIndexed(Dict* dict, const char* key, int* index);
+// number of bytes allocated by the dict (not counting the Dict itself)
+size_t DictMemory(const Dict* dict);
 void FreeDict(Dict* dict);
 
 #endif
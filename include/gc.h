@@ -0,0 +1,229 @@
+// gc.h -- paged object heap for the mint vm garbage collector
+#ifndef MINT_GC_H
+#define MINT_GC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Objects live in fixed size slots inside GC_PAGE_SIZE aligned pages, so
+// the page (and with it the mark bits) of any object can be found by masking
+// its address. The first GC_PAGE_HEADER_SIZE bytes of every page hold the
+// HeapPage header.
+#define GC_PAGE_SIZE			(64 * 1024)
+#define GC_PAGE_HEADER_SIZE		2048
+#define GC_SLOT_SIZE			32
+#define GC_PAGE_SLOTS			((GC_PAGE_SIZE - GC_PAGE_HEADER_SIZE) / GC_SLOT_SIZE)
+#define GC_BITMAP_WORDS			((GC_PAGE_SLOTS + 63) / 64)
+
+// number of completely empty pages the heap holds onto after a sweep
+// (the rest are released back to the system)
+#define GC_MAX_EMPTY_PAGES		4
+
+// Major collections are paced by the number of bytes objects take up (their
+// slots plus everything they allocate outside of the heap pages). One starts
+// once the heap is heap.growthFactor times as big as it was after the last one,
+// but never before the heap reaches GC_MIN_HEAP_BYTES.
+#define GC_MIN_HEAP_BYTES			(1024 * 1024)
+#define GC_DEFAULT_GROWTH_FACTOR	2.0
+
+// number of objects which can be allocated after a collection before a minor
+// (nursery only) collection is triggered
+#define GC_NURSERY_SIZE			4096
+
+// while an incremental collection is in progress, NewObject does
+// heap.stepWork units of marking work for every GC_STEP_BYTES allocated
+// (which is GC_STEP_INTERVAL objects that don't allocate anything else)
+#define GC_STEP_INTERVAL		256
+#define GC_STEP_BYTES			(GC_STEP_INTERVAL * GC_SLOT_SIZE)
+#define GC_DEFAULT_STEP_WORK	(GC_STEP_INTERVAL * 4)
+
+// after a major collection the dead objects are freed lazily; NewObject sweeps
+// pages until (roughly) this many objects have been freed for every
+// GC_STEP_BYTES allocated (and whenever it runs out of free slots)
+#define GC_SWEEP_STEP_WORK		(GC_STEP_INTERVAL * 4)
+
+// the final (stop the world) part of a major collection is marked by
+// heap.numMarkThreads threads once the heap has at least this many objects
+#define GC_PARALLEL_MARK_MIN_OBJECTS	(64 * 1024)
+#define GC_MAX_MARK_THREADS				16
+
+// pause times are counted in GC_PAUSE_BUCKETS buckets: the first one holds
+// pauses under a microsecond and bucket i holds pauses under 2^i microseconds
+// (the last one holds everything longer)
+#define GC_PAUSE_BUCKETS		20
+
+// the per type stats are indexed by ObjectType (there are fewer than this)
+#define GC_MAX_OBJECT_TYPES		16
+
+typedef enum
+{
+	GC_IDLE,
+	GC_MARKING,		// incremental major collection in progress
+	GC_SWEEPING		// major collection finished marking, dead objects are being freed
+} GcState;
+
+struct _Object;
+struct _ParallelMarker;
+
+// Collector statistics; these are kept up to date as the program runs (see
+// GetGcStats for the ones which are computed when they're asked for)
+typedef struct _GcStats
+{
+	int numMinor;
+	int numMajor;		// counted when the marking finishes
+
+	// a pause is any stretch of time the program spends in the collector
+	int numPauses;
+	double totalPause;	// seconds
+	double maxPause;
+	int pauseHistogram[GC_PAUSE_BUCKETS];
+
+	// everything allocated since the heap was created
+	size_t allocatedObjects;
+	size_t allocatedBytes;
+	double startTime;
+
+	// objects which haven't been freed yet (and the bytes they take up) by type
+	int numObjects[GC_MAX_OBJECT_TYPES];
+	size_t numBytes[GC_MAX_OBJECT_TYPES];
+
+	// filled in by GetGcStats
+	double allocationRate;	// bytes per second since the heap was created
+	int numPages;
+	int numFreePages;
+	int numFreeSlots;
+} GcStats;
+
+typedef struct _HeapPage
+{
+	struct _Heap* heap;				// the heap the page belongs to
+	struct _HeapPage* next;			// next page in the heap
+	struct _HeapPage* nextFree;		// next page in the free page list
+	struct _HeapPage* nextNursery;	// next page in the nursery
+
+	int numLive;					// number of allocated slots
+	int freeHint;					// first bitmap word which may have a free slot
+	char inFreeList;
+	char inNursery;
+	char needsSweep;				// page hasn't been swept since the last major collection
+
+	uint64_t allocBits[GC_BITMAP_WORDS];
+	uint64_t markBits[GC_BITMAP_WORDS];
+
+	// objects which survived a collection; these are only freed by a major collection
+	uint64_t oldBits[GC_BITMAP_WORDS];
+	// old objects which are in the remembered set
+	uint64_t rememberedBits[GC_BITMAP_WORDS];
+} HeapPage;
+
+typedef struct _Heap
+{
+	HeapPage* pages;
+	int numPages;
+
+	// pages which (might) have free slots in them; allocation always
+	// happens from the head of this list
+	HeapPage* freePages;
+
+	// pages which have had objects allocated in them since the last
+	// collection; a minor collection only sweeps these
+	HeapPage* nursery;
+
+	int numOld;
+
+	size_t numBytes;
+	size_t bytesUntilGc;
+	double growthFactor;
+
+	// if this isn't 0, a full collection is forced whenever the heap would grow
+	// past this many bytes (and the vm exits if that doesn't free up enough)
+	size_t maxBytes;
+
+	// old objects which have had references to young objects stored in them
+	struct _Object** remembered;
+	int numRemembered;
+	int rememberedCapacity;
+
+	// old objects which are always scanned by a minor collection (threads
+	// and natives with an onMark callback, which get mutated without a barrier)
+	struct _Object** sticky;
+	int numSticky;
+	int stickyCapacity;
+
+	// set while a minor collection is marking
+	char minor;
+
+	GcState state;
+
+	// link to the next page the lazy sweep will look at
+	HeapPage** sweepLink;
+	int numEmptyPages;
+
+	// weak references and weak dicts; their dead referents are cleared
+	// once marking finishes (see ClearWeakReferences)
+	struct _Object** weak;
+	int numWeak;
+	int weakCapacity;
+
+	// marked objects which still have to be scanned (gray objects)
+	struct _Object** gray;
+	int numGray;
+	int grayCapacity;
+
+	// black objects which can be mutated without a barrier (threads and
+	// arrays handed out by PopArray); these are rescanned when marking finishes
+	struct _Object** rescan;
+	int numRescan;
+	int rescanCapacity;
+
+	// amount of work (roughly the number of references scanned) done per
+	// automatic incremental step; if this is 0 then major collections are
+	// done all at once
+	int stepWork;
+	size_t bytesSinceStep;
+
+	// number of threads (including the one running the vm) which mark the heap
+	// in parallel; defaults to the number of processors (and is always 1 when
+	// the vm is built without MINT_PARALLEL_MARK)
+	int numMarkThreads;
+	struct _ParallelMarker* parallel;
+
+	GcStats stats;
+	int pauseDepth;
+	double pauseStart;
+} Heap;
+
+static inline HeapPage* GetObjectPage(const struct _Object* obj)
+{
+	return (HeapPage*)((uintptr_t)obj & ~(uintptr_t)(GC_PAGE_SIZE - 1));
+}
+
+static inline int GetObjectSlot(const HeapPage* page, const struct _Object* obj)
+{
+	return (int)(((const char*)obj - (const char*)page - GC_PAGE_HEADER_SIZE) / GC_SLOT_SIZE);
+}
+
+static inline struct _Object* GetPageObject(HeapPage* page, int slot)
+{
+	return (struct _Object*)((char*)page + GC_PAGE_HEADER_SIZE + (size_t)slot * GC_SLOT_SIZE);
+}
+
+static inline int TestObjectBit(const uint64_t* bits, const HeapPage* page, const struct _Object* obj)
+{
+	int slot = GetObjectSlot(page, obj);
+	return (bits[slot >> 6] >> (slot & 63)) & 1;
+}
+
+static inline int IsObjectOld(const struct _Object* obj)
+{
+	HeapPage* page = GetObjectPage(obj);
+	return TestObjectBit(page->oldBits, page, obj);
+}
+
+static inline int IsObjectMarked(const struct _Object* obj)
+{
+	HeapPage* page = GetObjectPage(obj);
+	return TestObjectBit(page->markBits, page, obj);
+}
+
+#endif
@@ -0,0 +1,27 @@
+// intern.h -- string interning table for the mint vm
+#ifndef MINT_INTERN_H
+#define MINT_INTERN_H
+
+#include <stdint.h>
+
+#define INIT_STRING_TABLE_CAPACITY 256
+
+struct _Object;
+
+// Set of interned string objects (open addressing with linear probing). The
+// table doesn't keep its strings alive; the gc removes them when they're freed.
+typedef struct _StringTable
+{
+	struct _Object** entries;
+	int capacity;	// always a power of 2
+	int count;
+} StringTable;
+
+void InitStringTable(StringTable* table);
+// returns the interned string with the given contents (or NULL if there is no such string)
+struct _Object* StringTableFind(StringTable* table, const char* chars, int length, uint32_t hash);
+void StringTableAdd(StringTable* table, struct _Object* obj);
+void StringTableRemove(StringTable* table, struct _Object* obj);
+void FreeStringTable(StringTable* table);
+
+#endif
@@ -19,6 +19,10 @@
 
 extern char ProduceDebugInfo;
 
+// compiles everything to the stack forms of instructions instead of using the
+// register forms where it can (see OP_ADD_RR); mostly there to compare the two
+extern char ProduceStackCode;
+
 void ErrorExit(const char* format, ...);
 void Warn(const char* format, ...);
 
@@ -29,6 +33,10 @@ void AllocatePatch(int length);
 
 void EmplaceInt(int loc, int value);
 
+// returns the index of a new inline cache (the operand of OP_DICT_GET and
+// OP_DICT_SET) for accessing the key with the given string constant index
+int AddDictCache(int key);
+
 void OutputCode(FILE* out);
 
 struct _Expr;
@@ -68,6 +76,7 @@ typedef struct _TypeHint
 			int numElements;
 			struct _TypeHint* elements[MAX_STRUCT_ELEMENTS];  
 			char* names[MAX_STRUCT_ELEMENTS];
+			int structIndex;	// into the struct types written to the binary (or -1; see GetStructTypeIndex)
 		} user;
 		// for funcs
 		struct
@@ -247,6 +256,8 @@ extern int CurTok;
 extern char ResetLex;
 
 int GetToken(FILE* in);
+void AppendLexChar(int c);
+void ClearLexeme();
 
 typedef enum
 {
@@ -279,6 +290,7 @@ typedef enum
 	EXP_TYPE_DECL,
 	EXP_TYPE_CAST,
 	EXP_MULTI,
+	EXP_FOR_IN,
 	NUM_EXPR_TYPES
 } ExprType;
 
@@ -315,6 +327,8 @@ typedef struct _Expr
 		struct { int op; struct _Expr* expr; } unaryx;
 		// comDecl: for array comprehensions
 		struct { struct _Expr *init, *cond, *iter, *bodyHead; VarDecl* comDecl; } forx;
+		// iterDecl and indexDecl hold the container and the position in it; valueDecl is NULL if there's no value variable
+		struct { VarDecl *keyDecl, *valueDecl; struct _Expr *iterable, *bodyHead; VarDecl *iterDecl, *indexDecl, *comDecl; } forinx;
 		struct { struct _Expr* dict; char name[MAX_ID_NAME_LENGTH]; char isColon; } dotx;
 		struct { struct _Expr* pairsHead; int length; VarDecl* decl; } dictx;
 		struct { struct _Expr* dict; char name[MAX_ID_NAME_LENGTH]; } colonx;
@@ -344,6 +358,9 @@ TypeHint* RegisterUserType(const char* name);
 TypeHint* GetUserTypeElement(const TypeHint* type, const char* name);
 int GetUserTypeElementIndex(const TypeHint* type, const char* name);
 int GetUserTypeNumElements(const TypeHint* type);
+// returns the index of the struct type the instances of the usertype are
+// (its fields are written to the binary the first time this is called)
+int GetStructTypeIndex(TypeHint* type);
 
 void CheckAllTypesDefined();
 
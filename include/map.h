@@ -0,0 +1,81 @@
+// map.h -- hash map keyed by any value for mint vm
+#ifndef MINT_MAP_H
+#define MINT_MAP_H
+
+#include "value.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INIT_MAP_CAPACITY 8
+
+// Unlike a dict, a map can be keyed by numbers, bools and objects as well as
+// strings: numbers and bools are compared by value, strings by their contents
+// and every other object by identity. Null isn't a valid key, so it marks the
+// entries which were removed.
+#define MAP_EMPTY_KEY		NULL_VAL
+
+#define MAP_EMPTY_SLOT		-1
+#define MAP_DELETED_SLOT	-2
+
+typedef struct _MapEntry
+{
+	Value key;
+	Value value;
+} MapEntry;
+
+// The map keeps its entries in an array in the order they were added and finds
+// them through an open addressing table of indices into it, which is probed
+// linearly. Removing an entry leaves a hole behind, so the indices of the others
+// don't change. Once the array is full, it's compacted if at least half of it
+// is holes (which is the only time the indices change) and grown otherwise.
+typedef struct _Map
+{
+	MapEntry* entries;
+	int length;						// including the holes
+	int entriesCapacity;
+
+	int32_t* slots;					// an entry's index, MAP_EMPTY_SLOT or MAP_DELETED_SLOT
+	int capacity;					// always a power of 2 (or 0 if there is no table)
+
+	int used;						// full and deleted slots
+	int numEntries;					// not counting the holes
+
+	uint32_t compactions;			// the number of times the entries were compacted
+
+	char weakMode;					// see WEAK_KEYS and WEAK_VALUES in vm.h
+} Map;
+
+// Every entry can be visited (in the order they were added) by going over each
+// index below GetMapEntryCount and skipping the ones GetMapEntry returns NULL for
+static inline int GetMapEntryCount(const Map* map)
+{
+	return map->length;
+}
+
+static inline MapEntry* GetMapEntry(const Map* map, int index)
+{
+	return map->entries[index].key != MAP_EMPTY_KEY ? &map->entries[index] : NULL;
+}
+
+void InitMap(Map* map);
+// NOTE: the key can't be null or NaN (see IsValidMapKey)
+void MapPut(Map* map, Value key, Value value);
+char MapRemove(Map* map, Value key, Value* removed);
+// removes every entry for which 'shouldRemove' returns true; returns the number removed
+// NOTE: this doesn't move any entries
+int MapRemoveWhere(Map* map, char (*shouldRemove)(const MapEntry* entry, void* data), void* data);
+// returns a pointer to the value stored under key (or NULL if there is no such key)
+// NOTE: the pointer is only valid until something is put into or removed from the map
+Value* MapGet(Map* map, Value key);
+// number of bytes allocated by the map (not counting the Map itself)
+size_t MapMemory(const Map* map);
+void FreeMap(Map* map);
+
+static inline char IsValidMapKey(Value key)
+{
+	// NaN isn't equal to itself, so it could never be found again
+	return key != MAP_EMPTY_KEY && (!IS_NUMBER(key) || AS_NUMBER(key) == AS_NUMBER(key));
+}
+
+#endif
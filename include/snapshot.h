@@ -0,0 +1,21 @@
+// snapshot.h -- heap snapshot file format for the mint vm
+#ifndef MINT_SNAPSHOT_H
+#define MINT_SNAPSHOT_H
+
+// A snapshot is a text file whose first line is SNAPSHOT_HEADER followed by the
+// format version. Every line after that is one of:
+//
+//	o <id> <type> <size> "<label>"	an object; the size includes everything it allocated
+//	e <from> <to> "<name>"			a reference from one object to another
+//	r <to> "<name>"					a reference from a root (global, stack slot, ...)
+//
+// Only objects reachable from the roots are written. Ids are handed out breadth
+// first from the roots (starting at 0), so an edge can refer to an object which
+// is written later on. Quoted strings have \\, \" and \n escaped.
+#define SNAPSHOT_HEADER			"mint-heap-snapshot"
+#define SNAPSHOT_VERSION		1
+
+// string labels are cut off after this many characters
+#define SNAPSHOT_MAX_LABEL		40
+
+#endif
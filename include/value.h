@@ -0,0 +1,57 @@
+// value.h -- NaN-boxed value representation for the mint vm
+#ifndef MINT_VALUE_H
+#define MINT_VALUE_H
+
+#include <stdint.h>
+#include <string.h>
+
+struct _Object;
+
+// Every value the vm manipulates (stack slots, array members, dict values,
+// globals) is a NaN-boxed 64 bit word. Anything which is not a quiet NaN with
+// all of the QNAN bits set is a number; null and the booleans are encoded as
+// small payloads in a quiet NaN and heap objects additionally set the sign bit
+// and store the pointer in the low 48 bits. This means numbers, bools and null
+// never touch the allocator.
+typedef uint64_t Value;
+
+#define VALUE_SIGN_BIT		((uint64_t)0x8000000000000000)
+#define VALUE_QNAN			((uint64_t)0x7ffc000000000000)
+
+#define VALUE_TAG_NULL		1
+#define VALUE_TAG_FALSE		2
+#define VALUE_TAG_TRUE		3
+
+#define NULL_VAL			((Value)(VALUE_QNAN | VALUE_TAG_NULL))
+#define FALSE_VAL			((Value)(VALUE_QNAN | VALUE_TAG_FALSE))
+#define TRUE_VAL			((Value)(VALUE_QNAN | VALUE_TAG_TRUE))
+
+#define IS_NUMBER(v)		(((v) & VALUE_QNAN) != VALUE_QNAN)
+#define IS_NULL(v)			((v) == NULL_VAL)
+#define IS_BOOL(v)			(((v) | 1) == TRUE_VAL)
+#define IS_OBJECT(v)		(((v) & (VALUE_QNAN | VALUE_SIGN_BIT)) == (VALUE_QNAN | VALUE_SIGN_BIT))
+
+#define AS_BOOL(v)			((v) == TRUE_VAL)
+#define AS_OBJECT(v)		((struct _Object*)(uintptr_t)((v) & ~(VALUE_SIGN_BIT | VALUE_QNAN)))
+
+#define BOOL_VAL(b)			((b) ? TRUE_VAL : FALSE_VAL)
+#define OBJECT_VAL(obj)		((Value)(VALUE_SIGN_BIT | VALUE_QNAN | (uint64_t)(uintptr_t)(obj)))
+
+static inline Value NUMBER_VAL(double number)
+{
+	Value value;
+	// NOTE: NaNs produced by arithmetic could collide with the tag space so they are canonicalized
+	if(number != number)
+		return (Value)0x7ff8000000000000;
+	memcpy(&value, &number, sizeof(double));
+	return value;
+}
+
+static inline double AS_NUMBER(Value value)
+{
+	double number;
+	memcpy(&number, &value, sizeof(double));
+	return number;
+}
+
+#endif
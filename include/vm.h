@@ -1,9 +1,15 @@
 #ifndef MINT_VM_H
 #define MINT_VM_H
 
+#include "value.h"
 #include "dict.h"
+#include "map.h"
+#include "intern.h"
+#include "gc.h"
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <stdbool.h>
 
 #ifdef MINT_FFI_SUPPORT
@@ -53,6 +59,7 @@ enum
 	OP_SET_META,
 	OP_GET_META,
 
+	// access the key of the inline cache given by the operand (see DictCache)
 	OP_DICT_SET,
 	OP_DICT_GET,
 	
@@ -61,6 +68,20 @@ enum
 	OP_DICT_GET_RAW,
 	
 	OP_DICT_PAIRS,
+
+	// instances of usertypes (see StructType); the first operand is the type
+	// and the second one is the field
+	OP_PUSH_STRUCT,
+	OP_STRUCT_SET,
+	OP_STRUCT_GET,
+
+	// for loops over dicts, structs, maps and arrays; the position in the
+	// container is the index of a slot (or a field or an element) which is -1
+	// before the first one, so nothing has to be allocated to iterate
+	OP_ITER_BEGIN,		// checks that the value on top of the stack can be iterated over
+	OP_ITER_NEXT,		// pops the container and the position and pushes the next position (or jumps to the operand if there is none)
+	OP_ITER_KEY,		// pops the container and the position and pushes the key there
+	OP_ITER_VALUE,		// same as OP_ITER_KEY but pushes the value
 	
 	// concatenate strings
 	OP_CAT,
@@ -124,7 +145,26 @@ enum
 	
 	OP_FILE, // set current file name
 	OP_LINE, // set current line name
-	
+
+	// register forms: the operands name frame slots (R, the operand of
+	// OP_GETLOCAL) or number constants (K) instead of being on the stack. Each
+	// operator has four of them in this order: the two which push the result,
+	// and the two which store it in the slot given by the last operand (_TO)
+	// or, for the relational ones, jump to it if the result is false (_GOTOZ)
+	OP_ADD_RR, OP_ADD_RK, OP_ADD_RR_TO, OP_ADD_RK_TO,
+	OP_SUB_RR, OP_SUB_RK, OP_SUB_RR_TO, OP_SUB_RK_TO,
+	OP_MUL_RR, OP_MUL_RK, OP_MUL_RR_TO, OP_MUL_RK_TO,
+	OP_DIV_RR, OP_DIV_RK, OP_DIV_RR_TO, OP_DIV_RK_TO,
+
+	OP_LT_RR, OP_LT_RK, OP_LT_RR_GOTOZ, OP_LT_RK_GOTOZ,
+	OP_LTE_RR, OP_LTE_RK, OP_LTE_RR_GOTOZ, OP_LTE_RK_GOTOZ,
+	OP_GT_RR, OP_GT_RK, OP_GT_RR_GOTOZ, OP_GT_RK_GOTOZ,
+	OP_GTE_RR, OP_GTE_RK, OP_GTE_RR_GOTOZ, OP_GTE_RK_GOTOZ,
+
+	OP_MOVE_R,		// copies the first slot into the second one
+	OP_MOVE_K,		// stores the constant in the slot
+	OP_GETINDEX_RR,	// pushes the first slot indexed by the second one (like OP_GETINDEX)
+
 	NUM_OPCODES
 };
 
@@ -138,28 +178,57 @@ typedef enum
 	OBJ_NATIVE,
 	OBJ_FUNC,
 	OBJ_DICT,
-	OBJ_THREAD
+	OBJ_THREAD,
+	OBJ_WEAK,
+	OBJ_STRUCT,
+	OBJ_MAP
 } ObjectType;
 
+// which parts of the entries of a weak dict or map don't keep their referents
+// alive (see PushWeakDict and PushWeakMap)
+// NOTE: strings are compared by their contents, so like numbers they're never
+// weak (an equal string could always be made again); that's why only maps,
+// whose keys can be other objects, can have weak keys
+#define WEAK_KEYS			1
+#define WEAK_VALUES			2
+
 struct _VMThread;
 
+// NOTE: Objects are allocated in the slots of heap pages (see gc.h); their
+// mark bits live in the page header rather than the object itself. Anything
+// which doesn't fit in a slot (array members, dict tables, string characters)
+// is allocated separately.
 typedef struct _Object
 {
-	char marked;
-	
-	struct _Object* next;
 	ObjectType type;
+
+	// bytes allocated outside of the heap page for this object; the gc paces
+	// collections by these (see SetExternalSize)
+	uint32_t externalSize;
 	
 	union
 	{
-		char boolean;
-
-		double number;
-		struct { char* raw; } string;
+		// NOTE: strings are immutable; the length and hash are computed when the string is created
+		struct
+		{
+			int length;
+			char interned;
+
+			// long strings are concatenated lazily: until somebody reads the
+			// characters (and the hash is known) the string is made up of
+			// left and right instead
+			char isRope;
+
+			union
+			{
+				struct { char* raw; uint32_t hash; };
+				struct { struct _Object* left; struct _Object* right; };
+			};
+		} string;
 		
 		struct
 		{
-			struct _Object** members;
+			Value* members;
 			int length;
 			int capacity;
 		} array;
@@ -174,22 +243,101 @@ typedef struct _Object
 		struct { struct _Object* env; int index; Word isExtern; } func;
 		 
 		// TODO: change this so it doesn't use anon structs
-		struct { Dict dict; struct _Object* meta; };
+		struct { Dict* dict; struct _Object* meta; char weakMode; };
 
 		struct _VMThread* thread;
+
+		// a weak reference doesn't keep its target alive; the collector sets
+		// it to NULL once the target is found dead
+		struct _Object* weak;
+
+		// an instance of a usertype; it behaves like a dict with exactly the
+		// type's fields in it (and is turned into one if that stops being true)
+		struct
+		{
+			Value* members;		// one per field of the type
+			int typeIndex;		// into vm->structTypes
+		} structure;
+
+		Map* map;
 	};
 } Object;
+
+// strings at most this long are interned when they're created
+#define MAX_SHORT_STRING_LENGTH		40
+
+// concatenations which produce strings at least this long are done lazily
+// (see the string struct above)
+#define MIN_ROPE_LENGTH				128
+
+const char* FlattenRope(Object* obj);
+
+// returns the characters of a string object (flattening it first if it's a rope)
+static inline const char* GetStringChars(Object* obj)
+{
+	return obj->string.isRope ? FlattenRope(obj) : obj->string.raw;
+}
+
+static inline char StringsEqual(Object* a, Object* b)
+{
+	if(a == b) return MINT_TRUE;
+	// there is only ever one interned string with the same contents
+	if(a->string.interned && b->string.interned) return MINT_FALSE;
+	if(a->string.length != b->string.length) return MINT_FALSE;
+	
+	const char* ca = GetStringChars(a);
+	const char* cb = GetStringChars(b);
+	return a->string.hash == b->string.hash && memcmp(ca, cb, a->string.length) == 0;
+}
+
+static inline ObjectType GetValueType(Value value)
+{
+	if(IS_NUMBER(value)) return OBJ_NUMBER;
+	if(IS_OBJECT(value)) return AS_OBJECT(value)->type;
+	if(IS_BOOL(value)) return OBJ_BOOL;
+	return OBJ_NULL;
+}
+
+// whether a weak key or value can be collected (see WEAK_KEYS)
+static inline char IsWeakReferent(Value value)
+{
+	return IS_OBJECT(value) && AS_OBJECT(value)->type != OBJ_STRING;
+}
  
-#define MAX_INDIR						1024
+#define MAX_INDIR						1280
 #define MAX_STACK						4096
-#define INIT_GC_THRESH					32
 #ifdef MINT_FFI_SUPPORT
 #define MAX_TRACKED_CALLSTACK_LENGTH 	8
 #define MAX_CIF_ARGS					32
 #define CIF_STACK_SIZE					4096
 #endif
 #define NATIVE_STACK_SIZE				4096
-#define VM_BIN_MAGIC					"MINT"
+// binary files start with the magic and then the version of the format they
+// were written in (see OutputCode). The version goes up whenever the layout or
+// the instruction set changes; LoadBinaryFile rejects newer versions and
+// DecodeProgram older ones. Files from before there was a version (and from
+// before the register forms of instructions) start with "MINT" instead
+#define VM_BIN_MAGIC					"MINV"
+#define VM_BIN_VERSION					1
+
+// What is done when a function which the vm called by itself (an operator
+// overload or an arraysort comparator) returns. These functions run in an
+// ordinary frame instead of a nested interpreter loop, so they can yield; the
+// rest of the instruction which called them is done once they return.
+typedef enum
+{
+	RESUME_NONE,				// the return value is left in retVal (ordinary calls)
+	RESUME_PUSH_RETVAL,
+	RESUME_PUSH_NOT_RETVAL,		// pushes whether the return value is false (for OP_NEQU)
+	RESUME_ARRAYSORT,			// does the next step of the arraysort whose state is on top of the stack
+	RESUME_SETLOCAL,			// stores the return value in the slot given by the last operand (for the _TO register forms)
+	RESUME_GOTOZ,				// jumps to the last operand if the return value is false (for the _GOTOZ register forms)
+} ResumeKind;
+
+// Every frame takes up FRAME_SIZE entries of the indir stack: the number of
+// arguments, the previous fp, the return pc, the native stack size and the
+// ResumeKind (in that order)
+#define FRAME_SIZE						5
 
 typedef struct _VMThread
 {
@@ -205,16 +353,95 @@ typedef struct _VMThread
 	int indirStack[MAX_INDIR];
 	int indirStackSize;
 
-	Object* stack[MAX_STACK];
+	Value stack[MAX_STACK];
 	int stackSize;
 	
 	// NOTE: When pc < 0, the thread is done working
 	int pc, fp;
 	int numExpandedArgs;
 
-	Object* retVal;
+	Value retVal;
 } VMThread;
 
+// Inline cache of an OP_DICT_GET/OP_DICT_SET. Dicts which get the same keys
+// put into them in the same order have each key at the same index of their
+// entries, so the cache remembers the index the key was at for the last few
+// layouts it saw. A cached index is only used if its entry still holds the
+// key, so it can't go stale.
+#define DICT_CACHE_SIZE		4
+
+typedef struct
+{
+	struct _Object* key;		// the (interned) string constant which is accessed
+	int indices[DICT_CACHE_SIZE];
+	int numIndices;				// -1 once the site has seen too many layouts
+} DictCache;
+
+// The operators which can be overloaded by putting functions with these names
+// (see MetaOperatorNames) into a metadict
+typedef enum
+{
+	META_ADD,
+	META_SUB,
+	META_MUL,
+	META_DIV,
+	META_MOD,
+	META_OR,
+	META_AND,
+	META_LT,
+	META_LTE,
+	META_GT,
+	META_GTE,
+	META_LOGICAL_AND,
+	META_LOGICAL_OR,
+	META_SHL,
+	META_SHR,
+	META_EQUALS,
+	META_GETINDEX,
+	META_SETINDEX,
+	META_CALL,
+	META_LENGTH,
+	META_NEG,
+	META_NOT,
+	NUM_META_OPERATORS
+} MetaOperator;
+
+extern const char* MetaOperatorNames[NUM_META_OPERATORS];
+
+#define META_MISSING		-1		// the metadict doesn't overload the operator
+#define META_UNRESOLVED		-2		// the operator hasn't been looked up since the metadict changed
+
+// Which entry of a metadict holds each of its overloads, so operators don't
+// have to look them up by name. The indices are only valid as long as the
+// dict's version is the one they were found at.
+typedef struct _MetaCache
+{
+	uint32_t version;
+	int indices[NUM_META_OPERATORS];
+} MetaCache;
+
+// The fields of a usertype whose instances are structs; the compiler writes
+// these into the binary file
+typedef struct
+{
+	char* name;
+	int numFields;
+	struct _Object** keys;		// the interned names of the fields (in declaration order)
+} StructType;
+
+// The program is decoded into these when it's loaded (see DecodeProgram): the
+// opcode and each of its operands take up one, jump targets and pcs are
+// indices into the decoded code and operands which index one of the
+// constant tables point straight at the constant instead
+typedef union
+{
+	int i;
+	Value value;				// OP_PUSH_NUMBER
+	struct _Object* obj;		// OP_PUSH_STRING and OP_FILE
+	DictCache* cache;			// OP_DICT_SET and OP_DICT_GET
+	Value* global;				// OP_SET and OP_GET
+} Instr;
+
 typedef struct _VM
 {
 	VMThread mainThread;
@@ -222,9 +449,12 @@ typedef struct _VM
 	// NOTE: This is the current thread
 	VMThread* thread;
 
-	Word* program;
+	Word* program;				// as it was loaded
 	int programLength;
 	
+	Instr* code;				// what actually runs
+	int codeLength;
+	
 	int entryPoint;
 	
 	int numFunctions;
@@ -243,16 +473,23 @@ typedef struct _VM
 	
 	int numStringConstants;
 	char** stringConstants;
+	Object** stringConstantObjects;	// interned when the program is loaded
+
+	StringTable strings;
+
+	int numDictCaches;
+	DictCache* dictCaches;
+
+	int numStructTypes;
+	StructType* structTypes;
 	
-	Object* gcHead;
-	Object* freeHead;
+	Heap heap;
 	
 	int numObjects;
-	int maxObjectsUntilGc;
 
 	char** globalNames;
 	int numGlobals;
-	Object** globals;
+	Value* globals;
 
 	char** externNames;
 	ExternFunction* externs;
@@ -286,6 +523,10 @@ void ResetVM(VM* vm);
 
 void LoadBinaryFile(VM* vm, FILE* in);
 
+// Pc in vm->code of the instruction at the given position in the loaded
+// program (-1 if there isn't one there)
+int GetDecodedPc(VM* vm, int pc);
+
 void HookStandardLibrary(VM* vm);
 void HookExtern(VM* vm, const char* name, ExternFunction func);
 void HookExternNoWarn(VM* vm, const char* name, ExternFunction func);
@@ -296,25 +537,39 @@ int GetFunctionId(VM* vm, const char* name);
 void CallFunction(VM* vm, int id, Word numArgs);
 
 int GetGlobalId(VM* vm, const char* name);
-Object* GetGlobal(VM* vm, int id);
+Value GetGlobal(VM* vm, int id);
 void SetGlobal(VM* vm, int id);	// set global to object on top of stack
 
+void PushValue(VM* vm, Value value);
 void PushObject(VM* vm, Object* obj);
 void PushBool(VM* vm, char value);
 void PushNumber(VM* vm, double value);
 void PushString(VM* vm, const char* string);
+// returns the interned string with the given contents (creating it if it doesn't exist)
+Object* InternString(VM* vm, const char* string, int length);
+// returns the interned string equal to obj (obj itself becomes interned if there isn't one)
+Object* InternStringObject(VM* vm, Object* obj);
 Object* PushFunc(VM* vm, int id, Word isExtern, Object* env);
 Object* PushArray(VM* vm, int length);
 Object* PushDict(VM* vm);
-void PushNative(VM* vm, void* native, void (*onFree)(void*), void (*onMark)(void*));
+// entries whose value is collected are removed from the dict (weakMode can only be WEAK_VALUES)
+Object* PushWeakDict(VM* vm, char weakMode);
+Object* PushNative(VM* vm, void* native, void (*onFree)(void*), void (*onMark)(void*));
 void PushThread(VM* vm, Object* funcObj);
+Object* PushWeak(VM* vm, Object* target);
+// the members of the struct are all null
+Object* PushStruct(VM* vm, int typeIndex);
+Object* PushMap(VM* vm);
+// entries whose weak key or value (see WEAK_KEYS, WEAK_VALUES) is collected are removed from the map
+Object* PushWeakMap(VM* vm, char weakMode);
 void PushNull(VM* vm);
 
+Value PopValue(VM* vm);
 Object* PopObject(VM* vm);
 char PopBool(VM* vm);
 double PopNumber(VM* vm);
 const char* PopString(VM* vm);
-Object** PopArray(VM* vm, int* length);
+Value* PopArray(VM* vm, int* length);
 void* PopNative(VM* vm);
 void* PopNativeOrNull(VM* vm);
 VMThread* PopThread(VM* vm);
@@ -322,9 +577,11 @@ VMThread* PopThread(VM* vm);
 Object* PopStringObject(VM* vm);
 Object* PopFuncObject(VM* vm);
 Object* PopArrayObject(VM* vm);
+// NOTE: a struct is turned into a dict
 Object* PopDict(VM* vm);
 Object* PopNativeObject(VM* vm);
 Object* PopThreadObject(VM* vm);
+Object* PopWeakObject(VM* vm);
 
 void* NativeStackAlloc(VM* vm, size_t size);
 
@@ -335,7 +592,60 @@ void ExecuteCycle(VM* vm);
 
 void RunVM(VM* vm);
 
+extern const char* ObjectTypeNames[];
+
+// gc.c
+void InitHeap(Heap* heap);
+Object* NewObject(VM* vm, ObjectType type);
+void MarkObject(VM* vm, Object* obj);
+void MarkValue(VM* vm, Value val);
+void RememberObject(VM* vm, Object* obj);
+// Records how many bytes 'obj' has allocated outside of the heap (array members,
+// dict tables, native buffers and so on) so collections can be paced by memory
+// use; natives should call this with the size of whatever they point to
+void SetExternalSize(VM* vm, Object* obj, size_t size);
+// Same as SetExternalSize for code which doesn't have the vm at hand (the heap
+// is found through the page the object lives in)
+void SetObjectExternalSize(Object* obj, size_t size);
+// Changes the type of an object in place (the union has to be set up for the
+// new type afterwards); its external size is reset to 0
+void ChangeObjectType(VM* vm, Object* obj, ObjectType type);
+void GetGcStats(VM* vm, GcStats* stats);
+// Must be called on every dict or map with a weakMode (weak references are registered
+// by NewObject) so the collector can clear its dead entries
+void RegisterWeakObject(VM* vm, Object* obj);
+// Must be called on objects found through a weak reference (the string table)
+// before they're used, since the collector might have decided they're dead
+void ReadBarrier(VM* vm, Object* obj);
+void CollectGarbageMinor(VM* vm);
+// Does (roughly) 'budget' units of incremental collection work, starting a new
+// collection if none is in progress; returns MINT_TRUE if the collection finished
+char CollectGarbageStep(VM* vm, int budget);
+// Does whatever collection work is due; this happens on every allocation, but
+// externs allocate with the collector disabled so it's also called after them
+void CollectGarbageIfNeeded(VM* vm);
 void CollectGarbage(VM* vm);
+void FreeHeap(VM* vm);
+
+// Must be called when a reference to 'child' is stored inside of 'parent' so
+// the collector can find old objects which point into the nursery and so that
+// incremental marking never misses an object stored into an already scanned one
+static inline void WriteBarrier(VM* vm, Object* parent, Value child)
+{
+	if(!IS_OBJECT(child)) return;
+
+	if(vm->heap.state == GC_MARKING)
+	{
+		if(!IsObjectMarked(AS_OBJECT(child)))
+			MarkObject(vm, AS_OBJECT(child));
+	}
+	else if(IsObjectOld(parent) && !IsObjectOld(AS_OBJECT(child)))
+		RememberObject(vm, parent);
+}
+
+// snapshot.c
+// Writes every object reachable from the roots to 'out' (see snapshot.h)
+void WriteHeapSnapshot(VM* vm, FILE* out);
 
 void DeleteVM(VM* vm);
 
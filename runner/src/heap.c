@@ -0,0 +1,585 @@
+// heap.c -- reads a heap snapshot written by the vm (see snapshot.h) and reports what is keeping memory alive
+/*
+ * usage: mint-heap <snapshot> [-top N] [-path TYPE] [-count N]
+ *
+ * Prints how much memory each type of object takes up and the N objects which
+ * retain the most memory (the bytes which would be freed if nothing else
+ * referenced them) along with the shortest path from a root to each one.
+ * With -path, the shortest paths from the roots to (up to -count) objects of
+ * the given type are printed as well.
+ */
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+static void ErrorExit(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	exit(1);
+}
+
+static void* emalloc(size_t size)
+{
+	void* mem = malloc(size);
+	if(!mem) ErrorExit("Out of memory!\n");
+	return mem;
+}
+
+static void* erealloc(void* mem, size_t newSize)
+{
+	void* newMem = realloc(mem, newSize);
+	if(!newMem) ErrorExit("Out of memory!\n");
+	return newMem;
+}
+
+static char* estrdup(const char* s)
+{
+	char* copy = emalloc(strlen(s) + 1);
+	strcpy(copy, s);
+	return copy;
+}
+
+#define MAX_TYPES 32
+
+typedef struct
+{
+	int type;
+	size_t size;
+	char* label;
+} HeapObject;
+
+typedef struct
+{
+	int from;	// -1 for roots
+	int to;
+	char* name;
+} HeapEdge;
+
+static const char* TypeNames[MAX_TYPES];
+static int NumTypes = 0;
+
+static HeapObject* Objects = NULL;
+static int NumObjects = 0;
+static int ObjectsCapacity = 0;
+
+static HeapEdge* Edges = NULL;
+static int NumEdges = 0;
+static int EdgesCapacity = 0;
+
+// edges leaving/entering every node; the roots are node NumObjects
+static int* SuccStart;
+static int* Succ;
+static int* PredStart;
+static int* Pred;
+
+// the edge every object was first reached through (by a breadth first search
+// from the roots, so this gives the shortest path to it) and its distance
+static int* ParentEdge;
+static int* Depth;
+
+static int* Dominator;
+static size_t* Retained;
+
+static int GetTypeIndex(const char* name)
+{
+	for(int i = 0; i < NumTypes; ++i)
+	{
+		if(strcmp(TypeNames[i], name) == 0)
+			return i;
+	}
+
+	if(NumTypes >= MAX_TYPES)
+		ErrorExit("Too many object types in snapshot\n");
+
+	TypeNames[NumTypes] = estrdup(name);
+	return NumTypes++;
+}
+
+// reads a quoted string (see snapshot.h) starting at 's' into 'buf'
+static void ReadQuoted(const char* s, char* buf, int lineNumber)
+{
+	while(*s == ' ') ++s;
+	if(*s != '"')
+		ErrorExit("Expected a quoted string on line %d of snapshot\n", lineNumber);
+	++s;
+
+	while(*s && *s != '"')
+	{
+		if(*s == '\\')
+		{
+			++s;
+			if(*s == 'n') *buf++ = '\n';
+			else if(*s) *buf++ = *s;
+			else break;
+			++s;
+		}
+		else
+			*buf++ = *s++;
+	}
+	*buf = '\0';
+
+	if(*s != '"')
+		ErrorExit("Unterminated string on line %d of snapshot\n", lineNumber);
+}
+
+static void AddEdge(int from, int to, const char* name)
+{
+	if(NumEdges >= EdgesCapacity)
+	{
+		EdgesCapacity = EdgesCapacity ? EdgesCapacity * 2 : 1024;
+		Edges = erealloc(Edges, sizeof(HeapEdge) * EdgesCapacity);
+	}
+
+	Edges[NumEdges].from = from;
+	Edges[NumEdges].to = to;
+	Edges[NumEdges].name = estrdup(name);
+	++NumEdges;
+}
+
+static void ReadSnapshot(FILE* in)
+{
+	// NOTE: labels are cut off at SNAPSHOT_MAX_LABEL, but root names aren't
+	static char line[4096];
+	static char text[4096];
+	char typeName[64];
+	int lineNumber = 1;
+
+	int version;
+	if(!fgets(line, sizeof(line), in) || sscanf(line, SNAPSHOT_HEADER " %d", &version) != 1)
+		ErrorExit("Not a heap snapshot\n");
+	if(version != SNAPSHOT_VERSION)
+		ErrorExit("Unsupported snapshot version %d (expected %d)\n", version, SNAPSHOT_VERSION);
+
+	while(fgets(line, sizeof(line), in))
+	{
+		++lineNumber;
+
+		int id, from, to, n;
+		unsigned long size;
+
+		if(line[0] == 'o' && sscanf(line, "o %d %63s %lu%n", &id, typeName, &size, &n) == 3)
+		{
+			ReadQuoted(line + n, text, lineNumber);
+
+			// objects are written in id order
+			if(id != NumObjects)
+				ErrorExit("Object ids out of order on line %d of snapshot\n", lineNumber);
+
+			if(NumObjects >= ObjectsCapacity)
+			{
+				ObjectsCapacity = ObjectsCapacity ? ObjectsCapacity * 2 : 1024;
+				Objects = erealloc(Objects, sizeof(HeapObject) * ObjectsCapacity);
+			}
+
+			Objects[NumObjects].type = GetTypeIndex(typeName);
+			Objects[NumObjects].size = size;
+			Objects[NumObjects].label = estrdup(text);
+			++NumObjects;
+		}
+		else if(line[0] == 'e' && sscanf(line, "e %d %d%n", &from, &to, &n) == 2)
+		{
+			ReadQuoted(line + n, text, lineNumber);
+			AddEdge(from, to, text);
+		}
+		else if(line[0] == 'r' && sscanf(line, "r %d%n", &to, &n) == 1)
+		{
+			ReadQuoted(line + n, text, lineNumber);
+			AddEdge(-1, to, text);
+		}
+		else if(line[0] != '\n')
+			ErrorExit("Invalid line %d in snapshot\n", lineNumber);
+	}
+
+	for(int i = 0; i < NumEdges; ++i)
+	{
+		if(Edges[i].from >= NumObjects || Edges[i].to < 0 || Edges[i].to >= NumObjects)
+			ErrorExit("Edge refers to an object which isn't in the snapshot\n");
+	}
+}
+
+// Builds the successor and predecessor lists (as edge indices into Edges for
+// successors and node indices for predecessors)
+static void BuildGraph(void)
+{
+	int numNodes = NumObjects + 1;
+
+	SuccStart = calloc(numNodes + 1, sizeof(int));
+	PredStart = calloc(numNodes + 1, sizeof(int));
+	Succ = emalloc(sizeof(int) * (NumEdges + 1));
+	Pred = emalloc(sizeof(int) * (NumEdges + 1));
+	if(!SuccStart || !PredStart) ErrorExit("Out of memory!\n");
+
+	for(int i = 0; i < NumEdges; ++i)
+	{
+		int from = Edges[i].from < 0 ? NumObjects : Edges[i].from;
+		++SuccStart[from + 1];
+		++PredStart[Edges[i].to + 1];
+	}
+
+	for(int i = 0; i < numNodes; ++i)
+	{
+		SuccStart[i + 1] += SuccStart[i];
+		PredStart[i + 1] += PredStart[i];
+	}
+
+	int* succPos = emalloc(sizeof(int) * numNodes);
+	int* predPos = emalloc(sizeof(int) * numNodes);
+	memcpy(succPos, SuccStart, sizeof(int) * numNodes);
+	memcpy(predPos, PredStart, sizeof(int) * numNodes);
+
+	for(int i = 0; i < NumEdges; ++i)
+	{
+		int from = Edges[i].from < 0 ? NumObjects : Edges[i].from;
+		Succ[succPos[from]++] = i;
+		Pred[predPos[Edges[i].to]++] = from;
+	}
+
+	free(succPos);
+	free(predPos);
+}
+
+static void FindShortestPaths(void)
+{
+	int root = NumObjects;
+	int* queue = emalloc(sizeof(int) * (NumObjects + 1));
+	int head = 0, tail = 0;
+
+	ParentEdge = emalloc(sizeof(int) * (NumObjects + 1));
+	Depth = emalloc(sizeof(int) * (NumObjects + 1));
+
+	for(int i = 0; i <= NumObjects; ++i)
+	{
+		ParentEdge[i] = -1;
+		Depth[i] = -1;
+	}
+
+	Depth[root] = 0;
+	queue[tail++] = root;
+
+	while(head < tail)
+	{
+		int node = queue[head++];
+
+		for(int i = SuccStart[node]; i < SuccStart[node + 1]; ++i)
+		{
+			int to = Edges[Succ[i]].to;
+			if(Depth[to] >= 0) continue;
+
+			Depth[to] = Depth[node] + 1;
+			ParentEdge[to] = Succ[i];
+			queue[tail++] = to;
+		}
+	}
+
+	free(queue);
+}
+
+static int Intersect(const int* postorder, int a, int b)
+{
+	while(a != b)
+	{
+		while(postorder[a] < postorder[b]) a = Dominator[a];
+		while(postorder[b] < postorder[a]) b = Dominator[b];
+	}
+	return a;
+}
+
+// Finds the immediate dominator of every object (using the iterative algorithm
+// from "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy) and
+// from that the number of bytes each one retains
+static void FindRetainedSizes(void)
+{
+	int numNodes = NumObjects + 1;
+	int root = NumObjects;
+
+	int* postorder = emalloc(sizeof(int) * numNodes);
+	int* order = emalloc(sizeof(int) * numNodes);		// nodes in postorder
+	int* stack = emalloc(sizeof(int) * numNodes);
+	int* next = emalloc(sizeof(int) * numNodes);		// next successor to visit
+	int numOrdered = 0;
+
+	for(int i = 0; i < numNodes; ++i)
+	{
+		postorder[i] = -1;
+		next[i] = SuccStart[i];
+	}
+
+	// iterative depth first search; postorder[node] is -2 while it's on the stack
+	int top = 0;
+	stack[top++] = root;
+	postorder[root] = -2;
+
+	while(top > 0)
+	{
+		int node = stack[top - 1];
+
+		if(next[node] < SuccStart[node + 1])
+		{
+			int to = Edges[Succ[next[node]++]].to;
+			if(postorder[to] == -1)
+			{
+				postorder[to] = -2;
+				stack[top++] = to;
+			}
+		}
+		else
+		{
+			postorder[node] = numOrdered;
+			order[numOrdered++] = node;
+			--top;
+		}
+	}
+
+	Dominator = emalloc(sizeof(int) * numNodes);
+	for(int i = 0; i < numNodes; ++i)
+		Dominator[i] = -1;
+	Dominator[root] = root;
+
+	char changed = 1;
+	while(changed)
+	{
+		changed = 0;
+
+		// reverse postorder, skipping the root (which is last)
+		for(int i = numOrdered - 2; i >= 0; --i)
+		{
+			int node = order[i];
+			int newDominator = -1;
+
+			for(int j = PredStart[node]; j < PredStart[node + 1]; ++j)
+			{
+				int pred = Pred[j];
+				if(Dominator[pred] < 0) continue;
+
+				if(newDominator < 0)
+					newDominator = pred;
+				else
+					newDominator = Intersect(postorder, pred, newDominator);
+			}
+
+			if(Dominator[node] != newDominator)
+			{
+				Dominator[node] = newDominator;
+				changed = 1;
+			}
+		}
+	}
+
+	// every object is done before its dominator in postorder
+	Retained = calloc(numNodes, sizeof(size_t));
+	if(!Retained) ErrorExit("Out of memory!\n");
+
+	for(int i = 0; i < numOrdered - 1; ++i)
+	{
+		int node = order[i];
+		Retained[node] += Objects[node].size;
+		Retained[Dominator[node]] += Retained[node];
+	}
+
+	free(postorder);
+	free(order);
+	free(stack);
+	free(next);
+}
+
+static void PrintObject(int id)
+{
+	printf("%s #%d", TypeNames[Objects[id].type], id);
+	if(Objects[id].label[0])
+	{
+		printf(" \"");
+		for(const char* s = Objects[id].label; *s; ++s)
+		{
+			if(*s == '\n') printf("\\n");
+			else if(*s == '"' || *s == '\\') printf("\\%c", *s);
+			else putchar(*s);
+		}
+		printf("\"");
+	}
+}
+
+static void PrintPath(int id)
+{
+	if(Depth[id] < 0)
+	{
+		printf("    (unreachable)\n");
+		return;
+	}
+
+	int* path = emalloc(sizeof(int) * (Depth[id] + 1));
+	int length = 0;
+
+	for(int node = id; ParentEdge[node] >= 0; node = Edges[ParentEdge[node]].from < 0 ? NumObjects : Edges[ParentEdge[node]].from)
+		path[length++] = ParentEdge[node];
+
+	printf("    ");
+	for(int i = length - 1; i >= 0; --i)
+	{
+		printf("%s", Edges[path[i]].name);
+		if(i > 0)
+			printf(" -> ");
+	}
+	printf("\n");
+
+	free(path);
+}
+
+static void PrintSummary(void)
+{
+	int counts[MAX_TYPES] = { 0 };
+	size_t bytes[MAX_TYPES] = { 0 };
+	size_t total = 0;
+
+	for(int i = 0; i < NumObjects; ++i)
+	{
+		++counts[Objects[i].type];
+		bytes[Objects[i].type] += Objects[i].size;
+		total += Objects[i].size;
+	}
+
+	int sorted[MAX_TYPES];
+	for(int i = 0; i < NumTypes; ++i)
+		sorted[i] = i;
+
+	for(int i = 1; i < NumTypes; ++i)
+	{
+		int type = sorted[i];
+		int j = i;
+		for(; j > 0 && bytes[sorted[j - 1]] < bytes[type]; --j)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = type;
+	}
+
+	printf("%d objects, %lu bytes\n\n", NumObjects, (unsigned long)total);
+	printf("%-10s %10s %14s\n", "type", "count", "bytes");
+	for(int i = 0; i < NumTypes; ++i)
+		printf("%-10s %10d %14lu\n", TypeNames[sorted[i]], counts[sorted[i]], (unsigned long)bytes[sorted[i]]);
+}
+
+static int CompareRetained(const void* a, const void* b)
+{
+	size_t ra = Retained[*(const int*)a];
+	size_t rb = Retained[*(const int*)b];
+
+	if(ra != rb)
+		return ra > rb ? -1 : 1;
+	return *(const int*)a - *(const int*)b;
+}
+
+static void PrintTopRetainers(int count)
+{
+	int* sorted = emalloc(sizeof(int) * (NumObjects + 1));
+	for(int i = 0; i < NumObjects; ++i)
+		sorted[i] = i;
+
+	qsort(sorted, NumObjects, sizeof(int), CompareRetained);
+
+	if(count > NumObjects)
+		count = NumObjects;
+
+	printf("\ntop %d retainers:\n", count);
+	for(int i = 0; i < count; ++i)
+	{
+		int id = sorted[i];
+		printf("%12lu bytes retained (%lu self) by ", (unsigned long)Retained[id], (unsigned long)Objects[id].size);
+		PrintObject(id);
+		printf("\n");
+		PrintPath(id);
+	}
+
+	free(sorted);
+}
+
+static void PrintPathsToType(const char* typeName, int count)
+{
+	int type = -1;
+	for(int i = 0; i < NumTypes; ++i)
+	{
+		if(strcmp(TypeNames[i], typeName) == 0)
+			type = i;
+	}
+
+	int total = 0;
+	for(int i = 0; i < NumObjects; ++i)
+	{
+		if(Objects[i].type == type)
+			++total;
+	}
+
+	printf("\nshortest paths to %s objects (%d of them):\n", typeName, total);
+
+	// NOTE: the snapshot hands out ids breadth first, but the objects are
+	// ordered by their depth here anyway so this doesn't depend on that
+	int printed = 0;
+	int maxDepth = 0;
+	for(int i = 0; i < NumObjects; ++i)
+	{
+		if(Depth[i] > maxDepth)
+			maxDepth = Depth[i];
+	}
+
+	for(int depth = 1; depth <= maxDepth && printed < count; ++depth)
+	{
+		for(int i = 0; i < NumObjects && printed < count; ++i)
+		{
+			if(Objects[i].type != type || Depth[i] != depth) continue;
+
+			PrintObject(i);
+			printf(" (%lu bytes retained)\n", (unsigned long)Retained[i]);
+			PrintPath(i);
+			++printed;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = NULL;
+	const char* pathType = NULL;
+	int top = 10;
+	int count = 10;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "-top") == 0 && i + 1 < argc)
+			top = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-path") == 0 && i + 1 < argc)
+			pathType = argv[++i];
+		else if(strcmp(argv[i], "-count") == 0 && i + 1 < argc)
+			count = atoi(argv[++i]);
+		else if(!path)
+			path = argv[i];
+		else
+			ErrorExit("Unexpected argument '%s'\n", argv[i]);
+	}
+
+	if(!path)
+		ErrorExit("usage: %s <snapshot> [-top N] [-path TYPE] [-count N]\n", argv[0]);
+
+	FILE* in = fopen(path, "r");
+	if(!in)
+		ErrorExit("Cannot open file '%s' for reading\n", path);
+
+	ReadSnapshot(in);
+	fclose(in);
+
+	BuildGraph();
+	FindShortestPaths();
+	FindRetainedSizes();
+
+	PrintSummary();
+
+	if(top > 0)
+		PrintTopRetainers(top);
+
+	if(pathType)
+		PrintPathsToType(pathType, count);
+
+	return 0;
+}
@@ -55,6 +55,10 @@ int main(int argc, char* argv[])
 			compile = 1;
 		else if(strcmp(argv[i], "-g") == 0)
 			ProduceDebugInfo = 1;
+		else if(strcmp(argv[i], "-stack") == 0)
+			ProduceStackCode = 1;
+		else if(strcmp(argv[i], "-gcthreads") == 0 || strcmp(argv[i], "-gcgrowth") == 0 || strcmp(argv[i], "-gclimit") == 0)
+			++i;
 		else if(strcmp(argv[i], "-l") == 0)
 		{		
 			/*FILE* in = fopen(argv[++i], "rb");
@@ -132,14 +136,30 @@ int main(int argc, char* argv[])
 				}
 
 				char debugFlag = 0;
+				int gcThreads = 0;
+				double gcGrowth = 0;
+				double gcLimitMb = 0;
 				for (int i = 2; i < argc; ++i)
 				{
 					if (strcmp(argv[i], "-g") == 0)
 						debugFlag = 1;
+					else if (strcmp(argv[i], "-gcthreads") == 0 && i + 1 < argc)
+						gcThreads = atoi(argv[++i]);
+					else if (strcmp(argv[i], "-gcgrowth") == 0 && i + 1 < argc)
+						gcGrowth = atof(argv[++i]);
+					else if (strcmp(argv[i], "-gclimit") == 0 && i + 1 < argc)
+						gcLimitMb = atof(argv[++i]);
 				}
 				VM* vm = NewVM();
 
 				vm->debug = debugFlag;
+				if (gcThreads > 0)
+					vm->heap.numMarkThreads = gcThreads;
+				if (gcGrowth > 1)
+					vm->heap.growthFactor = gcGrowth;
+				// the limit is given in megabytes
+				if (gcLimitMb > 0)
+					vm->heap.maxBytes = (size_t)(gcLimitMb * 1024 * 1024);
 
 				LoadBinaryFile(vm, bin);
 				fclose(bin);
@@ -2,6 +2,16 @@
 
 int EntryPoint = 0;
 
+// string constant index of the key of each inline cache
+int* DictCacheKeys = NULL;
+int NumDictCaches = 0;
+int DictCachesCapacity = 0;
+
+// usertypes which have instances that are structs
+TypeHint** StructTypes = NULL;
+int NumStructTypes = 0;
+int StructTypesCapacity = 0;
+
 Word* Code = NULL;
 int CodeCapacity = 0;
 int CodeLength = 0;
@@ -51,8 +61,50 @@ void EmplaceInt(int loc, int value)
 		Code[loc + i] = *code++;
 }
 
+int AddDictCache(int key)
+{
+	if(NumDictCaches >= DictCachesCapacity)
+	{
+		DictCachesCapacity = DictCachesCapacity ? DictCachesCapacity * 2 : 8;
+
+		void* newKeys = realloc(DictCacheKeys, sizeof(int) * DictCachesCapacity);
+		assert(newKeys);
+		DictCacheKeys = newKeys;
+	}
+
+	DictCacheKeys[NumDictCaches] = key;
+	return NumDictCaches++;
+}
+
+int GetStructTypeIndex(TypeHint* type)
+{
+	assert(type->hint == USERTYPE);
+
+	if(type->user.structIndex >= 0)
+		return type->user.structIndex;
+
+	if(NumStructTypes >= StructTypesCapacity)
+	{
+		StructTypesCapacity = StructTypesCapacity ? StructTypesCapacity * 2 : 8;
+
+		void* newTypes = realloc(StructTypes, sizeof(TypeHint*) * StructTypesCapacity);
+		assert(newTypes);
+		StructTypes = newTypes;
+	}
+
+	// NOTE: the field names have to be string constants by the time the code is output
+	for(int i = 0; i < type->user.numElements; ++i)
+		RegisterString(type->user.names[i]);
+
+	StructTypes[NumStructTypes] = type;
+	type->user.structIndex = NumStructTypes++;
+
+	return type->user.structIndex;
+}
+
 /* BINARY FORMAT:
 VM_BIN_MAGIC, see vm.h
+VM_BIN_VERSION as integer
 
 entry point as integer
 
@@ -77,6 +129,12 @@ number constants as doubles
 number of string constants
 string length followed by string as chars
 
+number of dict access caches (the operand of OP_DICT_GET and OP_DICT_SET is an index into these) as integer
+string constant index of the key each cache is for as integers
+
+number of struct types (the first operand of OP_PUSH_STRUCT, OP_STRUCT_SET and OP_STRUCT_GET is an index into these) as integer
+for each one: name [string length followed by string as chars], number of fields as integer and the string constant index of each field's name as integers
+
 whether the program has code metadata (i.e line numbers and file names for errors) (represented by char)
 if so (length of each of the arrays below must be the same as program length):
 line numbers mapping to pcs
@@ -93,10 +151,15 @@ void OutputCode(FILE* out)
 	printf("Number of externs: %i\n", NumExterns);
 	printf("Number of numbers: %i\n", NumNumbers);
 	printf("Number of strings: %i\n", NumStrings);
+	printf("Number of dict caches: %i\n", NumDictCaches);
+	printf("Number of struct types: %i\n", NumStructTypes);
 	printf("=================================\n");
 	
 	const char magic[] = VM_BIN_MAGIC;
 	fwrite(magic, 1, sizeof(magic) - 1, out);
+	
+	int version = VM_BIN_VERSION;
+	fwrite(&version, sizeof(int), 1, out);
 
 	fwrite(&EntryPoint, sizeof(int), 1, out);
 	
@@ -175,4 +238,22 @@ void OutputCode(FILE* out)
 			fwrite(decl->string, sizeof(char), len, out);
 		}
 	}
+
+	fwrite(&NumDictCaches, sizeof(int), 1, out);
+	if(NumDictCaches > 0)
+		fwrite(DictCacheKeys, sizeof(int), NumDictCaches, out);
+
+	fwrite(&NumStructTypes, sizeof(int), 1, out);
+	for(int i = 0; i < NumStructTypes; ++i)
+	{
+		const TypeHint* type = StructTypes[i];
+
+		int len = strlen(type->user.name);
+		fwrite(&len, sizeof(int), 1, out);
+		fwrite(type->user.name, sizeof(char), len, out);
+
+		fwrite(&type->user.numElements, sizeof(int), 1, out);
+		for(int j = 0; j < type->user.numElements; ++j)
+			fwrite(&RegisterString(type->user.names[j])->index, sizeof(int), 1, out);
+	}
 }
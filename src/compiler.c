@@ -498,7 +498,6 @@ char CompileIntrinsic(Expr* exp, const char* name)
 			CompileValueExpr(exp->callx.args[i]);
 
 		AppendCode(OP_SET_META);
-		AppendCode(OP_SET_RETVAL);
 
 		return 1;
 	}
@@ -837,6 +836,129 @@ void GetVar(VarDecl* decl)
 	}
 }
 
+char ProduceStackCode = 0;
+
+// Returns the local variable (i.e frame slot) exp refers to if it can be the
+// operand of a register form (see OP_ADD_RR)
+static VarDecl* GetRegister(Expr* exp)
+{
+	if(ProduceStackCode || CompilingMacros)
+		return NULL;
+	if(exp->type != EXP_IDENT && exp->type != EXP_VAR)
+		return NULL;
+	
+	if(!exp->varx.varDecl)
+		exp->varx.varDecl = ReferenceVariable(exp->varx.name);
+	
+	VarDecl* decl = exp->varx.varDecl;
+	return decl && !decl->isGlobal ? decl : NULL;
+}
+
+// Returns the register form (the one which pushes its result) of the binary
+// expression exp, or -1 if it has to be compiled to the stack form
+static int GetRegisterForm(Expr* exp)
+{
+	if(exp->type != EXP_BIN)
+		return -1;
+
+	int form;
+	switch(exp->binx.op)
+	{
+		case '+': form = OP_ADD_RR; break;
+		case '-': form = OP_SUB_RR; break;
+		case '*': form = OP_MUL_RR; break;
+		case '/': form = OP_DIV_RR; break;
+		case '<': form = OP_LT_RR; break;
+		case '>': form = OP_GT_RR; break;
+		case TOK_LTE: form = OP_LTE_RR; break;
+		case TOK_GTE: form = OP_GTE_RR; break;
+		default: return -1;
+	}
+	
+	if(!GetRegister(exp->binx.lhs))
+		return -1;
+	
+	if(GetBinaryOverload(InferTypeFromExpr(exp->binx.lhs), InferTypeFromExpr(exp->binx.rhs), exp->binx.op))
+		return -1;
+	
+	if(GetRegister(exp->binx.rhs))
+		return form;
+	if(exp->binx.rhs->type == EXP_NUMBER)
+		return form + 1;
+	return -1;
+}
+
+static char IsRelationalForm(int form)
+{
+	return form >= OP_LT_RR && form <= OP_GTE_RK_GOTOZ;
+}
+
+// NOTE: the form of exp must've come from GetRegisterForm
+static void AppendRegisterOperands(Expr* exp)
+{
+	AppendInt(exp->binx.lhs->varx.varDecl->index);
+	
+	if(exp->binx.rhs->type == EXP_NUMBER)
+		AppendInt(exp->binx.rhs->constDecl->index);
+	else
+		AppendInt(exp->binx.rhs->varx.varDecl->index);
+}
+
+// Compiles the condition of an if, while or for followed by a jump which is taken
+// if it's false; returns the location of the jump's operand (to be emplaced)
+static int CompileCondition(Expr* cond)
+{
+	int form = GetRegisterForm(cond);
+
+	if(form >= 0 && IsRelationalForm(form))
+	{
+		cond->pc = CodeLength;
+		// NOTE: the _GOTOZ form is two after the one which pushes the result
+		AppendCode(form + 2);
+		AppendRegisterOperands(cond);
+	}
+	else
+	{
+		CompileValueExpr(cond);
+		AppendCode(OP_GOTOZ);
+	}
+
+	int emplaceLoc = CodeLength;
+	AllocatePatch(sizeof(int) / sizeof(Word));
+	return emplaceLoc;
+}
+
+// Compiles dest = exp to a single register form if it can; returns MINT_FALSE
+// if it can't (and nothing has been compiled)
+static char CompileRegisterAssignment(VarDecl* dest, Expr* exp)
+{
+	int form = GetRegisterForm(exp);
+	
+	if(form >= 0 && !IsRelationalForm(form))
+	{
+		exp->pc = CodeLength;
+		// NOTE: the _TO form is two after the one which pushes the result
+		AppendCode(form + 2);
+		AppendRegisterOperands(exp);
+	}
+	else if(GetRegister(exp))
+	{
+		exp->pc = CodeLength;
+		AppendCode(OP_MOVE_R);
+		AppendInt(exp->varx.varDecl->index);
+	}
+	else if(exp->type == EXP_NUMBER && !ProduceStackCode && !CompilingMacros)
+	{
+		exp->pc = CodeLength;
+		AppendCode(OP_MOVE_K);
+		AppendInt(exp->constDecl->index);
+	}
+	else
+		return MINT_FALSE;
+	
+	AppendInt(dest->index);
+	return MINT_TRUE;
+}
 
 static void CheckMacroCall(Expr* exp)
 {
@@ -850,6 +972,132 @@ static void CheckMacroCall(Expr* exp)
 		ErrorExitE(exp, "Attempted to call '%s' using macro call operator '!' when it's not a macro\n", exp->callx.func->varx.name);	
 }
 
+// returns the name of the key of a pair in a dict literal (or NULL if the pair is invalid)
+static const char* GetDictLiteralKey(Expr* node)
+{
+	if(node->type != EXP_BIN || node->binx.op != '=')
+		return NULL;
+
+	if(node->binx.lhs->type == EXP_IDENT)
+		return node->binx.lhs->varx.name;
+	else if(node->binx.lhs->type == EXP_STRING)
+		return node->binx.lhs->constDecl->string;
+
+	return NULL;
+}
+
+// A dict literal which is cast to a usertype becomes a struct if it has every
+// field of the type (and nothing else)
+static char IsStructLiteral(const TypeHint* type, Expr* exp)
+{
+	if(exp->type != EXP_DICT_LITERAL || type->user.numElements <= 0)
+		return MINT_FALSE;
+
+	char hasField[MAX_STRUCT_ELEMENTS] = { 0 };
+	int numFields = 0;
+
+	for(Expr* node = exp->dictx.pairsHead; node; node = node->next)
+	{
+		const char* key = GetDictLiteralKey(node);
+		if(!key || strcmp(key, "pairs") == 0)
+			return MINT_FALSE;
+
+		int index = GetUserTypeElementIndex(type, key);
+		if(index < 0 || hasField[index])
+			return MINT_FALSE;
+
+		hasField[index] = MINT_TRUE;
+		++numFields;
+	}
+
+	return numFields == type->user.numElements;
+}
+
+// NOTE: when a value is expected the loop produces an array of the last
+// expression in its body (just like the array comprehension)
+static void CompileForIn(Expr* exp, char expectValue)
+{
+	VarDecl* comDecl = exp->forinx.comDecl;
+
+	if(expectValue)
+	{
+		AppendCode(OP_PUSH_NUMBER);
+		AppendInt(RegisterNumber(0)->index);
+
+		AppendCode(OP_CREATE_ARRAY);
+		SetVar(comDecl);
+	}
+
+	CompileValueExpr(exp->forinx.iterable);
+	AppendCode(OP_ITER_BEGIN);
+	SetVar(exp->forinx.iterDecl);
+
+	AppendCode(OP_PUSH_NUMBER);
+	AppendInt(RegisterNumber(-1)->index);
+	SetVar(exp->forinx.indexDecl);
+
+	PushPatchScope();
+
+	int loopPc = CodeLength;
+
+	GetVar(exp->forinx.indexDecl);
+	GetVar(exp->forinx.iterDecl);
+	AppendCode(OP_ITER_NEXT);
+	int emplaceLoc = CodeLength;
+	AllocatePatch(sizeof(int) / sizeof(Word));
+	SetVar(exp->forinx.indexDecl);
+
+	GetVar(exp->forinx.indexDecl);
+	GetVar(exp->forinx.iterDecl);
+	AppendCode(OP_ITER_KEY);
+	SetVar(exp->forinx.keyDecl);
+
+	if(exp->forinx.valueDecl)
+	{
+		GetVar(exp->forinx.indexDecl);
+		GetVar(exp->forinx.iterDecl);
+		AppendCode(OP_ITER_VALUE);
+		SetVar(exp->forinx.valueDecl);
+	}
+
+	for(Expr* node = exp->forinx.bodyHead; node != NULL; node = node->next)
+	{
+		if(expectValue && !node->next)
+		{
+			CompileValueExpr(node);
+			GetVar(comDecl);
+			AppendCode(OP_ARRAY_PUSH);
+		}
+		else
+			CompileExpr(node);
+	}
+
+	AppendCode(OP_GOTO);
+	AppendInt(loopPc);
+
+	int exitLoc = CodeLength;
+	EmplaceInt(emplaceLoc, CodeLength);
+
+	for(Patch* p = Patches; p != NULL; p = p->next)
+	{
+		if(p->scope == CurrentPatchScope)
+		{
+			if(p->type == PATCH_CONTINUE) EmplaceInt(p->loc, loopPc);
+			else if(p->type == PATCH_BREAK) EmplaceInt(p->loc, exitLoc);
+		}
+	}
+
+	ClearPatches();
+	PopPatchScope();
+
+	// the loop shouldn't keep the container alive once it's done
+	AppendCode(OP_PUSH_NULL);
+	SetVar(exp->forinx.iterDecl);
+
+	if(expectValue)
+		GetVar(comDecl);
+}
+
 void CompileExprList(Expr* head);
 // Expression should have a resulting value (pushed onto the stack)
 void CompileValueExpr(Expr* exp)
@@ -888,7 +1136,31 @@ void CompileValueExpr(Expr* exp)
 
 		case EXP_TYPE_CAST:
 		{
-			CompileValueExpr(exp->castx.expr);
+			TypeHint* type = exp->castx.newType;
+
+			if(IsStructLiteral(type, exp->castx.expr))
+			{
+				Expr* dict = exp->castx.expr;
+				int typeIndex = GetStructTypeIndex(type);
+
+				AppendCode(OP_PUSH_STRUCT);
+				AppendInt(typeIndex);
+				SetVar(dict->dictx.decl);
+
+				for(Expr* node = dict->dictx.pairsHead; node; node = node->next)
+				{
+					CompileValueExpr(node->binx.rhs);
+					GetVar(dict->dictx.decl);
+
+					AppendCode(OP_STRUCT_SET);
+					AppendInt(typeIndex);
+					AppendInt(GetUserTypeElementIndex(type, GetDictLiteralKey(node)));
+				}
+
+				GetVar(dict->dictx.decl);
+			}
+			else
+				CompileValueExpr(exp->castx.expr);
 		} break;
 
 		case EXP_UNARY:
@@ -962,6 +1234,14 @@ void CompileValueExpr(Expr* exp)
 			const TypeHint* b = InferTypeFromExpr(exp->arrayIndex.indexExpr);
 			FuncDecl* overload = a && b ? GetSpecialOverload(a, b, OVERLOAD_INDEX) : NULL;
 		
+			if(!overload && GetRegister(exp->arrayIndex.arrExpr) && GetRegister(exp->arrayIndex.indexExpr))
+			{
+				AppendCode(OP_GETINDEX_RR);
+				AppendInt(exp->arrayIndex.arrExpr->varx.varDecl->index);
+				AppendInt(exp->arrayIndex.indexExpr->varx.varDecl->index);
+				break;
+			}
+		
 			CompileValueExpr(exp->arrayIndex.indexExpr);
 			CompileValueExpr(exp->arrayIndex.arrExpr);
 			if(overload)
@@ -986,8 +1266,14 @@ void CompileValueExpr(Expr* exp)
 				const TypeHint* b = InferTypeFromExpr(exp->binx.rhs);
 				
 				FuncDecl* overload = GetBinaryOverload(a, b, exp->binx.op);
+				int form = GetRegisterForm(exp);
 				
-				if(overload)
+				if(form >= 0)
+				{
+					AppendCode(form);
+					AppendRegisterOperands(exp);
+				}
+				else if(overload)
 				{
 					CompileValueExpr(exp->binx.rhs);
 					CompileValueExpr(exp->binx.lhs);
@@ -1073,12 +1359,18 @@ void CompileValueExpr(Expr* exp)
 
 					if(eindex < 0)
 						ErrorExitE(exp, "Attempted to access non-existent field '%s' in usertype '%s'\n", exp->dotx.name, type->user.name);
+
+					CompileValueExpr(exp->dotx.dict);
+					AppendCode(OP_STRUCT_GET);
+					AppendInt(GetStructTypeIndex(type));
+					AppendInt(eindex);
+				}
+				else
+				{
+					CompileValueExpr(exp->dotx.dict);
+					AppendCode(OP_DICT_GET);
+					AppendInt(AddDictCache(RegisterString(exp->dotx.name)->index));
 				}
-				
-				AppendCode(OP_PUSH_STRING);
-				AppendInt(RegisterString(exp->dotx.name)->index);
-				CompileValueExpr(exp->dotx.dict);
-				AppendCode(OP_DICT_GET);
 			}
 		} break;
 		
@@ -1218,10 +1510,7 @@ void CompileValueExpr(Expr* exp)
 
 		case EXP_IF:
 		{
-			CompileValueExpr(exp->ifx.cond);
-			AppendCode(OP_GOTOZ);
-			int emplaceLoc = CodeLength;
-			AllocatePatch(sizeof(int) / sizeof(Word));
+			int emplaceLoc = CompileCondition(exp->ifx.cond);
 
 			Expr* node = exp->ifx.bodyHead;
 			while(node)
@@ -1273,10 +1562,7 @@ void CompileValueExpr(Expr* exp)
 			CompileExpr(exp->forx.init);
 			int loopPc = CodeLength;
 			
-			CompileValueExpr(exp->forx.cond);
-			AppendCode(OP_GOTOZ);
-			int emplaceLoc = CodeLength;
-			AllocatePatch(sizeof(int) / sizeof(Word));
+			int emplaceLoc = CompileCondition(exp->forx.cond);
 			
 			Expr* node = exp->forx.bodyHead;
 			while(node)
@@ -1317,6 +1603,11 @@ void CompileValueExpr(Expr* exp)
 			GetVar(comDecl);
 		} break;
 
+		case EXP_FOR_IN:
+		{
+			CompileForIn(exp, 1);
+		} break;
+
 		default:
 			ErrorExitE(exp, "Expected value expression in place of %s\n", ExprNames[exp->type]);
 	}
@@ -1365,6 +1656,10 @@ void CompileExpr(Expr* exp)
 		{	
 			if(exp->binx.op == '=')
 			{	
+				VarDecl* dest = GetRegister(exp->binx.lhs);
+				if(dest && CompileRegisterAssignment(dest, exp->binx.rhs))
+					break;
+
 				CompileValueExpr(exp->binx.rhs);
 								
 				if(exp->binx.lhs->type == EXP_VAR || exp->binx.lhs->type == EXP_IDENT)
@@ -1417,10 +1712,19 @@ void CompileExpr(Expr* exp)
 								HintString(etype));
 					}
 
-					AppendCode(OP_PUSH_STRING);
-					AppendInt(RegisterString(exp->binx.lhs->dotx.name)->index);
 					CompileValueExpr(exp->binx.lhs->dotx.dict);
-					AppendCode(OP_DICT_SET);
+
+					if(type && type->hint == USERTYPE)
+					{
+						AppendCode(OP_STRUCT_SET);
+						AppendInt(GetStructTypeIndex(type));
+						AppendInt(GetUserTypeElementIndex(type, exp->binx.lhs->dotx.name));
+					}
+					else
+					{
+						AppendCode(OP_DICT_SET);
+						AppendInt(AddDictCache(RegisterString(exp->binx.lhs->dotx.name)->index));
+					}
 				}
 				else
 					ErrorExitE(exp, "Left hand side of assignment operator '=' must be an assignable value (variable, array index, dictionary index, usertype) instead of %s\n", ExprNames[exp->binx.lhs->type]);
@@ -1467,11 +1771,8 @@ void CompileExpr(Expr* exp)
 			PushPatchScope();
 
 			int loopPc = CodeLength;
-			CompileValueExpr(exp->whilex.cond);
-			AppendCode(OP_GOTOZ);
 			// emplace integer of exit location here
-			int emplaceLoc = CodeLength;
-			AllocatePatch(sizeof(int) / sizeof(Word));
+			int emplaceLoc = CompileCondition(exp->whilex.cond);
 
 			CompileExprList(exp->whilex.bodyHead);
 
@@ -1501,10 +1802,7 @@ void CompileExpr(Expr* exp)
 			CompileExpr(exp->forx.init);
 			int loopPc = CodeLength;
 			
-			CompileValueExpr(exp->forx.cond);
-			AppendCode(OP_GOTOZ);
-			int emplaceLoc = CodeLength;
-			AllocatePatch(sizeof(int) / sizeof(Word));
+			int emplaceLoc = CompileCondition(exp->forx.cond);
 			
 			CompileExprList(exp->forx.bodyHead);
 
@@ -1531,12 +1829,14 @@ void CompileExpr(Expr* exp)
 			PopPatchScope();
 		} break;
 		
+		case EXP_FOR_IN:
+		{
+			CompileForIn(exp, 0);
+		} break;
+		
 		case EXP_IF:
 		{
-			CompileValueExpr(exp->ifx.cond);
-			AppendCode(OP_GOTOZ);
-			int emplaceLoc = CodeLength;
-			AllocatePatch(sizeof(int) / sizeof(Word));
+			int emplaceLoc = CompileCondition(exp->ifx.cond);
 			CompileExprList(exp->ifx.bodyHead);
 			
 			AppendCode(OP_GOTO);
@@ -5,6 +5,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DICT_SSE2
+#include <emmintrin.h>
+#endif
+
 static void* emalloc(size_t size)
 {
 	void* mem = malloc(size);
@@ -12,188 +17,547 @@ static void* emalloc(size_t size)
 	return mem;
 }
 
-static void* ecalloc(size_t size, size_t nmemb)
+static int CountTrailingZeros(uint32_t x)
 {
-	void* mem = calloc(size, nmemb);
-	if(!mem) { fprintf(stderr, "Virtual machine ran out of memory!\n"); exit(1); }
-	return mem;
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return (int)index;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+// The hash is split in two: the high bits pick the group probing starts at and
+// the low 7 bits are stored in the control byte
+static inline int GetProbeStart(const DictTable* table, uint32_t hash)
+{
+	return (int)(hash >> 7) & (table->capacity - 1);
+}
+
+static inline int8_t GetControlHash(uint32_t hash)
+{
+	return (int8_t)(hash & 0x7f);
+}
+
+// returns a mask with bit i set if control byte i of the group equals 'ctrl'
+static inline uint32_t MatchGroup(const int8_t* group, int8_t ctrl)
+{
+#ifdef DICT_SSE2
+	__m128i bytes = _mm_loadu_si128((const __m128i*)group);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)));
+#else
+	uint32_t mask = 0;
+	for(int i = 0; i < DICT_GROUP_SIZE; ++i)
+	{
+		if(group[i] == ctrl)
+			mask |= (uint32_t)1 << i;
+	}
+	return mask;
+#endif
+}
+
+// same as MatchGroup but for the empty and deleted slots (which are the only
+// negative control bytes)
+static inline uint32_t MatchFree(const int8_t* group)
+{
+#ifdef DICT_SSE2
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+	uint32_t mask = 0;
+	for(int i = 0; i < DICT_GROUP_SIZE; ++i)
+	{
+		if(group[i] < 0)
+			mask |= (uint32_t)1 << i;
+	}
+	return mask;
+#endif
+}
+
+static void SetControl(DictTable* table, int index, int8_t ctrl)
+{
+	table->ctrl[index] = ctrl;
+
+	// keep the copies after the last slot up to date (small tables are repeated
+	// more than once to fill up a group)
+	for(int i = index + table->capacity; i < table->capacity + DICT_GROUP_SIZE; i += table->capacity)
+		table->ctrl[i] = ctrl;
 }
 
-static void* erealloc(void* mem, size_t newSize)
+static void AllocTable(DictTable* table, int capacity)
 {
-	void* newMem = realloc(mem, newSize);
-	if(!newMem) { fprintf(stderr, "Virtual machine ran out of memory!\n"); exit(1); }
-	return newMem;
+	// NOTE: a slot is only read once its control byte says it's full, so they aren't cleared
+	table->slots = emalloc(sizeof(int32_t) * capacity + capacity + DICT_GROUP_SIZE);
+	table->ctrl = (int8_t*)(table->slots + capacity);
+	memset(table->ctrl, DICT_CTRL_EMPTY, capacity + DICT_GROUP_SIZE);
+
+	table->capacity = capacity;
 }
 
-static char* estrdup(const char* string)
+static void FreeTable(DictTable* table)
 {
-	char* newString = emalloc(strlen(string) + 1);
-	strcpy(newString, string);
-	return newString;
+	free(table->slots);
+
+	table->ctrl = NULL;
+	table->slots = NULL;
+	table->capacity = 0;
 }
 
-unsigned long HashFunction(const char* key)
+static size_t TableMemory(const DictTable* table)
 {
-	/*
-	unsigned long hash = 5381;
-	int c;
-	
-	while ((c = *key++))
-		hash = ((hash << 5) + hash) + c; // hash * 33 + c */
-		
-	return SuperFastHash(key, strlen(key));
+	if(table->capacity == 0) return 0;
+	return sizeof(int32_t) * table->capacity + table->capacity + DICT_GROUP_SIZE;
 }
 
-static void InternalInitDict(Dict* dict, int capacity)
+// NOTE: the table is only allocated once something is put into the dict
+void InitDict(Dict* dict)
 {
-	dict->buckets = ecalloc(sizeof(DictNode*), capacity);
-	dict->capacity = capacity;
+	dict->entries.data = NULL;
+	dict->entries.length = 0;
+	dict->entries.capacity = 0;
+
+	dict->entries.old = NULL;
+	dict->entries.copied = 0;
+	dict->entries.oldLength = 0;
+
+	dict->table.ctrl = NULL;
+	dict->table.slots = NULL;
+	dict->table.capacity = 0;
+
+	dict->old = dict->table;
+	dict->migrated = 0;
+
 	dict->used = 0;
-	
-	dict->active.data = ecalloc(sizeof(int), capacity);
-	dict->active.length = 0;
-	dict->active.capacity = capacity;
-	
 	dict->numEntries = 0;
+
+	dict->version = 0;
+	dict->compactions = 0;
+	dict->metaCache = NULL;
 }
 
-void InitDict(Dict* dict)
+// Groups are probed in a triangular sequence (1, 2, 3... groups apart) which
+// visits every group of a power of 2 sized table. The table always has an
+// empty slot in it, so probing ends once a group with an empty slot is found.
+static int FindInternedSlot(const Dict* dict, const DictTable* table, const Object* key)
 {
-	InternalInitDict(dict, INIT_DICT_CAPACITY);
+	if(table->capacity == 0) return -1;
+
+	uint32_t hash = key->string.hash;
+	int mask = table->capacity - 1;
+	int8_t ctrl = GetControlHash(hash);
+	int pos = GetProbeStart(table, hash);
+	int stride = 0;
+
+	while(1)
+	{
+		const int8_t* group = &table->ctrl[pos];
+		uint32_t match = MatchGroup(group, ctrl);
+
+		// an interned key can only ever match itself
+		while(match)
+		{
+			int index = (pos + CountTrailingZeros(match)) & mask;
+			if(LocateDictEntry(dict, table->slots[index])->key == key)
+				return index;
+			match &= match - 1;
+		}
+
+		if(MatchGroup(group, DICT_CTRL_EMPTY))
+			return -1;
+
+		stride += DICT_GROUP_SIZE;
+		pos = (pos + stride) & mask;
+	}
 }
 
-void DictResize(Dict* dict, int newCapacity);
-void DictPutNode(Dict* dict, DictNode* node)
+// same as FindInternedSlot but the keys' characters are compared
+static int FindSlot(const Dict* dict, const DictTable* table, uint32_t hash, const char* chars, int length)
 {
-	if(dict->used >= (int)(dict->capacity * (2.0f / 3.0f)))
-		DictResize(dict, dict->capacity * 2);
-	
-	node->activeIndex = dict->active.length;
-	
-	unsigned long hash = HashFunction(node->key) % dict->capacity;
-	if(!dict->buckets[hash])
-	{	
-		dict->buckets[hash] = node;
-		dict->used += 1;
-		
-		while(dict->active.length + 1 >= dict->active.capacity)
+	if(table->capacity == 0) return -1;
+
+	int mask = table->capacity - 1;
+	int8_t ctrl = GetControlHash(hash);
+	int pos = GetProbeStart(table, hash);
+	int stride = 0;
+
+	while(1)
+	{
+		const int8_t* group = &table->ctrl[pos];
+		uint32_t match = MatchGroup(group, ctrl);
+
+		while(match)
 		{
-			dict->active.capacity *= 2;
-			dict->active.data = erealloc(dict->active.data, sizeof(int) * dict->active.capacity);
+			int index = (pos + CountTrailingZeros(match)) & mask;
+			match &= match - 1;
+
+			const DictEntry* entry = LocateDictEntry(dict, table->slots[index]);
+			if(entry->hash == hash && entry->key->string.length == length && memcmp(entry->key->string.raw, chars, length) == 0)
+				return index;
 		}
-		
-		dict->active.data[dict->active.length++] = hash;
+
+		if(MatchGroup(group, DICT_CTRL_EMPTY))
+			return -1;
+
+		stride += DICT_GROUP_SIZE;
+		pos = (pos + stride) & mask;
 	}
-	else
+}
+
+// any string object can be used to look up a key
+static int FindKeySlot(const Dict* dict, const DictTable* table, Object* key)
+{
+	if(key->string.interned)
+		return FindInternedSlot(dict, table, key);
+
+	// NOTE: a rope doesn't have a hash until it's flattened
+	GetStringChars(key);
+	return FindSlot(dict, table, key->string.hash, key->string.raw, key->string.length);
+}
+
+// returns the index of the entry holding key (or -1 if there is none)
+static int FindEntry(const Dict* dict, Object* key)
+{
+	int index = FindKeySlot(dict, &dict->table, key);
+	if(index >= 0)
+		return dict->table.slots[index];
+
+	index = FindKeySlot(dict, &dict->old, key);
+	return index >= 0 ? dict->old.slots[index] : -1;
+}
+
+// same as FindEntry but the key has to be hashed
+static int FindStringEntry(const Dict* dict, const char* key)
+{
+	int length = (int)strlen(key);
+	uint32_t hash = SuperFastHash(key, length);
+
+	int index = FindSlot(dict, &dict->table, hash, key, length);
+	if(index >= 0)
+		return dict->table.slots[index];
+
+	index = FindSlot(dict, &dict->old, hash, key, length);
+	return index >= 0 ? dict->old.slots[index] : -1;
+}
+
+// returns the first empty or deleted slot in the probe sequence for 'hash'
+static int FindFreeSlot(const DictTable* table, uint32_t hash)
+{
+	int mask = table->capacity - 1;
+	int pos = GetProbeStart(table, hash);
+	int stride = 0;
+
+	while(1)
 	{
-		node->next = dict->buckets[hash];
-		dict->buckets[hash] = node;
+		uint32_t match = MatchFree(&table->ctrl[pos]);
+		if(match)
+			return (pos + CountTrailingZeros(match)) & mask;
+
+		stride += DICT_GROUP_SIZE;
+		pos = (pos + stride) & mask;
 	}
-	
-	++dict->numEntries;
 }
 
-void DictResize(Dict* dict, int newCapacity)
-{	
-	Dict newDict;
-	InternalInitDict(&newDict, dict->capacity * 2);
-	
-	for(int i = 0; i < dict->capacity; ++i)
+// points a slot of the table at 'entry' (whose key has the given hash)
+static void InsertSlot(Dict* dict, int32_t entry, uint32_t hash)
+{
+	DictTable* table = &dict->table;
+
+	int index = FindFreeSlot(table, hash);
+	if(table->ctrl[index] == DICT_CTRL_EMPTY)
+		++dict->used;
+
+	SetControl(table, index, GetControlHash(hash));
+	table->slots[index] = entry;
+}
+
+// Moves (up to) the next 'count' slots of the old table into the new one and
+// frees the old table once they've all been moved
+// NOTE: the entries themselves stay where they are
+static void MigrateSlots(Dict* dict, int count)
+{
+	DictTable* old = &dict->old;
+
+	int end = dict->migrated + count;
+	if(end > old->capacity)
+		end = old->capacity;
+
+	for(int i = dict->migrated; i < end; ++i)
 	{
-		DictNode* node = dict->buckets[i];
-		while(node)
-		{
-			DictPut(&newDict, node->key, node->value);
-			node = node->next;
-		}
+		if(old->ctrl[i] < 0) continue;
+
+		int32_t entry = old->slots[i];
+		InsertSlot(dict, entry, LocateDictEntry(dict, entry)->hash);
+
+		// NOTE: the slot is marked deleted rather than empty since lookups of
+		// the keys which haven't been moved yet may have to probe past it
+		SetControl(old, i, DICT_CTRL_DELETED);
 	}
-	
-	Dict swap = *dict;
-	*dict = newDict;
-	newDict = swap;
-	
-	FreeDict(&newDict);
-}
-
-void DictPut(Dict* dict, const char* key, void* value)
-{	
-	// NOTE: Calculating hash code multiple times in this function call
-	// TODO: Don't do that ^ (perhaps pass hashcode as parameter to DictPutNode)
-	unsigned long hash = HashFunction(key) % dict->capacity;
-	DictNode* node = dict->buckets[hash];
-	while(node)
+
+	dict->migrated = end;
+
+	if(dict->migrated == old->capacity)
 	{
-		if(strcmp(node->key, key) == 0)
-		{
-			node->value = value;
-			return;
-		}
-		node = node->next;
+		FreeTable(old);
+		dict->migrated = 0;
 	}
-	
-	node = emalloc(sizeof(DictNode));
-	node->next = NULL;
-	node->key = estrdup(key);
-	node->value = value;
-	
-	DictPutNode(dict, node);
 }
 
-void* DictRemove(Dict* dict, const char* key)
+// Starts moving the slots into a new table; it's twice as big unless most of
+// the used slots were deleted ones
+static void Rehash(Dict* dict)
 {
-	unsigned long hash = HashFunction(key) % dict->capacity;
-		
-	DictNode* node = dict->buckets[hash];
-	while(node)
+	// NOTE: this can't happen unless the table fills up before the previous
+	// resize is done (which DICT_MIGRATE_STEP is big enough to prevent)
+	if(dict->old.capacity > 0)
+		MigrateSlots(dict, dict->old.capacity);
+
+	int capacity = dict->table.capacity;
+	if((dict->numEntries + 1) * 16 > capacity * 7)
+		capacity *= 2;
+
+	dict->old = dict->table;
+	dict->migrated = 0;
+
+	AllocTable(&dict->table, capacity);
+	dict->used = 0;
+
+	// small tables are moved all at once
+	MigrateSlots(dict, DICT_MIGRATE_STEP);
+}
+
+// Copies (up to) the next 'count' entries of the old array into the new one
+// and frees the old array once they've all been copied
+static void CopyEntries(Dict* dict, int count)
+{
+	int end = dict->entries.copied + count;
+	if(end > dict->entries.oldLength)
+		end = dict->entries.oldLength;
+
+	memcpy(&dict->entries.data[dict->entries.copied], &dict->entries.old[dict->entries.copied],
+		sizeof(DictEntry) * (end - dict->entries.copied));
+	dict->entries.copied = end;
+
+	if(dict->entries.copied == dict->entries.oldLength)
+	{
+		free(dict->entries.old);
+		dict->entries.old = NULL;
+		dict->entries.copied = 0;
+		dict->entries.oldLength = 0;
+	}
+}
+
+// Squeezes the holes out of the entries (keeping them in order) and points
+// the table at where they ended up
+static void CompactEntries(Dict* dict)
+{
+	// NOTE: the old table's slots (and array) would have to be fixed up too otherwise
+	if(dict->old.capacity > 0)
+		MigrateSlots(dict, dict->old.capacity);
+	if(dict->entries.old)
+		CopyEntries(dict, dict->entries.oldLength);
+
+	DictEntry* data = dict->entries.data;
+
+	int length = 0;
+	for(int i = 0; i < dict->entries.length; ++i)
+	{
+		if(data[i].key)
+			data[length++] = data[i];
+	}
+	dict->entries.length = length;
+	++dict->compactions;
+
+	// this gets rid of the deleted slots as well
+	memset(dict->table.ctrl, DICT_CTRL_EMPTY, dict->table.capacity + DICT_GROUP_SIZE);
+	dict->used = 0;
+
+	for(int i = 0; i < length; ++i)
+		InsertSlot(dict, i, data[i].hash);
+
+	++dict->version;
+}
+
+// returns the index of the new entry
+static int32_t AppendEntry(Dict* dict, Object* key, Value value)
+{
+	if(dict->entries.length == dict->entries.capacity)
 	{
-		if(strcmp(node->key, key) == 0)
+		if(dict->entries.length > 0 && dict->numEntries * 2 <= dict->entries.length)
+			CompactEntries(dict);
+		else
 		{
-			dict->buckets[hash] = node->next;
-			void* value = node->value;
-			free(node->key);
-			free(node);
-			--dict->numEntries;
-			return value;
+			// NOTE: like with the table, this can't happen unless the new array
+			// fills up before the previous one is copied
+			if(dict->entries.old)
+				CopyEntries(dict, dict->entries.oldLength);
+
+			if(dict->entries.capacity > 0)
+			{
+				dict->entries.old = dict->entries.data;
+				dict->entries.copied = 0;
+				dict->entries.oldLength = dict->entries.length;
+			}
+
+			dict->entries.capacity = dict->entries.capacity > 0 ? dict->entries.capacity * 2 : INIT_DICT_CAPACITY;
+			dict->entries.data = emalloc(sizeof(DictEntry) * dict->entries.capacity);
+
+			// small arrays are copied all at once
+			if(dict->entries.old)
+				CopyEntries(dict, DICT_MIGRATE_STEP);
 		}
-		node = node->next;
 	}
-	
-	return NULL;
+
+	DictEntry* entry = &dict->entries.data[dict->entries.length];
+	entry->key = key;
+	entry->value = value;
+	entry->hash = key->string.hash;
+
+	return dict->entries.length++;
 }
 
-void* DictGet(Dict* dict, const char* key)
-{	
-	unsigned long hash = HashFunction(key) % dict->capacity;
-	
-	DictNode* node = dict->buckets[hash];
-	while(node)
+void DictPut(Dict* dict, Object* key, Value value)
+{
+	if(dict->table.capacity == 0)
+		AllocTable(&dict->table, INIT_DICT_CAPACITY);
+
+	// keys which are in the old table are updated in place as well
+	int index = FindEntry(dict, key);
+	if(index >= 0)
 	{
-		if(strcmp(node->key, key) == 0)
-			return node->value;
-		node = node->next;
+		LocateDictEntry(dict, index)->value = value;
+		return;
 	}
-	return NULL;
+
+	// NOTE: slots and entries are only moved when a key is added so that
+	// updating and removing entries doesn't allocate
+	if(dict->old.capacity > 0)
+		MigrateSlots(dict, DICT_MIGRATE_STEP);
+	if(dict->entries.old)
+		CopyEntries(dict, DICT_MIGRATE_STEP);
+
+	// NOTE: the deleted slots count towards the load factor (7/8) since they don't end probing
+	if((dict->used + 1) * 8 > dict->table.capacity * 7)
+		Rehash(dict);
+
+	InsertSlot(dict, AppendEntry(dict, key, value), key->string.hash);
+	++dict->numEntries;
+	++dict->version;
 }
 
-void FreeDict(Dict* dict)
+static void RemoveSlot(Dict* dict, DictTable* table, int index)
 {
-	for(int i = 0; i < dict->capacity; ++i)
+	LocateDictEntry(dict, table->slots[index])->key = NULL;
+
+	SetControl(table, index, DICT_CTRL_DELETED);
+	--dict->numEntries;
+	++dict->version;
+
+	// nothing is left to probe past, so the deleted slots can be reused right away
+	// NOTE: an old table is left to be freed by the next put (the collector
+	// removes entries while the slots may be being gone over)
+	if(dict->numEntries == 0)
 	{
-		DictNode* node = dict->buckets[i];
-		DictNode* next;
-		
-		while(node)
+		memset(dict->table.ctrl, DICT_CTRL_EMPTY, dict->table.capacity + DICT_GROUP_SIZE);
+		dict->used = 0;
+	}
+}
+
+char DictRemove(Dict* dict, Object* key, Value* removed)
+{
+	if(dict->numEntries == 0) return 0;
+
+	DictTable* table = &dict->table;
+
+	int index = FindKeySlot(dict, table, key);
+	if(index < 0)
+	{
+		table = &dict->old;
+		index = FindKeySlot(dict, table, key);
+	}
+
+	if(index < 0) return 0;
+
+	if(removed)
+		*removed = LocateDictEntry(dict, table->slots[index])->value;
+	RemoveSlot(dict, table, index);
+
+	return 1;
+}
+
+// NOTE: this doesn't move any entries (it's used by the collector, which may
+// be in the middle of going over them)
+int DictRemoveWhere(Dict* dict, char (*shouldRemove)(const DictEntry* entry, void* data), void* data)
+{
+	int numRemoved = 0;
+
+	DictTable* tables[2] = { &dict->table, &dict->old };
+
+	for(int t = 0; t < 2; ++t)
+	{
+		DictTable* table = tables[t];
+
+		for(int i = 0; i < table->capacity; ++i)
 		{
-			next = node->next;
-			free(node->key);
-			free(node);
-			node = next;
-		}	
+			if(table->ctrl[i] >= 0 && shouldRemove(LocateDictEntry(dict, table->slots[i]), data))
+			{
+				RemoveSlot(dict, table, i);
+				++numRemoved;
+			}
+		}
 	}
-	dict->numEntries = 0;
-	free(dict->active.data);
-	dict->active.length = 0;
-	dict->active.capacity = 0;
-	free(dict->buckets);
+
+	return numRemoved;
+}
+
+// NOTE: lookups don't move any entries so they can happen while the dict is
+// being iterated over
+Value* DictGet(Dict* dict, Object* key)
+{
+	if(dict->numEntries == 0) return NULL;
+
+	int index = FindEntry(dict, key);
+	return index >= 0 ? &LocateDictEntry(dict, index)->value : NULL;
+}
+
+Value* DictGetIndexed(Dict* dict, Object* key, int* index)
+{
+	*index = -1;
+	if(dict->numEntries == 0) return NULL;
+
+	*index = FindEntry(dict, key);
+	return *index >= 0 ? &LocateDictEntry(dict, *index)->value : NULL;
+}
+
+Value* DictGetString(Dict* dict, const char* key)
+{
+	if(dict->numEntries == 0) return NULL;
+
+	int index = FindStringEntry(dict, key);
+	return index >= 0 ? &LocateDictEntry(dict, index)->value : NULL;
+}
+
+Value* DictGetStringIndexed(Dict* dict, const char* key, int* index)
+{
+	*index = -1;
+	if(dict->numEntries == 0) return NULL;
+
+	*index = FindStringEntry(dict, key);
+	return *index >= 0 ? &LocateDictEntry(dict, *index)->value : NULL;
+}
+
+size_t DictMemory(const Dict* dict)
+{
+	// NOTE: the old array was full when it was replaced
+	size_t entries = sizeof(DictEntry) * (dict->entries.capacity + dict->entries.oldLength);
+	return entries + TableMemory(&dict->table) + TableMemory(&dict->old);
+}
+
+void FreeDict(Dict* dict)
+{
+	free(dict->metaCache);
+	free(dict->entries.data);
+	free(dict->entries.old);
+	FreeTable(&dict->table);
+	FreeTable(&dict->old);
+	InitDict(dict);
 }
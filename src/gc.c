@@ -0,0 +1,1555 @@
+// gc.c -- paged object heap and mark/sweep garbage collector for the mint vm
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef MINT_PARALLEL_MARK
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(p) __builtin_prefetch((p))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define PREFETCH(p) ((void)0)
+#endif
+
+// number of gray objects which are prefetched ahead of the one being scanned
+#define MARK_PREFETCH_DISTANCE 8
+
+// a parallel marking thread gives away some of its gray objects when it has
+// at least this many and another thread has run out of work
+#define MARK_SHARE_MIN 64
+
+// the header has to fit in the space reserved for it at the start of each page
+typedef char GcPageHeaderCheck[sizeof(HeapPage) <= GC_PAGE_HEADER_SIZE ? 1 : -1];
+typedef char GcSlotSizeCheck[sizeof(Object) <= GC_SLOT_SIZE ? 1 : -1];
+
+static int CountTrailingZeros(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+static int CountBits(uint64_t x)
+{
+#ifdef _MSC_VER
+	return (int)__popcnt64(x);
+#else
+	return __builtin_popcountll(x);
+#endif
+}
+
+// mask of the bits in bitmap word 'word' which correspond to actual slots
+static uint64_t SlotMask(int word)
+{
+	int bits = GC_PAGE_SLOTS - word * 64;
+	return bits >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1);
+}
+
+static HeapPage* AllocPage(void)
+{
+	void* mem;
+#ifdef _WIN32
+	mem = _aligned_malloc(GC_PAGE_SIZE, GC_PAGE_SIZE);
+#else
+	if(posix_memalign(&mem, GC_PAGE_SIZE, GC_PAGE_SIZE) != 0)
+		mem = NULL;
+#endif
+	if(!mem) { fprintf(stderr, "Virtual machine ran out of memory!\n"); exit(1); }
+
+	HeapPage* page = mem;
+	memset(page, 0, sizeof(HeapPage));
+
+	return page;
+}
+
+static void ReleasePage(HeapPage* page)
+{
+#ifdef _WIN32
+	_aligned_free(page);
+#else
+	free(page);
+#endif
+}
+
+// monotonic time in seconds
+static double GetTime(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+// NOTE: these nest, so only the outermost pair is counted as a pause
+static void BeginPause(Heap* heap)
+{
+	if(heap->pauseDepth++ == 0)
+		heap->pauseStart = GetTime();
+}
+
+static void EndPause(Heap* heap)
+{
+	if(--heap->pauseDepth > 0) return;
+
+	GcStats* stats = &heap->stats;
+	double pause = GetTime() - heap->pauseStart;
+
+	++stats->numPauses;
+	stats->totalPause += pause;
+	if(pause > stats->maxPause)
+		stats->maxPause = pause;
+
+	int bucket = 0;
+	for(double limit = 1e-6; bucket < GC_PAUSE_BUCKETS - 1 && pause >= limit; limit *= 2)
+		++bucket;
+	++stats->pauseHistogram[bucket];
+}
+
+static void* _erealloc(void* mem, size_t newSize)
+{
+	void* newMem = realloc(mem, newSize);
+	if(!newMem) { fprintf(stderr, "Virtual machine ran out of memory!\n"); exit(1); }
+	return newMem;
+}
+
+static void AppendObject(Object*** objects, int* length, int* capacity, Object* obj)
+{
+	if(*length >= *capacity)
+	{
+		*capacity = *capacity ? *capacity * 2 : 64;
+		*objects = _erealloc(*objects, sizeof(Object*) * (*capacity));
+	}
+
+	(*objects)[(*length)++] = obj;
+}
+
+void InitHeap(Heap* heap)
+{
+	heap->pages = NULL;
+	heap->numPages = 0;
+	heap->freePages = NULL;
+	heap->nursery = NULL;
+
+	heap->numOld = 0;
+
+	heap->numBytes = 0;
+	heap->bytesUntilGc = GC_MIN_HEAP_BYTES;
+	heap->growthFactor = GC_DEFAULT_GROWTH_FACTOR;
+	heap->maxBytes = 0;
+
+	heap->remembered = NULL;
+	heap->numRemembered = 0;
+	heap->rememberedCapacity = 0;
+
+	heap->sticky = NULL;
+	heap->numSticky = 0;
+	heap->stickyCapacity = 0;
+
+	heap->minor = MINT_FALSE;
+
+	heap->state = GC_IDLE;
+
+	heap->sweepLink = NULL;
+	heap->numEmptyPages = 0;
+
+	heap->weak = NULL;
+	heap->numWeak = 0;
+	heap->weakCapacity = 0;
+
+	heap->gray = NULL;
+	heap->numGray = 0;
+	heap->grayCapacity = 0;
+
+	heap->rescan = NULL;
+	heap->numRescan = 0;
+	heap->rescanCapacity = 0;
+
+	heap->stepWork = GC_DEFAULT_STEP_WORK;
+	heap->bytesSinceStep = 0;
+
+	heap->numMarkThreads = 1;
+#ifdef MINT_PARALLEL_MARK
+	long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+	if(numProcessors > 1)
+		heap->numMarkThreads = numProcessors < GC_MAX_MARK_THREADS ? (int)numProcessors : GC_MAX_MARK_THREADS;
+#endif
+	heap->parallel = NULL;
+
+	memset(&heap->stats, 0, sizeof(GcStats));
+	heap->stats.startTime = GetTime();
+	heap->pauseDepth = 0;
+	heap->pauseStart = 0;
+}
+
+static HeapPage* NewPage(Heap* heap)
+{
+	HeapPage* page = AllocPage();
+
+	page->heap = heap;
+	page->next = heap->pages;
+	heap->pages = page;
+	++heap->numPages;
+
+	page->inFreeList = MINT_TRUE;
+	page->nextFree = heap->freePages;
+	heap->freePages = page;
+
+	return page;
+}
+
+static int SweepPages(VM* vm, int budget);
+
+static Object* AllocSlot(VM* vm)
+{
+	Heap* heap = &vm->heap;
+
+	while(heap->freePages)
+	{
+		HeapPage* page = heap->freePages;
+
+		if(page->numLive < GC_PAGE_SLOTS)
+		{
+			for(int i = page->freeHint; i < GC_BITMAP_WORDS; ++i)
+			{
+				uint64_t free = ~page->allocBits[i] & SlotMask(i);
+				if(free)
+				{
+					int bit = CountTrailingZeros(free);
+
+					page->allocBits[i] |= (uint64_t)1 << bit;
+					page->freeHint = i;
+					++page->numLive;
+
+					if(!page->inNursery)
+					{
+						page->inNursery = MINT_TRUE;
+						page->nextNursery = heap->nursery;
+						heap->nursery = page;
+					}
+
+					return GetPageObject(page, i * 64 + bit);
+				}
+			}
+		}
+
+		// page is full, it'll be put back into the list by the sweep if anything in it dies
+		heap->freePages = page->nextFree;
+		page->nextFree = NULL;
+		page->inFreeList = MINT_FALSE;
+	}
+
+	// reuse the slots of dead objects in the unswept pages before growing the heap
+	if(heap->state == GC_SWEEPING)
+	{
+		BeginPause(heap);
+		SweepPages(vm, 1);
+		EndPause(heap);
+	}
+	else
+		NewPage(heap);
+	return AllocSlot(vm);
+}
+
+void MarkObject(VM* vm, Object* obj)
+{
+	if(!obj)
+	{
+		fprintf(stderr, "Attempted to mark null object\n");
+		return;
+	}
+
+	HeapPage* page = GetObjectPage(obj);
+	int slot = GetObjectSlot(page, obj);
+	uint64_t bit = (uint64_t)1 << (slot & 63);
+
+	if(page->markBits[slot >> 6] & bit) return;
+	
+	// a minor collection treats every old object as live (the ones which point
+	// into the nursery are scanned through the remembered set)
+	if(vm->heap.minor && (page->oldBits[slot >> 6] & bit)) return;
+
+	page->markBits[slot >> 6] |= bit;
+
+	if(vm->debug)
+		printf("marking %s\n", ObjectTypeNames[obj->type]);
+
+	// the object is gray until MarkGray gets to it
+	Heap* heap = &vm->heap;
+	if(heap->numGray < heap->grayCapacity)
+		heap->gray[heap->numGray++] = obj;
+	else
+		AppendObject(&heap->gray, &heap->numGray, &heap->grayCapacity, obj);
+}
+
+// adds obj to the set of objects which are rescanned when incremental marking finishes
+static void AddRescan(Heap* heap, Object* obj)
+{
+	// NOTE: the remembered set is empty during incremental marking, so its bits
+	// are used to keep track of which objects are in the rescan set instead
+	HeapPage* page = GetObjectPage(obj);
+	int slot = GetObjectSlot(page, obj);
+	uint64_t bit = (uint64_t)1 << (slot & 63);
+
+	if(page->rememberedBits[slot >> 6] & bit) return;
+
+	page->rememberedBits[slot >> 6] |= bit;
+	AppendObject(&heap->rescan, &heap->numRescan, &heap->rescanCapacity, obj);
+}
+
+struct _MarkWorker;
+#ifdef MINT_PARALLEL_MARK
+static void ParallelMarkObject(struct _MarkWorker* worker, Object* obj);
+static void DeferNative(struct _MarkWorker* worker, Object* obj);
+#endif
+
+// marks a reference found in a gray object (onto the worker's own gray stack
+// if the heap is being marked in parallel)
+static inline void MarkChild(VM* vm, struct _MarkWorker* worker, Object* obj)
+{
+#ifdef MINT_PARALLEL_MARK
+	if(worker)
+	{
+		ParallelMarkObject(worker, obj);
+		return;
+	}
+#endif
+	MarkObject(vm, obj);
+}
+
+static inline void MarkChildValue(VM* vm, struct _MarkWorker* worker, Value val)
+{
+	if(IS_OBJECT(val))
+		MarkChild(vm, worker, AS_OBJECT(val));
+}
+
+// marks everything referenced by obj; returns the amount of work this took
+static int ScanObject(VM* vm, struct _MarkWorker* worker, Object* obj)
+{
+	int work = 1;
+
+	if(obj->type == OBJ_STRING)
+	{
+		// an unflattened rope keeps its pieces alive
+		if(obj->string.isRope)
+		{
+			MarkChild(vm, worker, obj->string.left);
+			MarkChild(vm, worker, obj->string.right);
+		}
+	}
+	else if(obj->type == OBJ_NATIVE)
+	{
+		if(obj->native.onMark)
+		{
+#ifdef MINT_PARALLEL_MARK
+			// the callback marks through MarkObject, which only the vm's thread can use,
+			// so it gets called once the marking threads are done
+			if(worker)
+				DeferNative(worker, obj);
+			else
+#endif
+			obj->native.onMark(obj->native.value);
+		}
+	}
+	else if(obj->type == OBJ_ARRAY)
+	{
+		for(int i = 0; i < obj->array.length; ++i)
+			MarkChildValue(vm, worker, obj->array.members[i]);
+		work += obj->array.length;
+	}
+	else if(obj->type == OBJ_DICT)
+	{
+		work += GetDictEntryCount(obj->dict);
+
+		for(int i = 0; i < GetDictEntryCount(obj->dict); ++i)
+		{
+			DictEntry* entry = GetDictEntry(obj->dict, i);
+			if(!entry) continue;
+
+			MarkChild(vm, worker, entry->key);
+			if(!(obj->weakMode & WEAK_VALUES) || !IsWeakReferent(entry->value))
+				MarkChildValue(vm, worker, entry->value);
+		}
+
+		if(obj->meta)
+			MarkChild(vm, worker, obj->meta);
+	}
+	else if(obj->type == OBJ_STRUCT)
+	{
+		// NOTE: the field names are string constants, so they're always alive
+		int numFields = vm->structTypes[obj->structure.typeIndex].numFields;
+		for(int i = 0; i < numFields; ++i)
+			MarkChildValue(vm, worker, obj->structure.members[i]);
+		work += numFields;
+	}
+	else if(obj->type == OBJ_MAP)
+	{
+		work += GetMapEntryCount(obj->map);
+
+		for(int i = 0; i < GetMapEntryCount(obj->map); ++i)
+		{
+			MapEntry* entry = GetMapEntry(obj->map, i);
+			if(!entry) continue;
+
+			if(!(obj->map->weakMode & WEAK_KEYS) || !IsWeakReferent(entry->key))
+				MarkChildValue(vm, worker, entry->key);
+			if(!(obj->map->weakMode & WEAK_VALUES) || !IsWeakReferent(entry->value))
+				MarkChildValue(vm, worker, entry->value);
+		}
+	}
+	else if(obj->type == OBJ_FUNC)
+	{
+		if(obj->func.env)
+			MarkChild(vm, worker, obj->func.env);
+	}
+	else if (obj->type == OBJ_THREAD)
+	{
+		// A suspended thread keeps everything on its stack alive (including
+		// its env if it was created using a lambda or something)
+		if(obj->thread)
+		{
+			for(int i = 0; i < obj->thread->stackSize; ++i)
+				MarkChildValue(vm, worker, obj->thread->stack[i]);
+			MarkChildValue(vm, worker, obj->thread->retVal);
+			work += obj->thread->stackSize;
+		}
+
+		// threads don't have barriers on their stacks (the parallel marker
+		// only runs once the mutator is done, so it doesn't need to rescan)
+		if(!worker && vm->heap.state == GC_MARKING)
+			AddRescan(&vm->heap, obj);
+	}
+
+	return work;
+}
+
+// Scans gray objects until the budget runs out; returns the leftover budget.
+// Objects are popped off of the gray stack into a small queue and prefetched
+// so that they're (hopefully) in the cache by the time they get scanned.
+static int MarkGray(VM* vm, int budget)
+{
+	Heap* heap = &vm->heap;
+
+	Object* queue[MARK_PREFETCH_DISTANCE];
+	int head = 0;
+	int count = 0;
+
+	while(budget > 0)
+	{
+		if(count < MARK_PREFETCH_DISTANCE && heap->numGray > 0)
+		{
+			Object* obj = heap->gray[--heap->numGray];
+			PREFETCH(obj);
+
+			queue[(head + count++) % MARK_PREFETCH_DISTANCE] = obj;
+			continue;
+		}
+
+		if(count == 0) break;
+
+		Object* obj = queue[head];
+		head = (head + 1) % MARK_PREFETCH_DISTANCE;
+		--count;
+
+		budget -= ScanObject(vm, NULL, obj);
+	}
+
+	// whatever is still queued stays gray
+	while(count > 0)
+	{
+		--count;
+		AppendObject(&heap->gray, &heap->numGray, &heap->grayCapacity, queue[(head + count) % MARK_PREFETCH_DISTANCE]);
+	}
+
+	return budget;
+}
+
+#ifdef MINT_PARALLEL_MARK
+
+// Each marking thread works off of its own gray stack. When it has plenty of
+// work and somebody else has run out, it moves half of it to its shared stack,
+// which idle threads steal from.
+typedef struct _MarkWorker
+{
+	struct _ParallelMarker* marker;
+
+	// only ever touched by the thread which owns the worker
+	Object** gray;
+	int numGray;
+	int grayCapacity;
+
+	pthread_mutex_t lock;
+	Object** shared;
+	int numShared;		// NOTE: read without the lock to check for work
+	int sharedCapacity;
+
+	// natives with an onMark callback which were reached by this worker
+	Object** natives;
+	int numNatives;
+	int nativesCapacity;
+
+	pthread_t thread;
+} MarkWorker;
+
+typedef struct _ParallelMarker
+{
+	VM* vm;
+
+	// worker 0 is the thread running the vm, the rest have their own threads
+	// which sleep on 'start' in between collections
+	MarkWorker workers[GC_MAX_MARK_THREADS];
+	int numWorkers;
+	int numRequested;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	int phase;
+	int numDone;
+	char quit;
+
+	// number of workers which are out of gray objects; marking is done when all of them are
+	int numIdle;
+} ParallelMarker;
+
+static void ParallelMarkObject(MarkWorker* worker, Object* obj)
+{
+	HeapPage* page = GetObjectPage(obj);
+	int slot = GetObjectSlot(page, obj);
+	uint64_t bit = (uint64_t)1 << (slot & 63);
+	uint64_t* word = &page->markBits[slot >> 6];
+
+	if(__atomic_load_n(word, __ATOMIC_RELAXED) & bit) return;
+	// other threads might be marking this object (or one next to it) at the same time
+	if(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) return;
+
+	if(worker->numGray < worker->grayCapacity)
+		worker->gray[worker->numGray++] = obj;
+	else
+		AppendObject(&worker->gray, &worker->numGray, &worker->grayCapacity, obj);
+}
+
+static void DeferNative(MarkWorker* worker, Object* obj)
+{
+	AppendObject(&worker->natives, &worker->numNatives, &worker->nativesCapacity, obj);
+}
+
+// moves the bottom half of the worker's gray stack to its shared stack
+static void ShareWork(MarkWorker* worker)
+{
+	int count = worker->numGray / 2;
+
+	pthread_mutex_lock(&worker->lock);
+
+	int numShared = worker->numShared;
+	if(numShared + count > worker->sharedCapacity)
+	{
+		worker->sharedCapacity = (numShared + count) * 2;
+		worker->shared = _erealloc(worker->shared, sizeof(Object*) * worker->sharedCapacity);
+	}
+
+	memcpy(worker->shared + numShared, worker->gray, sizeof(Object*) * count);
+	__atomic_store_n(&worker->numShared, numShared + count, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&worker->lock);
+
+	worker->numGray -= count;
+	memmove(worker->gray, worker->gray + count, sizeof(Object*) * worker->numGray);
+}
+
+// Refills the worker's gray stack from its own shared stack or by stealing half
+// of somebody else's; returns MINT_FALSE if there was nothing to take
+static char TakeWork(MarkWorker* worker)
+{
+	ParallelMarker* pm = worker->marker;
+	int self = (int)(worker - pm->workers);
+
+	for(int i = 0; i < pm->numWorkers; ++i)
+	{
+		MarkWorker* victim = &pm->workers[(self + i) % pm->numWorkers];
+		if(__atomic_load_n(&victim->numShared, __ATOMIC_RELAXED) == 0) continue;
+
+		pthread_mutex_lock(&victim->lock);
+
+		int numShared = victim->numShared;
+		int count = victim == worker ? numShared : (numShared + 1) / 2;
+
+		for(int j = numShared - count; j < numShared; ++j)
+			AppendObject(&worker->gray, &worker->numGray, &worker->grayCapacity, victim->shared[j]);
+		__atomic_store_n(&victim->numShared, numShared - count, __ATOMIC_RELAXED);
+
+		pthread_mutex_unlock(&victim->lock);
+
+		if(count > 0)
+			return MINT_TRUE;
+	}
+
+	return MINT_FALSE;
+}
+
+static char HasSharedWork(ParallelMarker* pm)
+{
+	for(int i = 0; i < pm->numWorkers; ++i)
+	{
+		if(__atomic_load_n(&pm->workers[i].numShared, __ATOMIC_RELAXED) > 0)
+			return MINT_TRUE;
+	}
+	return MINT_FALSE;
+}
+
+// marks until every worker runs out of gray objects
+static void DrainWorker(MarkWorker* worker)
+{
+	ParallelMarker* pm = worker->marker;
+	VM* vm = pm->vm;
+
+	while(1)
+	{
+		while(worker->numGray > 0)
+		{
+			Object* obj = worker->gray[--worker->numGray];
+			if(worker->numGray > 0)
+				PREFETCH(worker->gray[worker->numGray - 1]);
+
+			ScanObject(vm, worker, obj);
+
+			if(worker->numGray >= MARK_SHARE_MIN && __atomic_load_n(&pm->numIdle, __ATOMIC_RELAXED) > 0 &&
+			   __atomic_load_n(&worker->numShared, __ATOMIC_RELAXED) == 0)
+				ShareWork(worker);
+		}
+
+		if(TakeWork(worker))
+			continue;
+
+		// NOTE: a worker stops counting as idle *before* it tries to steal so that
+		// the others can't finish while it's holding on to some gray objects
+		__atomic_add_fetch(&pm->numIdle, 1, __ATOMIC_SEQ_CST);
+		while(1)
+		{
+			if(__atomic_load_n(&pm->numIdle, __ATOMIC_SEQ_CST) == pm->numWorkers)
+				return;
+
+			if(HasSharedWork(pm))
+			{
+				__atomic_sub_fetch(&pm->numIdle, 1, __ATOMIC_SEQ_CST);
+				if(TakeWork(worker))
+					break;
+				__atomic_add_fetch(&pm->numIdle, 1, __ATOMIC_SEQ_CST);
+			}
+
+			sched_yield();
+		}
+	}
+}
+
+static void* MarkThreadMain(void* arg)
+{
+	MarkWorker* worker = arg;
+	ParallelMarker* pm = worker->marker;
+	int phase = 0;
+
+	pthread_mutex_lock(&pm->lock);
+	while(1)
+	{
+		while(pm->phase == phase && !pm->quit)
+			pthread_cond_wait(&pm->start, &pm->lock);
+		if(pm->quit)
+			break;
+
+		phase = pm->phase;
+		pthread_mutex_unlock(&pm->lock);
+
+		DrainWorker(worker);
+
+		pthread_mutex_lock(&pm->lock);
+		if(++pm->numDone == pm->numWorkers - 1)
+			pthread_cond_signal(&pm->done);
+	}
+	pthread_mutex_unlock(&pm->lock);
+
+	return NULL;
+}
+
+static ParallelMarker* NewParallelMarker(VM* vm, int numWorkers)
+{
+	ParallelMarker* pm = _erealloc(NULL, sizeof(ParallelMarker));
+	memset(pm, 0, sizeof(ParallelMarker));
+
+	pm->vm = vm;
+	pm->numRequested = numWorkers;
+	pthread_mutex_init(&pm->lock, NULL);
+	pthread_cond_init(&pm->start, NULL);
+	pthread_cond_init(&pm->done, NULL);
+
+	for(int i = 0; i < numWorkers; ++i)
+	{
+		pm->workers[i].marker = pm;
+		pthread_mutex_init(&pm->workers[i].lock, NULL);
+	}
+
+	// if a thread can't be created then marking just makes do with fewer of them
+	pm->numWorkers = 1;
+	for(int i = 1; i < numWorkers; ++i)
+	{
+		if(pthread_create(&pm->workers[i].thread, NULL, MarkThreadMain, &pm->workers[i]) != 0)
+			break;
+		pm->numWorkers = i + 1;
+	}
+
+	return pm;
+}
+
+static void FreeParallelMarker(ParallelMarker* pm)
+{
+	pthread_mutex_lock(&pm->lock);
+	pm->quit = MINT_TRUE;
+	pthread_cond_broadcast(&pm->start);
+	pthread_mutex_unlock(&pm->lock);
+
+	for(int i = 1; i < pm->numWorkers; ++i)
+		pthread_join(pm->workers[i].thread, NULL);
+
+	for(int i = 0; i < GC_MAX_MARK_THREADS; ++i)
+	{
+		if(pm->workers[i].marker)
+			pthread_mutex_destroy(&pm->workers[i].lock);
+		free(pm->workers[i].gray);
+		free(pm->workers[i].shared);
+		free(pm->workers[i].natives);
+	}
+
+	pthread_mutex_destroy(&pm->lock);
+	pthread_cond_destroy(&pm->start);
+	pthread_cond_destroy(&pm->done);
+	free(pm);
+}
+
+// Marks everything reachable from the gray objects using heap.numMarkThreads threads
+// (except through the onMark callbacks, which leave what they mark on heap.gray)
+static void ParallelMark(VM* vm)
+{
+	Heap* heap = &vm->heap;
+
+	int numThreads = heap->numMarkThreads < GC_MAX_MARK_THREADS ? heap->numMarkThreads : GC_MAX_MARK_THREADS;
+
+	if(heap->parallel && heap->parallel->numRequested != numThreads)
+	{
+		FreeParallelMarker(heap->parallel);
+		heap->parallel = NULL;
+	}
+
+	if(!heap->parallel)
+		heap->parallel = NewParallelMarker(vm, numThreads);
+	// NOTE: numWorkers can be smaller than what was asked for if creating a thread failed
+	ParallelMarker* pm = heap->parallel;
+
+	if(vm->debug)
+		printf("marking with %i threads...\n", pm->numWorkers);
+
+	// the gray objects (the roots, and whatever the incremental steps didn't
+	// get to) are dealt out to the workers
+	for(int i = 0; i < heap->numGray; ++i)
+	{
+		MarkWorker* worker = &pm->workers[i % pm->numWorkers];
+		AppendObject(&worker->gray, &worker->numGray, &worker->grayCapacity, heap->gray[i]);
+	}
+	heap->numGray = 0;
+
+	pthread_mutex_lock(&pm->lock);
+	pm->numIdle = 0;
+	pm->numDone = 0;
+	++pm->phase;
+	pthread_cond_broadcast(&pm->start);
+	pthread_mutex_unlock(&pm->lock);
+
+	DrainWorker(&pm->workers[0]);
+
+	pthread_mutex_lock(&pm->lock);
+	while(pm->numDone < pm->numWorkers - 1)
+		pthread_cond_wait(&pm->done, &pm->lock);
+	pthread_mutex_unlock(&pm->lock);
+
+	// whatever these mark ends up on heap.gray, which the caller drains
+	for(int i = 0; i < pm->numWorkers; ++i)
+	{
+		MarkWorker* worker = &pm->workers[i];
+		for(int j = 0; j < worker->numNatives; ++j)
+			worker->natives[j]->native.onMark(worker->natives[j]->native.value);
+		worker->numNatives = 0;
+	}
+}
+
+#endif
+
+void MarkValue(VM* vm, Value val)
+{
+	if(IS_OBJECT(val))
+		MarkObject(vm, AS_OBJECT(val));
+}
+
+void RememberObject(VM* vm, Object* obj)
+{
+	if(vm->heap.state == GC_MARKING)
+	{
+		// the object might have already been scanned
+		if(IsObjectMarked(obj))
+			AddRescan(&vm->heap, obj);
+		return;
+	}
+
+	HeapPage* page = GetObjectPage(obj);
+	int slot = GetObjectSlot(page, obj);
+	uint64_t bit = (uint64_t)1 << (slot & 63);
+
+	if(!(page->oldBits[slot >> 6] & bit) || (page->rememberedBits[slot >> 6] & bit)) return;
+
+	page->rememberedBits[slot >> 6] |= bit;
+	AppendObject(&vm->heap.remembered, &vm->heap.numRemembered, &vm->heap.rememberedCapacity, obj);
+}
+
+void ReadBarrier(VM* vm, Object* obj)
+{
+	Heap* heap = &vm->heap;
+	HeapPage* page = GetObjectPage(obj);
+	int slot = GetObjectSlot(page, obj);
+	uint64_t bit = (uint64_t)1 << (slot & 63);
+
+	if(page->markBits[slot >> 6] & bit) return;
+
+	// the object might not have been reached by the current collection yet
+	if(heap->state == GC_MARKING)
+		MarkObject(vm, obj);
+	else if(heap->state == GC_SWEEPING && page->needsSweep)
+	{
+		// the object was found dead but hasn't been freed yet; keep it (as an old
+		// object, like the rest of the survivors) since it's about to be used again
+		// NOTE: only strings are reachable this way, so there are no children to mark
+		page->markBits[slot >> 6] |= bit;
+		page->oldBits[slot >> 6] |= bit;
+	}
+}
+
+static void ForgetRemembered(Heap* heap)
+{
+	for(int i = 0; i < heap->numRemembered; ++i)
+	{
+		Object* obj = heap->remembered[i];
+		HeapPage* page = GetObjectPage(obj);
+		int slot = GetObjectSlot(page, obj);
+
+		page->rememberedBits[slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+	}
+
+	heap->numRemembered = 0;
+}
+
+static void MarkRoots(VM* vm)
+{
+	for (int i = 0; i < vm->numGlobals; ++i)
+		MarkValue(vm, vm->globals[i]);
+
+	// NOTE: these can be NULL while the program is being loaded
+	for (int i = 0; i < vm->numStringConstants; ++i)
+	{
+		if(vm->stringConstantObjects[i])
+			MarkObject(vm, vm->stringConstantObjects[i]);
+	}
+
+	VMThread* current = vm->thread;
+
+	while (current)
+	{
+		for (int i = 0; i < current->stackSize; ++i)
+			MarkValue(vm, current->stack[i]);
+		MarkValue(vm, current->retVal);
+
+		current = current->parent;
+	}
+}
+
+void RegisterWeakObject(VM* vm, Object* obj)
+{
+	AppendObject(&vm->heap.weak, &vm->heap.numWeak, &vm->heap.weakCapacity, obj);
+}
+
+// once marking is done, anything unmarked is dead (except for the old objects
+// during a minor collection, which aren't marked at all)
+static char IsObjectDead(Heap* heap, Object* obj)
+{
+	return !IsObjectMarked(obj) && !(heap->minor && IsObjectOld(obj));
+}
+
+typedef struct
+{
+	Heap* heap;
+	char weakMode;
+} WeakEntries;
+
+static char IsWeakValueDead(WeakEntries* weak, Value val)
+{
+	return IsWeakReferent(val) && IsObjectDead(weak->heap, AS_OBJECT(val));
+}
+
+static char IsWeakDictEntryDead(const DictEntry* entry, void* data)
+{
+	// NOTE: only the values of a dict can be weak
+	return IsWeakValueDead(data, entry->value);
+}
+
+static char IsWeakMapEntryDead(const MapEntry* entry, void* data)
+{
+	WeakEntries* weak = data;
+
+	if((weak->weakMode & WEAK_KEYS) && IsWeakValueDead(weak, entry->key))
+		return MINT_TRUE;
+	if((weak->weakMode & WEAK_VALUES) && IsWeakValueDead(weak, entry->value))
+		return MINT_TRUE;
+	return MINT_FALSE;
+}
+
+// Must be called after marking and before anything is freed; the weak objects
+// which are dead themselves are dropped from the list
+static void ClearWeakReferences(VM* vm)
+{
+	Heap* heap = &vm->heap;
+	int numWeak = 0;
+
+	for(int i = 0; i < heap->numWeak; ++i)
+	{
+		Object* obj = heap->weak[i];
+		if(IsObjectDead(heap, obj)) continue;
+
+		if(obj->type == OBJ_WEAK)
+		{
+			if(obj->weak && IsObjectDead(heap, obj->weak))
+				obj->weak = NULL;
+		}
+		else if(obj->type == OBJ_MAP)
+		{
+			WeakEntries weak = { heap, obj->map->weakMode };
+			MapRemoveWhere(obj->map, IsWeakMapEntryDead, &weak);
+		}
+		else
+		{
+			WeakEntries weak = { heap, obj->weakMode };
+			if(DictRemoveWhere(obj->dict, IsWeakDictEntryDead, &weak) > 0)
+				SetExternalSize(vm, obj, sizeof(Dict) + DictMemory(obj->dict));
+		}
+
+		heap->weak[numWeak++] = obj;
+	}
+
+	heap->numWeak = numWeak;
+}
+
+// Objects which can have references stored in them without going through a
+// write barrier have to be scanned by every minor collection once they're old
+static void PromoteObjects(VM* vm, HeapPage* page, int word, uint64_t promoted)
+{
+	while(promoted)
+	{
+		int bit = CountTrailingZeros(promoted);
+		promoted &= promoted - 1;
+
+		Object* obj = GetPageObject(page, word * 64 + bit);
+		if(obj->type == OBJ_THREAD || (obj->type == OBJ_NATIVE && obj->native.onMark))
+			AppendObject(&vm->heap.sticky, &vm->heap.numSticky, &vm->heap.stickyCapacity, obj);
+	}
+}
+
+static void FreeObject(VM* vm, Object* obj)
+{
+	assert(obj);
+
+	vm->heap.numBytes -= GC_SLOT_SIZE + obj->externalSize;
+	--vm->heap.stats.numObjects[obj->type];
+	vm->heap.stats.numBytes[obj->type] -= GC_SLOT_SIZE + obj->externalSize;
+
+	if(obj->type == OBJ_STRING)
+	{
+		if(obj->string.interned)
+			StringTableRemove(&vm->strings, obj);
+		if(!obj->string.isRope)
+			free(obj->string.raw);
+	}
+	else if(obj->type == OBJ_NATIVE)
+	{
+		if(obj->native.onFree)
+			obj->native.onFree(obj->native.value);
+	}
+	else if (obj->type == OBJ_ARRAY)
+	{
+		free(obj->array.members);
+		obj->array.capacity = 0;
+		obj->array.length = 0;
+	}
+	else if(obj->type == OBJ_DICT)
+	{
+		FreeDict(obj->dict);
+		free(obj->dict);
+	}
+	else if(obj->type == OBJ_STRUCT)
+		free(obj->structure.members);
+	else if(obj->type == OBJ_MAP)
+	{
+		FreeMap(obj->map);
+		free(obj->map);
+	}
+}
+
+// Frees the dead objects in the pages which haven't been swept since the last
+// major collection until 'budget' units of work (one per page and one per object
+// freed) have been done; returns the leftover budget
+static int SweepPages(VM* vm, int budget)
+{
+	Heap* heap = &vm->heap;
+
+	while(budget > 0 && *heap->sweepLink)
+	{
+		HeapPage* page = *heap->sweepLink;
+
+		// pages allocated since the collection don't have anything dead in them
+		if(!page->needsSweep)
+		{
+			heap->sweepLink = &page->next;
+			continue;
+		}
+
+		int numLive = 0;
+
+		for(int i = 0; i < GC_BITMAP_WORDS; ++i)
+		{
+			uint64_t dead = page->allocBits[i] & ~page->markBits[i];
+
+			while(dead)
+			{
+				int bit = CountTrailingZeros(dead);
+				dead &= dead - 1;
+
+				FreeObject(vm, GetPageObject(page, i * 64 + bit));
+				--vm->numObjects;
+				--heap->numOld;
+				--budget;
+			}
+
+			page->allocBits[i] &= page->markBits[i];
+			page->markBits[i] = 0;
+
+			numLive += CountBits(page->allocBits[i]);
+		}
+
+		page->numLive = numLive;
+		page->freeHint = 0;
+		page->needsSweep = MINT_FALSE;
+		--budget;
+
+		// NOTE: the page is kept if there's nowhere else to allocate, otherwise
+		// AllocSlot would end up sweeping everything looking for a free slot
+		if(numLive == 0 && ++heap->numEmptyPages > GC_MAX_EMPTY_PAGES && heap->freePages)
+		{
+			// NOTE: unswept pages are never in the free list or the nursery
+			*heap->sweepLink = page->next;
+			--heap->numPages;
+			ReleasePage(page);
+			continue;
+		}
+
+		if(numLive < GC_PAGE_SLOTS)
+		{
+			page->inFreeList = MINT_TRUE;
+			page->nextFree = heap->freePages;
+			heap->freePages = page;
+		}
+
+		heap->sweepLink = &page->next;
+	}
+
+	if(!*heap->sweepLink)
+	{
+		heap->state = GC_IDLE;
+		heap->sweepLink = NULL;
+
+		double bytesUntilGc = heap->numBytes * heap->growthFactor;
+		heap->bytesUntilGc = bytesUntilGc > GC_MIN_HEAP_BYTES ? (size_t)bytesUntilGc : GC_MIN_HEAP_BYTES;
+
+		if(vm->debug)
+		{
+			printf("cleaned objects\n"
+				   "objects after collection: %i\n"
+				   "heap pages: %i\n"
+				   "heap bytes: %zu\n", vm->numObjects, vm->heap.numPages, vm->heap.numBytes);
+		}
+	}
+
+	return budget;
+}
+
+static void FinishSweep(VM* vm)
+{
+	if(vm->heap.state == GC_SWEEPING)
+		SweepPages(vm, INT_MAX);
+}
+
+// Only sweeps the pages in the nursery; young objects which survive are promoted
+static void SweepNursery(VM* vm)
+{
+	Heap* heap = &vm->heap;
+	HeapPage* page = heap->nursery;
+
+	while(page)
+	{
+		HeapPage* next = page->nextNursery;
+		int numLive = 0;
+
+		for(int i = 0; i < GC_BITMAP_WORDS; ++i)
+		{
+			uint64_t young = page->allocBits[i] & ~page->oldBits[i];
+			uint64_t dead = young & ~page->markBits[i];
+
+			while(dead)
+			{
+				int bit = CountTrailingZeros(dead);
+				dead &= dead - 1;
+
+				FreeObject(vm, GetPageObject(page, i * 64 + bit));
+				--vm->numObjects;
+			}
+
+			uint64_t promoted = young & page->markBits[i];
+			
+			PromoteObjects(vm, page, i, promoted);
+			heap->numOld += CountBits(promoted);
+
+			page->allocBits[i] = page->oldBits[i] | promoted;
+			page->oldBits[i] = page->allocBits[i];
+			page->markBits[i] = 0;
+
+			numLive += CountBits(page->allocBits[i]);
+		}
+
+		page->numLive = numLive;
+		page->freeHint = 0;
+		page->inNursery = MINT_FALSE;
+		page->nextNursery = NULL;
+
+		if(!page->inFreeList && numLive < GC_PAGE_SLOTS)
+		{
+			page->inFreeList = MINT_TRUE;
+			page->nextFree = heap->freePages;
+			heap->freePages = page;
+		}
+
+		page = next;
+	}
+
+	heap->nursery = NULL;
+}
+
+void CollectGarbageMinor(VM* vm)
+{
+	Heap* heap = &vm->heap;
+
+	// the nursery is collected along with everything else by the incremental collection
+	if(heap->state == GC_MARKING) return;
+
+	BeginPause(heap);
+	++heap->stats.numMinor;
+
+	// NOTE: the old objects are only known once the last major collection has been swept
+	FinishSweep(vm);
+
+	if(vm->debug)
+		printf("collecting nursery...\n");
+	int numObjects = vm->numObjects;
+
+	heap->minor = MINT_TRUE;
+
+	MarkRoots(vm);
+	for(int i = 0; i < heap->numRemembered; ++i)
+		ScanObject(vm, NULL, heap->remembered[i]);
+	for(int i = 0; i < heap->numSticky; ++i)
+		ScanObject(vm, NULL, heap->sticky[i]);
+
+	while(heap->numGray > 0)
+		MarkGray(vm, INT_MAX);
+
+	ClearWeakReferences(vm);
+
+	heap->minor = MINT_FALSE;
+
+	SweepNursery(vm);
+	
+	// everything the remembered objects pointed to has been promoted now
+	ForgetRemembered(heap);
+
+	EndPause(heap);
+
+	if(vm->debug)
+	{
+		printf("objects before minor collection: %i\n"
+			   "objects after minor collection: %i\n", numObjects, vm->numObjects);
+	}
+}
+
+static void StartCycle(VM* vm)
+{
+	Heap* heap = &vm->heap;
+
+	if(vm->debug)
+		printf("starting collection cycle...\n");
+
+	// everything reachable is going to be traced from the roots so the remembered set isn't needed
+	ForgetRemembered(heap);
+
+	heap->state = GC_MARKING;
+	heap->bytesSinceStep = 0;
+
+	MarkRoots(vm);
+}
+
+static void FinishCycle(VM* vm)
+{
+	Heap* heap = &vm->heap;
+
+	if(vm->debug)
+		printf("finishing collection cycle...\n");
+	int numObjects = vm->numObjects;
+
+	// the stacks and globals are written to without barriers, so they're
+	// marked again along with the objects in the rescan set
+	MarkRoots(vm);
+
+	int numRescan = heap->numRescan;
+	for(int i = 0; i < numRescan; ++i)
+		ScanObject(vm, NULL, heap->rescan[i]);
+
+#ifdef MINT_PARALLEL_MARK
+	if(heap->numMarkThreads > 1 && vm->numObjects >= GC_PARALLEL_MARK_MIN_OBJECTS)
+		ParallelMark(vm);
+#endif
+
+	while(heap->numGray > 0)
+		MarkGray(vm, INT_MAX);
+
+	heap->numRescan = 0;
+	++heap->stats.numMajor;
+
+	ClearWeakReferences(vm);
+
+	if(vm->debug)
+		printf("marked all objects\n");
+
+	// the sticky set is rebuilt from the surviving sticky objects and the ones promoted below
+	int numSticky = 0;
+	for(int i = 0; i < heap->numSticky; ++i)
+	{
+		Object* obj = heap->sticky[i];
+		if(IsObjectMarked(obj))
+			heap->sticky[numSticky++] = obj;
+	}
+	heap->numSticky = numSticky;
+
+	// Everything which survives a major collection is old. That's recorded right
+	// away (the write barrier depends on it) but the dead objects are left in
+	// place for SweepPages to free as the program allocates.
+	for(HeapPage* page = heap->pages; page; page = page->next)
+	{
+		for(int i = 0; i < GC_BITMAP_WORDS; ++i)
+		{
+			PromoteObjects(vm, page, i, page->markBits[i] & ~page->oldBits[i]);
+
+			page->oldBits[i] = page->allocBits[i] & page->markBits[i];
+			page->rememberedBits[i] = 0;
+		}
+
+		page->needsSweep = MINT_TRUE;
+		page->inNursery = MINT_FALSE;
+		page->nextNursery = NULL;
+		page->inFreeList = MINT_FALSE;
+		page->nextFree = NULL;
+	}
+
+	heap->nursery = NULL;
+	heap->freePages = NULL;
+
+	// NOTE: the dead objects are counted as old until they're freed
+	heap->numOld = vm->numObjects;
+
+	heap->state = GC_SWEEPING;
+	heap->sweepLink = &heap->pages;
+	heap->numEmptyPages = 0;
+
+	if(vm->debug)
+		printf("objects before collection: %i\n", numObjects);
+}
+
+char CollectGarbageStep(VM* vm, int budget)
+{
+	Heap* heap = &vm->heap;
+
+	BeginPause(heap);
+
+	if(heap->state == GC_IDLE)
+		StartCycle(vm);
+
+	if(heap->state == GC_MARKING)
+	{
+		budget = MarkGray(vm, budget);
+		if(budget > 0 || heap->numGray == 0)
+			FinishCycle(vm);
+	}
+
+	if(heap->state == GC_SWEEPING)
+		SweepPages(vm, budget);
+
+	EndPause(heap);
+	return heap->state == GC_IDLE;
+}
+
+void CollectGarbage(VM* vm)
+{
+	BeginPause(&vm->heap);
+
+	// NOTE: if an incremental collection is in progress then this just finishes
+	// it; either way the dead objects are swept lazily afterwards
+	FinishSweep(vm);
+	if(vm->heap.state == GC_IDLE)
+		StartCycle(vm);
+	FinishCycle(vm);
+
+	EndPause(&vm->heap);
+}
+
+// Frees everything it can right away since the heap is about to grow past heap.maxBytes
+static void EnforceHeapLimit(VM* vm)
+{
+	Heap* heap = &vm->heap;
+
+	if(vm->debug)
+		printf("heap limit reached, collecting everything...\n");
+
+	CollectGarbage(vm);
+	FinishSweep(vm);
+
+	if(heap->numBytes + GC_SLOT_SIZE > heap->maxBytes)
+		ErrorExitVM(vm, "Heap limit of %zu bytes exceeded (%zu bytes are in use)\n", heap->maxBytes, heap->numBytes);
+}
+
+void CollectGarbageIfNeeded(VM* vm)
+{
+	Heap* heap = &vm->heap;
+
+	char stepDue = heap->state != GC_IDLE && heap->bytesSinceStep >= GC_STEP_BYTES;
+	char collectionDue = heap->state == GC_IDLE &&
+		(heap->numBytes >= heap->bytesUntilGc || vm->numObjects - heap->numOld >= GC_NURSERY_SIZE);
+	char limitReached = heap->maxBytes > 0 && heap->numBytes + GC_SLOT_SIZE > heap->maxBytes;
+
+	if(!stepDue && !collectionDue && !limitReached) return;
+
+	BeginPause(heap);
+
+	if(stepDue)
+	{
+		// the collector has to keep up with big allocations (see SetExternalSize) too
+		size_t numSteps = heap->bytesSinceStep / GC_STEP_BYTES;
+		int work = heap->state == GC_SWEEPING ? GC_SWEEP_STEP_WORK : heap->stepWork;
+
+		heap->bytesSinceStep %= GC_STEP_BYTES;
+		if(work > 0 && numSteps > (size_t)(INT_MAX / work))
+			CollectGarbageStep(vm, INT_MAX);
+		else
+			CollectGarbageStep(vm, (int)numSteps * work);
+	}
+
+	// NOTE: the nursery can't be collected until the last major collection has
+	// been swept, so it's allowed to grow past GC_NURSERY_SIZE until then
+	if(heap->state == GC_IDLE)
+	{
+		if(heap->numBytes >= heap->bytesUntilGc)
+		{
+			if(heap->stepWork > 0)
+				StartCycle(vm);
+			else
+				CollectGarbage(vm);
+		}
+		else if(vm->numObjects - heap->numOld >= GC_NURSERY_SIZE)
+			CollectGarbageMinor(vm);
+	}
+
+	if(heap->maxBytes > 0 && heap->numBytes + GC_SLOT_SIZE > heap->maxBytes)
+		EnforceHeapLimit(vm);
+
+	EndPause(heap);
+}
+
+Object* NewObject(VM* vm, ObjectType type)
+{
+	Heap* heap = &vm->heap;
+
+	heap->bytesSinceStep += GC_SLOT_SIZE;
+	if(!vm->inExternBody)
+		CollectGarbageIfNeeded(vm);
+
+	if(vm->debug)
+		printf("creating object: %s\n", ObjectTypeNames[type]);
+
+	Object* obj = AllocSlot(vm);
+	memset(obj, 0, sizeof(Object));
+
+	obj->type = type;
+
+	// objects allocated while marking are black (their contents go through the write barrier)
+	if(heap->state == GC_MARKING)
+	{
+		HeapPage* page = GetObjectPage(obj);
+		int slot = GetObjectSlot(page, obj);
+		page->markBits[slot >> 6] |= (uint64_t)1 << (slot & 63);
+
+		if(type == OBJ_THREAD)
+			AddRescan(heap, obj);
+	}
+
+	if(type == OBJ_WEAK)
+		RegisterWeakObject(vm, obj);
+
+	++vm->numObjects;
+	heap->numBytes += GC_SLOT_SIZE;
+
+	++heap->stats.allocatedObjects;
+	heap->stats.allocatedBytes += GC_SLOT_SIZE;
+	++heap->stats.numObjects[type];
+	heap->stats.numBytes[type] += GC_SLOT_SIZE;
+
+	return obj;
+}
+
+static void SetHeapExternalSize(Heap* heap, Object* obj, size_t size)
+{
+	// NOTE: anything past 4GB isn't counted
+	uint32_t externalSize = size < UINT32_MAX ? (uint32_t)size : UINT32_MAX;
+
+	if(externalSize > obj->externalSize)
+	{
+		heap->bytesSinceStep += externalSize - obj->externalSize;
+		heap->stats.allocatedBytes += externalSize - obj->externalSize;
+	}
+
+	heap->numBytes -= obj->externalSize;
+	heap->numBytes += externalSize;
+	heap->stats.numBytes[obj->type] -= obj->externalSize;
+	heap->stats.numBytes[obj->type] += externalSize;
+	obj->externalSize = externalSize;
+}
+
+void SetExternalSize(VM* vm, Object* obj, size_t size)
+{
+	SetHeapExternalSize(&vm->heap, obj, size);
+}
+
+void SetObjectExternalSize(Object* obj, size_t size)
+{
+	SetHeapExternalSize(GetObjectPage(obj)->heap, obj, size);
+}
+
+void ChangeObjectType(VM* vm, Object* obj, ObjectType type)
+{
+	SetExternalSize(vm, obj, 0);
+
+	--vm->heap.stats.numObjects[obj->type];
+	vm->heap.stats.numBytes[obj->type] -= GC_SLOT_SIZE;
+
+	obj->type = type;
+
+	++vm->heap.stats.numObjects[type];
+	vm->heap.stats.numBytes[type] += GC_SLOT_SIZE;
+}
+
+void GetGcStats(VM* vm, GcStats* stats)
+{
+	Heap* heap = &vm->heap;
+
+	*stats = heap->stats;
+
+	double elapsed = GetTime() - stats->startTime;
+	stats->allocationRate = elapsed > 0 ? stats->allocatedBytes / elapsed : 0;
+
+	stats->numPages = heap->numPages;
+	stats->numFreePages = 0;
+	stats->numFreeSlots = 0;
+
+	// NOTE: the unswept pages aren't in the free list yet
+	for(HeapPage* page = heap->freePages; page; page = page->nextFree)
+	{
+		++stats->numFreePages;
+		stats->numFreeSlots += GC_PAGE_SLOTS - page->numLive;
+	}
+}
+
+void FreeHeap(VM* vm)
+{
+	HeapPage* page = vm->heap.pages;
+
+	while(page)
+	{
+		HeapPage* next = page->next;
+
+		for(int i = 0; i < GC_BITMAP_WORDS; ++i)
+		{
+			uint64_t live = page->allocBits[i];
+
+			while(live)
+			{
+				int bit = CountTrailingZeros(live);
+				live &= live - 1;
+
+				FreeObject(vm, GetPageObject(page, i * 64 + bit));
+			}
+		}
+
+		ReleasePage(page);
+		page = next;
+	}
+
+#ifdef MINT_PARALLEL_MARK
+	if(vm->heap.parallel)
+		FreeParallelMarker(vm->heap.parallel);
+#endif
+
+	free(vm->heap.remembered);
+	free(vm->heap.sticky);
+	free(vm->heap.weak);
+	free(vm->heap.gray);
+	free(vm->heap.rescan);
+
+	InitHeap(&vm->heap);
+	vm->numObjects = 0;
+}
@@ -0,0 +1,102 @@
+#include "intern.h"
+#include "vm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void* ecalloc(size_t size, size_t nmemb)
+{
+	void* mem = calloc(size, nmemb);
+	if(!mem) { fprintf(stderr, "Virtual machine ran out of memory!\n"); exit(1); }
+	return mem;
+}
+
+void InitStringTable(StringTable* table)
+{
+	table->entries = NULL;
+	table->capacity = 0;
+	table->count = 0;
+}
+
+Object* StringTableFind(StringTable* table, const char* chars, int length, uint32_t hash)
+{
+	if(table->count == 0) return NULL;
+
+	int mask = table->capacity - 1;
+	for(int i = hash & mask; table->entries[i]; i = (i + 1) & mask)
+	{
+		Object* obj = table->entries[i];
+		if(obj->string.hash == hash && obj->string.length == length && memcmp(obj->string.raw, chars, length) == 0)
+			return obj;
+	}
+
+	return NULL;
+}
+
+static void InsertEntry(StringTable* table, Object* obj)
+{
+	int mask = table->capacity - 1;
+	int i = obj->string.hash & mask;
+
+	while(table->entries[i])
+		i = (i + 1) & mask;
+
+	table->entries[i] = obj;
+}
+
+void StringTableAdd(StringTable* table, Object* obj)
+{
+	// keep the load factor under 1/2
+	if((table->count + 1) * 2 > table->capacity)
+	{
+		Object** entries = table->entries;
+		int capacity = table->capacity;
+
+		table->capacity = capacity ? capacity * 2 : INIT_STRING_TABLE_CAPACITY;
+		table->entries = ecalloc(sizeof(Object*), table->capacity);
+
+		for(int i = 0; i < capacity; ++i)
+		{
+			if(entries[i])
+				InsertEntry(table, entries[i]);
+		}
+
+		free(entries);
+	}
+
+	InsertEntry(table, obj);
+	++table->count;
+}
+
+void StringTableRemove(StringTable* table, Object* obj)
+{
+	int mask = table->capacity - 1;
+	int i = obj->string.hash & mask;
+
+	while(table->entries[i] != obj)
+		i = (i + 1) & mask;
+
+	// NOTE: entries after the removed one are shifted back into the hole
+	// (instead of leaving a tombstone) so lookups can stop at the first empty slot
+	int hole = i;
+	for(i = (i + 1) & mask; table->entries[i]; i = (i + 1) & mask)
+	{
+		int home = table->entries[i]->string.hash & mask;
+
+		// the entry can only move back if its home slot isn't between the hole and it
+		if(((i - home) & mask) >= ((i - hole) & mask))
+		{
+			table->entries[hole] = table->entries[i];
+			hole = i;
+		}
+	}
+
+	table->entries[hole] = NULL;
+	--table->count;
+}
+
+void FreeStringTable(StringTable* table)
+{
+	free(table->entries);
+	InitStringTable(table);
+}
@@ -0,0 +1,1340 @@
+// The interpreter loop. vm.c includes this file twice: INTERP_NAME is the name of
+// the function to define and INTERP_TRACE says whether it's the tracing one.
+//
+// The tracing loop checks vm->debug (to print every instruction) and every
+// reason to stop before each instruction, which also lets it single step
+// (see ExecuteCycle). The other one has no tracing at all: it only checks
+// whether it has to stop after instructions which can end a frame or switch
+// threads, and where the compiler supports it (GCC and Clang) every handler
+// jumps straight to the next one through a table of label addresses instead
+// of going back through the switch.
+
+#if INTERP_TRACE
+#define TRACE vm->debug
+#else
+#define TRACE 0
+#endif
+
+#if !INTERP_TRACE && defined(__GNUC__) && !defined(MINT_NO_COMPUTED_GOTO)
+#define INTERP_COMPUTED_GOTO
+#endif
+
+#ifdef INTERP_COMPUTED_GOTO
+#define CASE(op) case op: L_##op:
+#define NEXT goto *labels[vm->code[thread->pc].i]
+#else
+#define CASE(op) case op:
+#define NEXT break
+#endif
+
+// Operands are read in order, each one is an Instr (see DecodeProgram)
+#define READ_OPERAND() (vm->code[thread->pc++])
+
+// NOTE: Must come after anything which can end the current frame or switch threads
+#define CHECK_STOP() if(ShouldStop(vm, stopFp)) return; thread = vm->thread
+
+#if INTERP_TRACE
+static void INTERP_NAME(VM* vm, int stopFp, char singleStep)
+#else
+static void INTERP_NAME(VM* vm, int stopFp)
+#endif
+{
+	VMThread* thread = vm->thread;
+
+#ifdef INTERP_COMPUTED_GOTO
+	static const void* labels[256] =
+	{
+		[0 ... 255] = &&L_INVALID,
+		
+		[OP_GET_RETVAL] = &&L_OP_GET_RETVAL,
+		[OP_SET_RETVAL] = &&L_OP_SET_RETVAL,
+		[OP_PUSH_NULL] = &&L_OP_PUSH_NULL,
+		[OP_PUSH_TRUE] = &&L_OP_PUSH_TRUE,
+		[OP_PUSH_FALSE] = &&L_OP_PUSH_FALSE,
+		[OP_PUSH_NUMBER] = &&L_OP_PUSH_NUMBER,
+		[OP_PUSH_STRING] = &&L_OP_PUSH_STRING,
+		[OP_CREATE_ARRAY] = &&L_OP_CREATE_ARRAY,
+		[OP_CREATE_ARRAY_BLOCK] = &&L_OP_CREATE_ARRAY_BLOCK,
+		[OP_PUSH_FUNC] = &&L_OP_PUSH_FUNC,
+		[OP_PUSH_DICT] = &&L_OP_PUSH_DICT,
+		[OP_PUSH_THREAD] = &&L_OP_PUSH_THREAD,
+		[OP_EXPAND_ARRAY] = &&L_OP_EXPAND_ARRAY,
+		[OP_PUSH_STACK] = &&L_OP_PUSH_STACK,
+		[OP_POP_STACK] = &&L_OP_POP_STACK,
+		[OP_LENGTH] = &&L_OP_LENGTH,
+		[OP_ARRAY_PUSH] = &&L_OP_ARRAY_PUSH,
+		[OP_ARRAY_POP] = &&L_OP_ARRAY_POP,
+		[OP_ARRAY_CLEAR] = &&L_OP_ARRAY_CLEAR,
+		[OP_SET_META] = &&L_OP_SET_META,
+		[OP_GET_META] = &&L_OP_GET_META,
+		[OP_DICT_SET] = &&L_OP_DICT_SET,
+		[OP_DICT_GET] = &&L_OP_DICT_GET,
+		[OP_DICT_SET_RAW] = &&L_OP_DICT_SET_RAW,
+		[OP_DICT_GET_RAW] = &&L_OP_DICT_GET_RAW,
+		[OP_DICT_PAIRS] = &&L_OP_DICT_PAIRS,
+		[OP_PUSH_STRUCT] = &&L_OP_PUSH_STRUCT,
+		[OP_STRUCT_SET] = &&L_OP_STRUCT_SET,
+		[OP_STRUCT_GET] = &&L_OP_STRUCT_GET,
+		[OP_ITER_BEGIN] = &&L_OP_ITER_BEGIN,
+		[OP_ITER_NEXT] = &&L_OP_ITER_NEXT,
+		[OP_ITER_KEY] = &&L_OP_ITER_KEY,
+		[OP_ITER_VALUE] = &&L_OP_ITER_VALUE,
+		[OP_CAT] = &&L_OP_CAT,
+		[OP_THREAD_RUN] = &&L_OP_THREAD_RUN,
+		[OP_THREAD_YIELD] = &&L_OP_THREAD_YIELD,
+		[OP_THREAD_DONE] = &&L_OP_THREAD_DONE,
+		[OP_THREAD_DELETE] = &&L_OP_THREAD_DELETE,
+		[OP_ADD] = &&L_OP_ADD,
+		[OP_SUB] = &&L_OP_SUB,
+		[OP_MUL] = &&L_OP_MUL,
+		[OP_DIV] = &&L_OP_DIV,
+		[OP_MOD] = &&L_OP_MOD,
+		[OP_OR] = &&L_OP_OR,
+		[OP_AND] = &&L_OP_AND,
+		[OP_LT] = &&L_OP_LT,
+		[OP_LTE] = &&L_OP_LTE,
+		[OP_GT] = &&L_OP_GT,
+		[OP_GTE] = &&L_OP_GTE,
+		[OP_EQU] = &&L_OP_EQU,
+		[OP_NEQU] = &&L_OP_NEQU,
+		[OP_NEG] = &&L_OP_NEG,
+		[OP_LOGICAL_NOT] = &&L_OP_LOGICAL_NOT,
+		[OP_LOGICAL_AND] = &&L_OP_LOGICAL_AND,
+		[OP_LOGICAL_OR] = &&L_OP_LOGICAL_OR,
+		[OP_SHL] = &&L_OP_SHL,
+		[OP_SHR] = &&L_OP_SHR,
+		[OP_SETINDEX] = &&L_OP_SETINDEX,
+		[OP_GETINDEX] = &&L_OP_GETINDEX,
+		[OP_SET] = &&L_OP_SET,
+		[OP_GET] = &&L_OP_GET,
+		[OP_WRITE] = &&L_OP_WRITE,
+		[OP_READ] = &&L_OP_READ,
+		[OP_GOTO] = &&L_OP_GOTO,
+		[OP_GOTOZ] = &&L_OP_GOTOZ,
+		[OP_CALL] = &&L_OP_CALL,
+		[OP_CALLP] = &&L_OP_CALLP,
+		[OP_RETURN] = &&L_OP_RETURN,
+		[OP_RETURN_VALUE] = &&L_OP_RETURN_VALUE,
+		[OP_CALLF] = &&L_OP_CALLF,
+		[OP_GETLOCAL] = &&L_OP_GETLOCAL,
+		[OP_SETLOCAL] = &&L_OP_SETLOCAL,
+		[OP_HALT] = &&L_OP_HALT,
+		[OP_SETVMDEBUG] = &&L_OP_SETVMDEBUG,
+		[OP_GETARGS] = &&L_OP_GETARGS,
+		[OP_FILE] = &&L_OP_FILE,
+		[OP_LINE] = &&L_OP_LINE,
+		[OP_ADD_RR] = &&L_OP_ADD_RR,
+		[OP_ADD_RK] = &&L_OP_ADD_RK,
+		[OP_ADD_RR_TO] = &&L_OP_ADD_RR_TO,
+		[OP_ADD_RK_TO] = &&L_OP_ADD_RK_TO,
+		[OP_SUB_RR] = &&L_OP_SUB_RR,
+		[OP_SUB_RK] = &&L_OP_SUB_RK,
+		[OP_SUB_RR_TO] = &&L_OP_SUB_RR_TO,
+		[OP_SUB_RK_TO] = &&L_OP_SUB_RK_TO,
+		[OP_MUL_RR] = &&L_OP_MUL_RR,
+		[OP_MUL_RK] = &&L_OP_MUL_RK,
+		[OP_MUL_RR_TO] = &&L_OP_MUL_RR_TO,
+		[OP_MUL_RK_TO] = &&L_OP_MUL_RK_TO,
+		[OP_DIV_RR] = &&L_OP_DIV_RR,
+		[OP_DIV_RK] = &&L_OP_DIV_RK,
+		[OP_DIV_RR_TO] = &&L_OP_DIV_RR_TO,
+		[OP_DIV_RK_TO] = &&L_OP_DIV_RK_TO,
+		[OP_LT_RR] = &&L_OP_LT_RR,
+		[OP_LT_RK] = &&L_OP_LT_RK,
+		[OP_LT_RR_GOTOZ] = &&L_OP_LT_RR_GOTOZ,
+		[OP_LT_RK_GOTOZ] = &&L_OP_LT_RK_GOTOZ,
+		[OP_LTE_RR] = &&L_OP_LTE_RR,
+		[OP_LTE_RK] = &&L_OP_LTE_RK,
+		[OP_LTE_RR_GOTOZ] = &&L_OP_LTE_RR_GOTOZ,
+		[OP_LTE_RK_GOTOZ] = &&L_OP_LTE_RK_GOTOZ,
+		[OP_GT_RR] = &&L_OP_GT_RR,
+		[OP_GT_RK] = &&L_OP_GT_RK,
+		[OP_GT_RR_GOTOZ] = &&L_OP_GT_RR_GOTOZ,
+		[OP_GT_RK_GOTOZ] = &&L_OP_GT_RK_GOTOZ,
+		[OP_GTE_RR] = &&L_OP_GTE_RR,
+		[OP_GTE_RK] = &&L_OP_GTE_RK,
+		[OP_GTE_RR_GOTOZ] = &&L_OP_GTE_RR_GOTOZ,
+		[OP_GTE_RK_GOTOZ] = &&L_OP_GTE_RK_GOTOZ,
+		[OP_MOVE_R] = &&L_OP_MOVE_R,
+		[OP_MOVE_K] = &&L_OP_MOVE_K,
+		[OP_GETINDEX_RR] = &&L_OP_GETINDEX_RR,
+	};
+#endif
+
+#if INTERP_TRACE
+	int steps = 0;
+#endif
+
+	for(;;)
+	{
+#if INTERP_TRACE
+		if(ShouldStop(vm, stopFp) || (singleStep && steps > 0) || (!singleStep && !vm->debug))
+			return;
+		
+		thread = vm->thread;
+		++steps;
+		
+		if(vm->debug)
+			printf("(%s:%i:%i): ", thread->curFile, thread->curLine, thread->pc);
+#endif
+
+#ifdef INTERP_COMPUTED_GOTO
+		NEXT;
+#endif
+
+		switch(vm->code[thread->pc].i)
+		{
+			CASE(OP_GET_RETVAL)
+			{
+				if(TRACE)
+					printf("get_retval\n");
+				++thread->pc;
+				PushValue(vm, thread->retVal);
+			} NEXT;
+
+			CASE(OP_SET_RETVAL)
+			{
+				if(TRACE)
+					printf("set_retval\n");
+				++thread->pc;
+
+				thread->retVal = PopValue(vm);
+			} NEXT;
+		
+			CASE(OP_PUSH_NULL)
+			{
+				if(TRACE)
+					printf("push_null\n");
+				++thread->pc;
+				PushNull(vm);
+			} NEXT;
+
+			CASE(OP_PUSH_TRUE)
+			{
+				if(TRACE)
+					printf("push_true\n");
+				++thread->pc;
+				PushBool(vm, MINT_TRUE);
+			} NEXT;
+		
+			CASE(OP_PUSH_FALSE)
+			{
+				if(TRACE)
+					printf("push_false\n");
+				++thread->pc;
+				PushBool(vm, MINT_FALSE);
+			} NEXT;
+
+			CASE(OP_PUSH_NUMBER)
+			{
+				++thread->pc;
+				Value value = READ_OPERAND().value;
+			
+				if(TRACE)
+					printf("push_number %g\n", AS_NUMBER(value));
+				PushValue(vm, value);
+			} NEXT;
+		
+			CASE(OP_PUSH_STRING)
+			{
+				++thread->pc;
+				Object* obj = READ_OPERAND().obj;
+				if(TRACE)
+					printf("push_string %s\n", obj->string.raw);
+				PushObject(vm, obj);
+			} NEXT;
+		
+			CASE(OP_PUSH_FUNC)
+			{
+				if(TRACE)
+					printf("push_func\n");
+				Word hasEnv = vm->code[++thread->pc].i;
+				Word isExtern = vm->code[++thread->pc].i;
+				++thread->pc;
+				int index = READ_OPERAND().i;
+			
+				Object* env = NULL;
+				if(hasEnv)
+					env = PopObject(vm);
+				PushFunc(vm, index, isExtern, env);
+			} NEXT;
+		
+			CASE(OP_PUSH_DICT)
+			{
+				if(TRACE)
+					printf("push_dict\n");
+				++thread->pc;
+				PushDict(vm);
+			} NEXT;
+
+			CASE(OP_PUSH_THREAD)
+			{
+				if(TRACE)
+					printf("push_thread\n");
+				++thread->pc;
+
+				Object* obj = PopFuncObject(vm);
+				if (obj->func.isExtern)
+					ErrorExitVM(vm, "Expected function but received extern %s instead\n", vm->externNames[obj->func.index]);
+				PushThread(vm, obj);
+			} NEXT;
+
+			/* REMOVED: see header
+			 * case OP_CREATE_DICT_BLOCK:
+			{
+				if(TRACE)
+					printf("create_dict_block\n");
+				++vm->pc;
+				int length = READ_OPERAND().i;
+				Object* obj = PushDict(vm);
+				if(length > 0)
+				{
+					// stack (before dict) is filled with key-value pairs (backwards, key is higher on stack)
+					for(int i = 0; i < length * 2; i += 2)
+						DictPut(obj->dict, vm->stack[vm->stackSize - i - 2]->string.raw, vm->stack[vm->stackSize - i - 3]);
+					vm->stackSize -= length * 2;
+					vm->stack[vm->stackSize - 1] = obj;
+				}
+			} break;*/
+
+			CASE(OP_CREATE_ARRAY)
+			{
+				if(TRACE)
+					printf("create_array\n");
+				++thread->pc;
+				int length = (int)PopNumber(vm);
+				PushArray(vm, length);
+			} NEXT;
+		
+			CASE(OP_CREATE_ARRAY_BLOCK)
+			{
+				if(TRACE)
+					printf("create_array_block\n");
+				++thread->pc;
+				int length = READ_OPERAND().i;
+				Object* obj = PushArray(vm, length);
+			
+				if(length > 0)
+				{
+					for(int i = 0; i < length; ++i)
+					{
+						Value value = thread->stack[thread->stackSize - 2 - i];
+						WriteBarrier(vm, obj, value);
+						obj->array.members[length - i - 1] = value;
+					}
+					thread->stackSize -= length + 1;
+					thread->stack[thread->stackSize++] = OBJECT_VAL(obj);
+				}
+			} NEXT;
+
+			CASE(OP_EXPAND_ARRAY)
+			{
+				if(TRACE)
+					printf("expand_array\n");
+				++thread->pc;
+				Value val = PopValue(vm);
+				if(GetValueType(val) != OBJ_ARRAY)
+					ErrorExitVM(vm, "Expected array when expanding but received %s\n", ObjectTypeNames[GetValueType(val)]);
+				Object* obj = AS_OBJECT(val);
+				int expand_amount = (int)PopNumber(vm);
+			
+				if(expand_amount < 0 || expand_amount > obj->array.length)
+					ErrorExitVM(vm, "Expansion length out of array bounds\n");
+			
+				for(int i = expand_amount - 1; i >= 0; --i)
+					PushValue(vm, obj->array.members[i]);
+			
+				vm->numExpandedArgs += expand_amount;
+			} NEXT;
+
+			CASE(OP_PUSH_STACK)
+			{
+				if(TRACE)
+					printf("push_stack\n");
+				++thread->pc;
+				thread->indirStack[thread->indirStackSize++] = thread->stackSize;
+			} NEXT;
+		
+			CASE(OP_POP_STACK)
+			{
+				if(TRACE)
+					printf("pop_stack\n");
+				++thread->pc;
+				thread->stackSize = thread->indirStack[--thread->indirStackSize];
+			} NEXT;
+		
+			CASE(OP_LENGTH)
+			{
+				if(TRACE)
+					printf("length\n");
+				++thread->pc;
+				Value val = PopValue(vm);
+				ObjectType type = GetValueType(val);
+				if(type == OBJ_STRING)
+					PushNumber(vm, AS_OBJECT(val)->string.length);
+				else if(type == OBJ_ARRAY)
+					PushNumber(vm, AS_OBJECT(val)->array.length);
+				else if(type == OBJ_MAP)
+					PushNumber(vm, AS_OBJECT(val)->map->numEntries);
+				else if(type == OBJ_DICT && AS_OBJECT(val)->meta)
+				{
+					Object* lenFunc = GetOverload(vm, val, META_LENGTH);
+					if(!lenFunc)
+						ErrorExitVM(vm, "Attempted to get length of dictionary without 'LENGTH' overload\n");					
+
+					CallUnaryOverload(vm, lenFunc, val);
+				}
+				else
+					ErrorExitVM(vm, "Attempted to get length of %s\n", ObjectTypeNames[type]);
+			} NEXT;
+		
+			CASE(OP_ARRAY_PUSH)
+			{
+				if(TRACE)
+					printf("array_push\n");
+				++thread->pc;
+			
+				Object* obj = PopArrayObject(vm);
+				Value value = PopValue(vm);
+
+				if(obj->array.length + 1 >= obj->array.capacity)
+				{
+					while(obj->array.length + 1 >= obj->array.capacity)
+						obj->array.capacity *= 2;
+					obj->array.members = erealloc(obj->array.members, obj->array.capacity * sizeof(Value));
+					SetExternalSize(vm, obj, sizeof(Value) * obj->array.capacity);
+				}
+			
+				WriteBarrier(vm, obj, value);
+				obj->array.members[obj->array.length++] = value;
+			} NEXT;
+		
+			CASE(OP_ARRAY_POP)
+			{
+				if(TRACE)
+					printf("array_pop\n");
+				++thread->pc;
+				Object* obj = PopArrayObject(vm);
+				if(obj->array.length <= 0)
+					ErrorExitVM(vm, "Cannot pop from empty array\n");
+			
+				PushValue(vm, obj->array.members[--obj->array.length]);
+			} NEXT;
+		
+			CASE(OP_ARRAY_CLEAR)
+			{
+				if(TRACE)
+					printf("array_clear\n");
+				++thread->pc;
+				Object* obj = PopArrayObject(vm);
+				obj->array.length = 0;
+			} NEXT;
+
+			CASE(OP_SET_META)
+			{
+				if(TRACE)
+					printf("set_meta\n");
+				++thread->pc;
+
+				Object* obj = PopDict(vm);
+				Object* meta = PopDict(vm);
+
+				WriteBarrier(vm, obj, OBJECT_VAL(meta));
+				obj->meta = meta;
+			} NEXT;
+
+			CASE(OP_GET_META)
+			{
+				if(TRACE)
+					printf("get_meta\n");
+				++thread->pc;
+
+				Object* obj = PopDict(vm);
+				if(obj->meta)
+					PushObject(vm, obj->meta);
+				else
+					PushNull(vm);
+			} NEXT;
+
+			CASE(OP_DICT_SET)
+			{
+				++thread->pc;
+				DictCache* cache = READ_OPERAND().cache;
+				if(TRACE)
+					printf("dict_set");
+
+				Value objVal = PopValue(vm);
+				Object* index = cache->key;
+				Value value = PopValue(vm);
+			
+				if(TRACE)
+				{
+					printf(" '%s' ", index->string.raw);
+					WriteNonVerbose(vm, value);
+					printf("\n");
+				}
+
+				if(GetValueType(objVal) != OBJ_DICT)
+				{
+					SetField(vm, objVal, index, value);
+					break;
+				}
+			
+				Object* obj = AS_OBJECT(objVal);
+				WriteBarrier(vm, obj, value);
+
+				Value* val = GetCachedDictValue(cache, obj->dict);
+				if(val)
+					*val = value;
+				else if(!CallOverloadedOperatorEx(vm, META_SETINDEX, OBJECT_VAL(obj), OBJECT_VAL(index), value))
+					PutDictValue(vm, obj, index, value);
+			} NEXT;
+		
+			CASE(OP_DICT_GET)
+			{
+				++thread->pc;
+				DictCache* cache = READ_OPERAND().cache;
+				if(TRACE)
+					printf("dict_get");
+				
+				Value objVal = PopValue(vm);
+			
+				if(TRACE)
+					printf(" '%s'\n", cache->key->string.raw);
+
+				if(GetValueType(objVal) != OBJ_DICT)
+				{
+					GetField(vm, objVal, cache->key);
+					break;
+				}
+			
+				Object* obj = AS_OBJECT(objVal);
+				Value* val = GetCachedDictValue(cache, obj->dict);
+
+				if(val)
+					PushValue(vm, *val);
+				else if(!CallOverloadedOperatorIf(vm, META_GETINDEX, OBJECT_VAL(obj), OBJECT_VAL(cache->key), RESUME_PUSH_RETVAL))
+					PushNull(vm);
+			} NEXT;
+		
+			CASE(OP_DICT_SET_RAW)
+			{
+				++thread->pc;
+			
+				Object* obj = PopDict(vm);
+				Object* index = PopStringObject(vm);
+				Value value = PopValue(vm);
+			
+				PutDictValue(vm, obj, index, value);
+			} NEXT;
+		
+			CASE(OP_DICT_GET_RAW)
+			{
+				++thread->pc;
+			
+				Object* obj = PopDict(vm);
+				Object* index = PopStringObject(vm);
+			
+				Value* value = DictGet(obj->dict, index);
+				if(value)
+					PushValue(vm, *value);
+				else
+					PushNull(vm);
+			} NEXT;
+
+			CASE(OP_DICT_PAIRS)
+			{
+				if(TRACE)
+					printf("dict_pairs\n");
+				++thread->pc;
+				// NOTE: the dict stays on the stack (below the result) until the pairs
+				// are built so that the allocations below can't collect it
+				Value objVal = PopValue(vm);
+				PushValue(vm, objVal);
+
+				if(GetValueType(objVal) == OBJ_MAP)
+				{
+					PushMapPairs(vm, AS_OBJECT(objVal));
+					thread->stack[thread->stackSize - 2] = thread->stack[thread->stackSize - 1];
+					--thread->stackSize;
+					break;
+				}
+
+				Object* obj = ToDict(vm, objVal);
+				Object* aobj = PushArray(vm, obj->dict->numEntries);
+			
+				int len = 0;
+				for(int i = 0; i < GetDictEntryCount(obj->dict); ++i)
+				{
+					if(!GetDictEntry(obj->dict, i)) continue;
+				
+					Object* pair = PushArray(vm, 2);
+				
+					// NOTE: the entries aren't moved by a collection but a weak dict's
+					// entries may have been removed
+					DictEntry* entry = GetDictEntry(obj->dict, i);
+					if(!entry)
+					{
+						PopValue(vm);
+						continue;
+					}
+				
+					// a collection may have promoted the arrays by now
+					WriteBarrier(vm, pair, OBJECT_VAL(entry->key));
+					WriteBarrier(vm, pair, entry->value);
+					pair->array.members[0] = OBJECT_VAL(entry->key);
+					pair->array.members[1] = entry->value;
+				
+					WriteBarrier(vm, aobj, OBJECT_VAL(pair));
+					aobj->array.members[len++] = PopValue(vm);
+				}
+			
+				// a weak dict can lose entries while the pairs are allocated
+				aobj->array.length = len;
+			
+				thread->stack[thread->stackSize - 2] = thread->stack[thread->stackSize - 1];
+				--thread->stackSize;
+			} NEXT;
+
+			CASE(OP_PUSH_STRUCT)
+			{
+				++thread->pc;
+				int typeIndex = READ_OPERAND().i;
+				if(TRACE)
+					printf("push_struct %s\n", vm->structTypes[typeIndex].name);
+
+				PushStruct(vm, typeIndex);
+			} NEXT;
+
+			CASE(OP_STRUCT_SET)
+			{
+				++thread->pc;
+				int typeIndex = READ_OPERAND().i;
+				int field = READ_OPERAND().i;
+				if(TRACE)
+					printf("struct_set %s.%s\n", vm->structTypes[typeIndex].name, vm->structTypes[typeIndex].keys[field]->string.raw);
+
+				Value objVal = PopValue(vm);
+				Value value = PopValue(vm);
+
+				// the field can be indexed directly if the object is still a struct of
+				// the type it was declared as (otherwise it's looked up like a dict's)
+				if(GetValueType(objVal) == OBJ_STRUCT && AS_OBJECT(objVal)->structure.typeIndex == typeIndex)
+				{
+					Object* obj = AS_OBJECT(objVal);
+					WriteBarrier(vm, obj, value);
+					obj->structure.members[field] = value;
+				}
+				else
+					SetField(vm, objVal, vm->structTypes[typeIndex].keys[field], value);
+			} NEXT;
+
+			CASE(OP_STRUCT_GET)
+			{
+				++thread->pc;
+				int typeIndex = READ_OPERAND().i;
+				int field = READ_OPERAND().i;
+				if(TRACE)
+					printf("struct_get %s.%s\n", vm->structTypes[typeIndex].name, vm->structTypes[typeIndex].keys[field]->string.raw);
+
+				Value objVal = PopValue(vm);
+
+				if(GetValueType(objVal) == OBJ_STRUCT && AS_OBJECT(objVal)->structure.typeIndex == typeIndex)
+					PushValue(vm, AS_OBJECT(objVal)->structure.members[field]);
+				else
+					GetField(vm, objVal, vm->structTypes[typeIndex].keys[field]);
+			} NEXT;
+
+			CASE(OP_ITER_BEGIN)
+			{
+				if(TRACE)
+					printf("iter_begin\n");
+				++thread->pc;
+
+				ObjectType type = GetValueType(thread->stack[thread->stackSize - 1]);
+				if(type != OBJ_DICT && type != OBJ_STRUCT && type != OBJ_MAP && type != OBJ_ARRAY)
+					ErrorExitVM(vm, "Attempted to iterate over a %s\n", ObjectTypeNames[type]);
+			} NEXT;
+
+			CASE(OP_ITER_NEXT)
+			{
+				++thread->pc;
+				int pc = READ_OPERAND().i;
+				if(TRACE)
+					printf("iter_next %i\n", pc);
+
+				Value container = PopValue(vm);
+				double position = PopNumber(vm);
+
+				// the loop starts at -1
+				int index = -1;
+				if(position >= 0)
+				{
+					if((uint32_t)(position / ITER_INDEX_RANGE) != GetIterCompactions(container))
+						ErrorExitVM(vm, "Attempted to continue a loop over a %s which was compacted by adding keys to it after most of its entries were erased\n", ObjectTypeNames[GetValueType(container)]);
+					index = GetIterIndex(position);
+				}
+
+				int count = GetIterCount(vm, container);
+
+				Value key, value;
+				for(++index; index < count; ++index)
+				{
+					if(GetIterEntry(vm, container, index, &key, &value))
+						break;
+				}
+
+				if(index < count)
+					PushNumber(vm, MakeIterPosition(container, index));
+				else
+					thread->pc = pc;
+			} NEXT;
+
+			CASE(OP_ITER_KEY)
+			CASE(OP_ITER_VALUE)
+			{
+				Word op = vm->code[thread->pc++].i;
+				if(TRACE)
+					printf("%s\n", op == OP_ITER_KEY ? "iter_key" : "iter_value");
+
+				Value container = PopValue(vm);
+				int index = GetIterIndex(PopNumber(vm));
+
+				// NOTE: the entry is gone if the collector cleared it out of a weak dict
+				Value key, value;
+				if(!GetIterEntry(vm, container, index, &key, &value))
+					key = value = NULL_VAL;
+
+				PushValue(vm, op == OP_ITER_KEY ? key : value);
+			} NEXT;
+		
+			CASE(OP_CAT)
+			{
+				++thread->pc;
+				if(TRACE)
+					printf("cat\n");
+
+				Object* b = PopTypedObject(vm, OBJ_STRING, "string");
+				Object* a = PopTypedObject(vm, OBJ_STRING, "string");
+
+				PushObject(vm, ConcatStrings(vm, a, b));
+			} NEXT;
+
+			CASE(OP_THREAD_RUN)
+			{
+				++thread->pc;
+				VMThread* newThread = PopThread(vm);
+				if (!newThread) ErrorExitVM(vm, "Attempted to run deleted thread\n");
+
+				if(TRACE)
+					printf("thread_run");
+
+				vm->thread = newThread;
+				CHECK_STOP();
+			} NEXT;
+
+			CASE(OP_THREAD_YIELD)
+			{
+				if(TRACE)
+					printf("thread_yield");
+				++thread->pc;
+				// NOTE: yields value to the parent thread
+				vm->thread->retVal = PopValue(vm);
+				YieldCurrentThread(vm);
+				CHECK_STOP();
+			} NEXT;
+
+			CASE(OP_THREAD_DONE)
+			{
+				if(TRACE)
+					printf("thread_done");
+				++thread->pc;
+
+				VMThread* t = PopThread(vm);
+				PushBool(vm, t->pc < 0);
+			} NEXT;
+
+			CASE(OP_THREAD_DELETE)
+			{
+				++thread->pc;
+				Object* obj = PopThreadObject(vm);
+
+				if(TRACE)
+					printf("thread_delete");
+			
+				free(obj->thread);
+				obj->thread = NULL;
+				SetExternalSize(vm, obj, 0);
+			} NEXT;
+
+			#define BIN_OP_TYPE(op, operator, ty) CASE(OP_##op) { ++thread->pc; if(TRACE) printf("%s\n", #op); Value b = PopValue(vm); Value a = PopValue(vm); { if(!IS_NUMBER(a)) CallOverloadedOperator(vm, META_##op, a, b, RESUME_PUSH_RETVAL); else if(IS_NUMBER(b)) PushNumber(vm, (ty)AS_NUMBER(a) operator (ty)AS_NUMBER(b)); else ErrorExitVM(vm, "Invalid binary operation between %s and %s\n", ObjectTypeNames[GetValueType(a)], ObjectTypeNames[GetValueType(b)]); } } NEXT;
+			#define REL_OP(op, operator) CASE(OP_##op) { ++thread->pc; if(TRACE) printf("%s\n", #op); Value b = PopValue(vm); Value a = PopValue(vm); { if(!IS_NUMBER(a)) CallOverloadedOperator(vm, META_##op, a, b, RESUME_PUSH_RETVAL); else if(IS_NUMBER(b)) PushBool(vm, AS_NUMBER(a) operator AS_NUMBER(b)); else ErrorExitVM(vm, "Invalid binary operation between %s and %s\n", ObjectTypeNames[GetValueType(a)], ObjectTypeNames[GetValueType(b)]); } } NEXT;
+			#define BIN_OP(op, operator) BIN_OP_TYPE(op, operator, double)
+		
+			BIN_OP(ADD, +)
+			BIN_OP(SUB, -)
+			BIN_OP(MUL, *)
+			BIN_OP(DIV, /)
+			BIN_OP_TYPE(MOD, %, long)
+			BIN_OP_TYPE(OR, |, long)
+			BIN_OP_TYPE(AND, &, long)
+			REL_OP(LT, <)
+			REL_OP(LTE, <=)
+			REL_OP(GT, >)
+			REL_OP(GTE, >=)
+			BIN_OP_TYPE(LOGICAL_AND, &&, long)
+			BIN_OP_TYPE(LOGICAL_OR, ||, long)
+			BIN_OP_TYPE(SHL, <<, long)
+			BIN_OP_TYPE(SHR, >>, long)
+
+			// Register forms (see vm.h): the operands are read straight out of the
+			// frame and the constants, and the overloads are called the same way
+			// as for the stack forms (ResumeAfterReturn does the rest for _TO and _GOTOZ)
+			#define REG_OPERAND_R GetLocal(vm, READ_OPERAND().i)
+			#define REG_OPERAND_K READ_OPERAND().value
+			#define REG_OP_ERROR(a, b) ErrorExitVM(vm, "Invalid binary operation between %s and %s\n", ObjectTypeNames[GetValueType(a)], ObjectTypeNames[GetValueType(b)])
+			#define REG_ARITH_FORMS(op, operator, form, operandB) \
+			CASE(OP_##op##_##form) { ++thread->pc; Value a = REG_OPERAND_R; Value b = operandB; if(TRACE) printf("%s_%s\n", #op, #form); if(IS_NUMBER(a) && IS_NUMBER(b)) PushNumber(vm, AS_NUMBER(a) operator AS_NUMBER(b)); else if(!IS_NUMBER(a)) CallOverloadedOperator(vm, META_##op, a, b, RESUME_PUSH_RETVAL); else REG_OP_ERROR(a, b); } NEXT; \
+			CASE(OP_##op##_##form##_TO) { ++thread->pc; Value a = REG_OPERAND_R; Value b = operandB; int dest = READ_OPERAND().i; if(TRACE) printf("%s_%s_to %i\n", #op, #form, dest); if(IS_NUMBER(a) && IS_NUMBER(b)) SetLocal(vm, dest, NUMBER_VAL(AS_NUMBER(a) operator AS_NUMBER(b))); else if(!IS_NUMBER(a)) CallOverloadedOperator(vm, META_##op, a, b, RESUME_SETLOCAL); else REG_OP_ERROR(a, b); } NEXT;
+			#define REG_REL_FORMS(op, operator, form, operandB) \
+			CASE(OP_##op##_##form) { ++thread->pc; Value a = REG_OPERAND_R; Value b = operandB; if(TRACE) printf("%s_%s\n", #op, #form); if(IS_NUMBER(a) && IS_NUMBER(b)) PushBool(vm, AS_NUMBER(a) operator AS_NUMBER(b)); else if(!IS_NUMBER(a)) CallOverloadedOperator(vm, META_##op, a, b, RESUME_PUSH_RETVAL); else REG_OP_ERROR(a, b); } NEXT; \
+			CASE(OP_##op##_##form##_GOTOZ) { ++thread->pc; Value a = REG_OPERAND_R; Value b = operandB; int pc = READ_OPERAND().i; if(TRACE) printf("%s_%s_gotoz %i\n", #op, #form, pc); if(IS_NUMBER(a) && IS_NUMBER(b)) { if(!(AS_NUMBER(a) operator AS_NUMBER(b))) thread->pc = pc; } else if(!IS_NUMBER(a)) CallOverloadedOperator(vm, META_##op, a, b, RESUME_GOTOZ); else REG_OP_ERROR(a, b); } NEXT;
+			#define REG_ARITH(op, operator) REG_ARITH_FORMS(op, operator, RR, REG_OPERAND_R) REG_ARITH_FORMS(op, operator, RK, REG_OPERAND_K)
+			#define REG_REL(op, operator) REG_REL_FORMS(op, operator, RR, REG_OPERAND_R) REG_REL_FORMS(op, operator, RK, REG_OPERAND_K)
+
+			REG_ARITH(ADD, +)
+			REG_ARITH(SUB, -)
+			REG_ARITH(MUL, *)
+			REG_ARITH(DIV, /)
+			REG_REL(LT, <)
+			REG_REL(LTE, <=)
+			REG_REL(GT, >)
+			REG_REL(GTE, >=)
+
+			CASE(OP_MOVE_R)
+			{
+				++thread->pc;
+				int src = READ_OPERAND().i;
+				int dest = READ_OPERAND().i;
+				if(TRACE)
+					printf("move_r %i %i\n", src, dest);
+				SetLocal(vm, dest, GetLocal(vm, src));
+			} NEXT;
+
+			CASE(OP_MOVE_K)
+			{
+				++thread->pc;
+				Value value = READ_OPERAND().value;
+				int dest = READ_OPERAND().i;
+				if(TRACE)
+					printf("move_k %i\n", dest);
+				SetLocal(vm, dest, value);
+			} NEXT;
+
+			CASE(OP_GETINDEX_RR)
+			{
+				++thread->pc;
+				Value objVal = REG_OPERAND_R;
+				Value indexVal = REG_OPERAND_R;
+				if(TRACE)
+					printf("getindex_rr\n");
+
+				PushIndex(vm, objVal, indexVal);
+			} NEXT;
+
+			CASE(OP_EQU)
+			{
+				++thread->pc;
+				Value o2 = PopValue(vm);
+				Value o1 = PopValue(vm);
+				ObjectType t1 = GetValueType(o1);
+				ObjectType t2 = GetValueType(o2);
+				if(TRACE)
+					printf("equ %s %s\n", ObjectTypeNames[t1], ObjectTypeNames[t2]);
+			
+				if(t1 != t2 && t1 != OBJ_DICT) PushBool(vm, 0);
+				else
+				{
+					if(t1 == OBJ_STRING) { PushBool(vm, StringsEqual(AS_OBJECT(o1), AS_OBJECT(o2))); }
+					else if(t1 == OBJ_NUMBER) { PushBool(vm, AS_NUMBER(o1) == AS_NUMBER(o2)); }
+					else if(t1 == OBJ_DICT && CallOverloadedOperatorIf(vm, META_EQUALS, o1, o2, RESUME_PUSH_RETVAL)) break;
+					else PushBool(vm, o1 == o2);
+				}
+			} NEXT;
+		
+			CASE(OP_NEQU)
+			{
+				++thread->pc;
+				Value o2 = PopValue(vm);
+				Value o1 = PopValue(vm);
+				ObjectType t1 = GetValueType(o1);
+				ObjectType t2 = GetValueType(o2);
+			
+				if(TRACE)
+					printf("nequ %s %s\n", ObjectTypeNames[t1], ObjectTypeNames[t2]);
+				
+				if(t1 != t2 && t1 != OBJ_DICT) PushBool(vm, 1);
+				else
+				{
+					if(t1 == OBJ_STRING) { PushBool(vm, !StringsEqual(AS_OBJECT(o1), AS_OBJECT(o2))); }
+					else if(t1 == OBJ_NUMBER) { PushBool(vm, AS_NUMBER(o1) != AS_NUMBER(o2)); }
+					else if(t1 == OBJ_DICT && CallOverloadedOperatorIf(vm, META_EQUALS, o1, o2, RESUME_PUSH_NOT_RETVAL)) break;
+					else PushBool(vm, o1 != o2);
+				}
+			} NEXT;
+		
+			CASE(OP_NEG)
+			{
+				if(TRACE)
+					printf("neg\n");
+			
+				++thread->pc;
+				Value val = PopValue(vm);
+
+				if (IS_NUMBER(val))
+					PushNumber(vm, -AS_NUMBER(val));
+				else if (GetValueType(val) == OBJ_DICT)
+				{
+					Object* negFunc = GetOverload(vm, val, META_NEG);
+					if (negFunc)
+					{
+						CallUnaryOverload(vm, negFunc, val);
+					}
+					else
+						ErrorExitVM(vm, "Invalid negation of dictionary\n");
+				}
+				else
+					ErrorExitVM(vm, "Attempted to negate object of type %s\n", ObjectTypeNames[GetValueType(val)]);
+			} NEXT;
+		
+			CASE(OP_LOGICAL_NOT)
+			{	
+				++thread->pc;
+				Value val = PopValue(vm);
+				if (IS_BOOL(val))
+				{
+					if(TRACE)
+						printf("NOT %s\n", AS_BOOL(val) ? "true" : "false");
+					PushBool(vm, !AS_BOOL(val));
+				}
+				else if (GetValueType(val) == OBJ_DICT)
+				{
+					if(TRACE)
+						printf("NOT dict\n");
+
+					Object* notFunc = GetOverload(vm, val, META_NOT);
+					if (notFunc)
+					{
+						CallUnaryOverload(vm, notFunc, val);
+					}
+					else
+						ErrorExitVM(vm, "Invalid logical not-ing of dictionary\n");
+				}
+				else
+					ErrorExitVM(vm, "Attempted to use '!' operator on value of type %s\n", ObjectTypeNames[GetValueType(val)]);
+			} NEXT;
+		
+			CASE(OP_SETINDEX)
+			{
+				++thread->pc;
+
+				Value objVal = PopValue(vm);
+				Value indexVal = PopValue(vm);
+				Value value = PopValue(vm);
+				if(TRACE)
+					printf("setindex\n");
+			
+				ObjectType type = GetValueType(objVal);
+			
+				if(type == OBJ_ARRAY)
+				{
+					Object* obj = AS_OBJECT(objVal);
+					if(!IS_NUMBER(indexVal))
+						ErrorExitVM(vm, "Attempted to index array with a %s (expected number)\n", ObjectTypeNames[GetValueType(indexVal)]);
+				
+					int index = (int)AS_NUMBER(indexVal);
+				
+					if(index >= 0 && index < obj->array.length)
+					{
+						WriteBarrier(vm, obj, value);
+						obj->array.members[index] = value;
+					}
+					else
+						ErrorExitVM(vm, "Invalid array index %i\n", index);
+				}
+				else if(type == OBJ_STRING)
+					ErrorExitVM(vm, "Attempted to assign to an index of the string '%s' (strings are immutable)\n", GetStringChars(AS_OBJECT(objVal)));
+				else if(type == OBJ_MAP)
+				{
+					Object* obj = AS_OBJECT(objVal);
+					if(!IsValidMapKey(indexVal))
+						ErrorExitVM(vm, "Attempted to use %s as a map key\n", IS_NUMBER(indexVal) ? "NaN" : "null");
+
+					WriteBarrier(vm, obj, indexVal);
+					WriteBarrier(vm, obj, value);
+
+					MapPut(obj->map, indexVal, value);
+					SetExternalSize(vm, obj, sizeof(Map) + MapMemory(obj->map));
+				}
+				else if(type == OBJ_STRUCT && GetValueType(indexVal) == OBJ_STRING)
+					SetField(vm, objVal, AS_OBJECT(indexVal), value);
+				else if(type == OBJ_DICT || type == OBJ_STRUCT)
+				{
+					Object* obj = ToDict(vm, objVal);
+					WriteBarrier(vm, obj, value);
+
+					Value* val = GetValueType(indexVal) == OBJ_STRING ? DictGet(obj->dict, AS_OBJECT(indexVal)) : NULL;
+					if(val)
+						*val = value;
+					else if(CallOverloadedOperatorEx(vm, META_SETINDEX, objVal, indexVal, value))
+						break;
+					else if(GetValueType(indexVal) == OBJ_STRING)
+						PutDictValue(vm, obj, AS_OBJECT(indexVal), value);
+					else
+						ErrorExitVM(vm, "Attempted to index dictionary with a %s (expected string)\n", ObjectTypeNames[GetValueType(indexVal)]);
+				}
+				else
+					ErrorExitVM(vm, "Attempted to index a %s\n", ObjectTypeNames[type]);
+			} NEXT;
+
+			CASE(OP_GETINDEX)
+			{
+				++thread->pc;
+
+				Value objVal = PopValue(vm);
+				Value indexVal = PopValue(vm);
+				if(TRACE)
+					printf("getindex\n");
+
+				PushIndex(vm, objVal, indexVal);
+			} NEXT;
+
+			CASE(OP_SET)
+			{
+				if(vm->numGlobals == 0)
+					ErrorExitVM(vm, "Invalid access to global variables\n");
+
+				++thread->pc;
+				Value* global = READ_OPERAND().global;
+			
+				Value top = PopValue(vm);
+				*global = top;
+			
+				if(TRACE)
+				{
+					printf("set %s to ", vm->globalNames[vm->numGlobals - (int)(global - vm->globals) - 1]);
+					WriteValue(vm, top);
+					printf("\n");
+				}
+			} NEXT;
+		
+			CASE(OP_GET)
+			{
+				if(vm->numGlobals == 0)
+					ErrorExitVM(vm, "Invalid access to global variables\n");
+
+				++thread->pc;
+				Value* global = READ_OPERAND().global;
+				PushValue(vm, *global);
+				
+				if(TRACE)
+					printf("get %s\n", vm->globalNames[vm->numGlobals - (int)(global - vm->globals) - 1]);
+			} NEXT;
+		
+			CASE(OP_WRITE)
+			{
+				if(TRACE)
+					printf("write\n");
+				Value top = PopValue(vm);
+				WriteValue(vm, top);
+				printf("\n");
+				++thread->pc;
+			} NEXT;
+		
+			CASE(OP_READ)
+			{
+				if(TRACE)
+					printf("read\n");
+				char* string = ReadStringFromStdin();
+				PushString(vm, string);
+				free(string);
+				++thread->pc;
+			} NEXT;
+		
+			CASE(OP_GOTO)
+			{
+				++thread->pc;
+				int pc = READ_OPERAND().i;
+				thread->pc = pc;
+		
+				if(TRACE)
+					printf("goto %i\n", thread->pc);
+			} NEXT;
+		
+			CASE(OP_GOTOZ)
+			{
+				++thread->pc;
+				int pc = READ_OPERAND().i;
+			
+				Value top = PopValue(vm);
+
+				if(IS_NULL(top) || top == FALSE_VAL)
+				{
+					thread->pc = pc;
+					if(TRACE)
+						printf("gotoz %i\n", thread->pc);
+				}
+			} NEXT;
+		
+			CASE(OP_CALL)
+			{
+				Word nargs = vm->code[++thread->pc].i;
+				++thread->pc;
+				int pc = READ_OPERAND().i;
+				int index = READ_OPERAND().i;
+
+				if(TRACE)
+					printf("call %s\n", vm->functionNames[index]);
+				vm->lastFunctionName = vm->functionNames[index];
+				vm->lastFunctionIndex = index;
+			
+				if(!vm->functionHasEllipsis[index])
+				{
+					if(vm->functionNumArgs[index] != nargs + thread->numExpandedArgs)
+						ErrorExitVM(vm, "Invalid number of arguments (%i) to function '%s' which expects %i arguments\n", nargs + thread->numExpandedArgs, vm->functionNames[index], vm->functionNumArgs[index]);
+				}
+				else
+				{
+					if(vm->functionNumArgs[index] > nargs + thread->numExpandedArgs)
+						ErrorExitVM(vm, "Invalid number of arguments (%i) to function '%s' which expects at least %i arguments\n", nargs + thread->numExpandedArgs, vm->functionNames[index], vm->functionNumArgs[index]);
+				}
+			
+				PushIndir(vm, nargs + thread->numExpandedArgs, RESUME_NONE);
+
+				thread->pc = pc;
+			} NEXT;
+		
+			CASE(OP_CALLP)
+			{
+				int id;
+				Word hasEllipsis, isExtern, numArgs;
+				Word nargs = vm->code[++thread->pc].i;
+			
+				++thread->pc;
+			
+				Value val = PopValue(vm);
+				ObjectType type = GetValueType(val);
+				Object* obj = type >= OBJ_STRING ? AS_OBJECT(val) : NULL;
+				Object* env = NULL;
+			
+				if(type == OBJ_FUNC)
+				{
+					id = obj->func.index;
+					isExtern = obj->func.isExtern;
+					if(!isExtern)
+					{
+						numArgs = vm->functionNumArgs[id];
+						hasEllipsis = vm->functionHasEllipsis[id];	
+					}
+				
+					env = obj->func.env;
+				}
+				else if(type == OBJ_DICT)
+				{
+					Object* callFn = GetOverload(vm, val, META_CALL);
+					if(callFn)
+					{
+						if(callFn->func.env)
+							ErrorExitVM(vm, "Dictionary CALL overload has enclosing environment (i.e closure); This is not a valid overload\n");
+					
+						id = callFn->func.index;
+						isExtern = callFn->func.isExtern;
+						numArgs = vm->functionNumArgs[id];
+						hasEllipsis = vm->functionHasEllipsis[id];
+						env = obj;
+					}
+					else
+						ErrorExitVM(vm, "Attempted to call pure dict (no CALL meta overload found)\n");
+				}
+				else
+					ErrorExitVM(vm, "Expected func or dict but received '%s'\n", ObjectTypeNames[type]);
+
+				if(TRACE)
+					printf("callp %s%s\n", isExtern ? "extern " : "", isExtern ? vm->externNames[id] : vm->functionNames[id]);
+				
+				vm->lastFunctionName = isExtern ? vm->externNames[id] : vm->functionNames[id];
+				vm->lastFunctionIndex = id;
+			
+				nargs += vm->numExpandedArgs;
+				if(env)
+					nargs += 1;
+			
+				if(isExtern)
+				{
+					vm->inExternBody = MINT_TRUE;
+					vm->externs[id](vm);
+					vm->inExternBody = MINT_FALSE;
+					CollectGarbageIfNeeded(vm);
+					CHECK_STOP();
+				}
+				else
+				{
+					if(!hasEllipsis)
+					{
+						if(nargs != numArgs)
+							ErrorExitVM(vm, "Function '%s' expected %i args but recieved %i args\n", vm->functionNames[id], numArgs, nargs);
+					}
+					else
+					{
+						if(nargs < numArgs)
+							ErrorExitVM(vm, "Function '%s' expected at least %i args but recieved %i args\n", vm->functionNames[id], numArgs, nargs);
+					}
+				
+					if(env)
+						PushObject(vm, env);
+					PushIndir(vm, nargs, RESUME_NONE);
+					thread->pc = vm->functionPcs[id];
+				}
+			} NEXT;
+		
+			CASE(OP_RETURN)
+			{
+				if(TRACE)
+					printf("ret (previous fp: %i)\n", thread->fp);
+				thread->retVal = NULL_VAL;
+				ResumeAfterReturn(vm, PopIndir(vm));
+				CHECK_STOP();
+			} NEXT;
+		
+			CASE(OP_RETURN_VALUE)
+			{
+				if(TRACE)
+					printf("retval (previous fp: %i)\n", thread->fp);
+				thread->retVal = PopValue(vm);
+				ResumeAfterReturn(vm, PopIndir(vm));
+				CHECK_STOP();
+			} NEXT;
+		
+			CASE(OP_CALLF)
+			{
+				++thread->pc;
+				int index = READ_OPERAND().i;
+				if(TRACE)
+					printf("callf %s\n", vm->externNames[index]);
+				vm->lastFunctionIndex = index;
+			
+				vm->inExternBody = MINT_TRUE;
+				vm->externs[index](vm);
+				vm->inExternBody = MINT_FALSE;
+				CollectGarbageIfNeeded(vm);
+				CHECK_STOP();
+			} NEXT;
+
+			CASE(OP_GETLOCAL)
+			{
+				++thread->pc;
+				int index = READ_OPERAND().i;
+				PushValue(vm, GetLocal(vm, index));
+				if(TRACE)
+					printf("getlocal %i (fp: %i, stack size: %i)\n", index, thread->fp, thread->stackSize);
+			} NEXT;
+		
+			CASE(OP_SETLOCAL)
+			{
+				++thread->pc;
+				int index = READ_OPERAND().i;
+				if(TRACE)
+					printf("setlocal %i\n", index);
+				SetLocal(vm, index, PopValue(vm));
+			} NEXT;
+		
+			CASE(OP_HALT)
+			{
+				if(TRACE)
+					printf("halt\n");
+				vm->thread = NULL;
+				CHECK_STOP();
+			} NEXT;
+		
+			CASE(OP_SETVMDEBUG)
+			{
+				if(TRACE)
+					printf("setvmdebug\n");
+				char debug = vm->code[++thread->pc].i;
+				++thread->pc;
+				vm->debug = debug;
+			
+				// NOTE: the other loop takes over (see Execute)
+				if(vm->debug != INTERP_TRACE)
+					return;
+			} NEXT;
+		
+			CASE(OP_GETARGS)
+			{
+				++thread->pc;
+				int startArgIndex = -READ_OPERAND().i - 1;
+			
+				if(TRACE)
+					printf("getargs %i\n", -startArgIndex + 1);
+			
+				Word nargs = thread->indirStack[thread->indirStackSize - FRAME_SIZE]; // number of arguments passed to the function
+			
+				if(nargs == 0) PushArray(vm, 0);
+				else
+				{
+					Object* obj = PushArray(vm, nargs - startArgIndex);
+				
+					for(int i = startArgIndex; i < nargs; ++i)
+					{
+						Value value = GetLocal(vm, -i - 1);
+						WriteBarrier(vm, obj, value);
+						obj->array.members[i - startArgIndex] = value;
+					}
+				}
+			} NEXT;
+		
+			CASE(OP_FILE)
+			{
+				++thread->pc;
+				Object* file = READ_OPERAND().obj;
+				if(TRACE)
+					printf("\r\n");
+				thread->curFile = file->string.raw;
+			} NEXT;
+		
+			CASE(OP_LINE)
+			{
+				++thread->pc;
+				thread->curLine = READ_OPERAND().i;
+				if(TRACE)
+					printf("\r\n");
+			} NEXT;
+
+			default:
+#ifdef INTERP_COMPUTED_GOTO
+			L_INVALID:
+#endif
+				ErrorExitVM(vm, "Invalid instruction %i\n", vm->code[thread->pc].i);
+				break;
+		}
+	}
+}
+
+#undef BIN_OP
+#undef REG_REL
+#undef REG_ARITH
+#undef REG_REL_FORMS
+#undef REG_ARITH_FORMS
+#undef REG_OP_ERROR
+#undef REG_OPERAND_K
+#undef REG_OPERAND_R
+#undef BIN_OP_TYPE
+#undef REL_OP
+#undef CHECK_STOP
+#undef READ_OPERAND
+#undef NEXT
+#undef CASE
+#undef TRACE
+#undef INTERP_COMPUTED_GOTO
+#undef INTERP_TRACE
+#undef INTERP_NAME
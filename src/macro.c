@@ -127,6 +127,18 @@ static void RecordMacro(Expr** pExp)
 			}
 		} break;
 		
+		case EXP_FOR_IN:
+		{
+			RecordMacro(&exp->forinx.iterable);
+			
+			Expr** node = &exp->forinx.bodyHead;
+			while(*node)
+			{
+				RecordMacro(node);
+				node = &(*node)->next;
+			}
+		} break;
+		
 		case EXP_DICT_LITERAL:
 		{
 			Expr** node = &exp->dictx.pairsHead;
@@ -176,16 +188,16 @@ static void Macro_MultiExpr(VM* vm)
 	Expr* node = NULL;
 	for(int i = 0; i < obj->array.length; ++i)
 	{
-		if(obj->array.members[i]->type != OBJ_NATIVE)
+		if(GetValueType(obj->array.members[i]) != OBJ_NATIVE)
 			ErrorExitVM(vm, "Invalid expression in array argument to 'macro_multi'\n");
 		if(!node)
 		{
-			exp->multiHead = obj->array.members[i]->native.value;
+			exp->multiHead = AS_OBJECT(obj->array.members[i])->native.value;
 			node = exp->multiHead;
 		}
 		else
 		{
-			node->next = obj->array.members[i]->native.value;
+			node->next = AS_OBJECT(obj->array.members[i])->native.value;
 			node = node->next;
 		}
 	}
@@ -361,7 +373,7 @@ void ExecuteMacros(Expr** exp)
 			if(!decl)
 				ErrorExitE(nodeExp, "Attempted to call non-existent function '%s' at compile time\n", nodeExp->callx.func->varx.name); 
 			
-			vm->thread->pc = nodeExp->pc;
+			vm->thread->pc = GetDecodedPc(vm, nodeExp->pc);
 			SetExprContext(vm, nodeExp);
 			
 			printf("ctx line: %i\n", Context.line);
@@ -374,10 +386,10 @@ void ExecuteMacros(Expr** exp)
 			
 			if(decl->hasReturn > 0)
 			{
-				if(!vm->thread->retVal || vm->thread->retVal->type != OBJ_NATIVE)
+				if(GetValueType(vm->thread->retVal) != OBJ_NATIVE)
 					ErrorExitE(nodeExp, "Compile-time function '%s' has invalid resulting value\n", nodeExp->callx.func->varx.name);
 				
-				Expr* exp = vm->thread->retVal->native.value;
+				Expr* exp = AS_OBJECT(vm->thread->retVal)->native.value;
 				
 				exp->next = NextExpr;
 				*pNodeExp = exp;
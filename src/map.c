@@ -0,0 +1,262 @@
+#include "map.h"
+#include "vm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void* emalloc(size_t size)
+{
+	void* mem = malloc(size);
+	if(!mem) { fprintf(stderr, "Virtual machine ran out of memory!\n"); exit(1); }
+	return mem;
+}
+
+// -0 and 0 are the same key
+static inline Value NormalizeKey(Value key)
+{
+	return IS_NUMBER(key) && AS_NUMBER(key) == 0 ? NUMBER_VAL(0) : key;
+}
+
+static inline uint32_t HashKey(Value key)
+{
+	if(IS_OBJECT(key) && AS_OBJECT(key)->type == OBJ_STRING)
+	{
+		// NOTE: the hash of a rope is only known once it's flattened
+		GetStringChars(AS_OBJECT(key));
+		return AS_OBJECT(key)->string.hash;
+	}
+
+	// everything else is hashed by its bits (the finalizer of MurmurHash3)
+	uint64_t x = key;
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return (uint32_t)x;
+}
+
+static inline char KeysEqual(Value a, Value b)
+{
+	if(a == b) return MINT_TRUE;
+
+	return IS_OBJECT(a) && IS_OBJECT(b) && AS_OBJECT(a)->type == OBJ_STRING && AS_OBJECT(b)->type == OBJ_STRING &&
+		StringsEqual(AS_OBJECT(a), AS_OBJECT(b));
+}
+
+static void* erealloc(void* mem, size_t size)
+{
+	void* newMem = realloc(mem, size);
+	if(!newMem) { fprintf(stderr, "Virtual machine ran out of memory!\n"); exit(1); }
+	return newMem;
+}
+
+static void AllocSlots(Map* map, int capacity)
+{
+	map->slots = emalloc(sizeof(int32_t) * capacity);
+	map->capacity = capacity;
+
+	for(int i = 0; i < capacity; ++i)
+		map->slots[i] = MAP_EMPTY_SLOT;
+}
+
+// NOTE: the table is only allocated once something is put into the map
+void InitMap(Map* map)
+{
+	map->entries = NULL;
+	map->length = 0;
+	map->entriesCapacity = 0;
+
+	map->slots = NULL;
+	map->capacity = 0;
+
+	map->used = 0;
+	map->numEntries = 0;
+
+	map->compactions = 0;
+
+	map->weakMode = 0;
+}
+
+// returns the index of the slot holding key (or -1 if there is none)
+static int FindSlot(const Map* map, Value key, uint32_t hash)
+{
+	if(map->capacity == 0)
+		return -1;
+
+	int mask = map->capacity - 1;
+	for(int i = (int)hash & mask;; i = (i + 1) & mask)
+	{
+		int32_t entry = map->slots[i];
+		if(entry == MAP_EMPTY_SLOT)
+			return -1;
+		if(entry >= 0 && KeysEqual(map->entries[entry].key, key))
+			return i;
+	}
+}
+
+// points a free slot at 'entry' (whose key has the given hash)
+static void InsertSlot(Map* map, int32_t entry, uint32_t hash)
+{
+	int mask = map->capacity - 1;
+	int i = (int)hash & mask;
+
+	while(map->slots[i] >= 0)
+		i = (i + 1) & mask;
+
+	if(map->slots[i] == MAP_EMPTY_SLOT)
+		++map->used;
+
+	map->slots[i] = entry;
+}
+
+// Points a new table at the entries (which is only bigger if the deleted
+// slots aren't what filled up the old one)
+// NOTE: the entries themselves don't move
+static void Rehash(Map* map)
+{
+	int newCapacity = map->capacity;
+	while((map->numEntries + 1) * 2 > newCapacity)
+		newCapacity *= 2;
+
+	free(map->slots);
+	AllocSlots(map, newCapacity);
+	map->used = 0;
+
+	for(int i = 0; i < map->length; ++i)
+	{
+		if(map->entries[i].key != MAP_EMPTY_KEY)
+			InsertSlot(map, i, HashKey(map->entries[i].key));
+	}
+}
+
+// Squeezes the holes out of the entries (keeping them in order) and points
+// the table at where they ended up
+static void CompactEntries(Map* map)
+{
+	int length = 0;
+	for(int i = 0; i < map->length; ++i)
+	{
+		if(map->entries[i].key != MAP_EMPTY_KEY)
+			map->entries[length++] = map->entries[i];
+	}
+	map->length = length;
+	++map->compactions;
+
+	// this gets rid of the deleted slots as well
+	for(int i = 0; i < map->capacity; ++i)
+		map->slots[i] = MAP_EMPTY_SLOT;
+	map->used = 0;
+
+	for(int i = 0; i < length; ++i)
+		InsertSlot(map, i, HashKey(map->entries[i].key));
+}
+
+// returns the index of the new entry
+static int32_t AppendEntry(Map* map, Value key, Value value)
+{
+	if(map->length == map->entriesCapacity)
+	{
+		if(map->length > 0 && map->numEntries * 2 <= map->length)
+			CompactEntries(map);
+		else
+		{
+			map->entriesCapacity = map->entriesCapacity > 0 ? map->entriesCapacity * 2 : INIT_MAP_CAPACITY;
+			map->entries = erealloc(map->entries, sizeof(MapEntry) * map->entriesCapacity);
+		}
+	}
+
+	map->entries[map->length].key = key;
+	map->entries[map->length].value = value;
+
+	return map->length++;
+}
+
+void MapPut(Map* map, Value key, Value value)
+{
+	key = NormalizeKey(key);
+	uint32_t hash = HashKey(key);
+
+	if(map->capacity == 0)
+		AllocSlots(map, INIT_MAP_CAPACITY);
+
+	int index = FindSlot(map, key, hash);
+	if(index >= 0)
+	{
+		map->entries[map->slots[index]].value = value;
+		return;
+	}
+
+	// NOTE: the deleted slots count towards the load factor (3/4) since they don't end probing
+	if((map->used + 1) * 4 > map->capacity * 3)
+		Rehash(map);
+
+	InsertSlot(map, AppendEntry(map, key, value), hash);
+	++map->numEntries;
+}
+
+static void RemoveSlot(Map* map, int index)
+{
+	map->entries[map->slots[index]].key = MAP_EMPTY_KEY;
+	map->slots[index] = MAP_DELETED_SLOT;
+	--map->numEntries;
+
+	// once there's nothing left the deleted slots don't have to be kept around
+	if(map->numEntries == 0)
+	{
+		for(int i = 0; i < map->capacity; ++i)
+			map->slots[i] = MAP_EMPTY_SLOT;
+		map->used = 0;
+	}
+}
+
+char MapRemove(Map* map, Value key, Value* removed)
+{
+	key = NormalizeKey(key);
+
+	int index = FindSlot(map, key, HashKey(key));
+	if(index < 0)
+		return MINT_FALSE;
+
+	if(removed)
+		*removed = map->entries[map->slots[index]].value;
+	RemoveSlot(map, index);
+
+	return MINT_TRUE;
+}
+
+int MapRemoveWhere(Map* map, char (*shouldRemove)(const MapEntry* entry, void* data), void* data)
+{
+	int numRemoved = 0;
+
+	for(int i = 0; i < map->capacity; ++i)
+	{
+		if(map->slots[i] >= 0 && shouldRemove(&map->entries[map->slots[i]], data))
+		{
+			RemoveSlot(map, i);
+			++numRemoved;
+		}
+	}
+
+	return numRemoved;
+}
+
+Value* MapGet(Map* map, Value key)
+{
+	key = NormalizeKey(key);
+
+	int index = FindSlot(map, key, HashKey(key));
+	return index >= 0 ? &map->entries[map->slots[index]].value : NULL;
+}
+
+size_t MapMemory(const Map* map)
+{
+	return sizeof(MapEntry) * map->entriesCapacity + sizeof(int32_t) * map->capacity;
+}
+
+void FreeMap(Map* map)
+{
+	free(map->entries);
+	free(map->slots);
+	InitMap(map);
+}
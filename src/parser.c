@@ -1,11 +1,50 @@
 #include "lang.h"
 
+// a token which was read ahead and put back (see PutBackToken)
+static int PendingTok = 0;
+static char* PendingLexeme = NULL;
+
+static void SetLexeme(const char* lexeme)
+{
+	ClearLexeme();
+	while(*lexeme)
+		AppendLexChar(*lexeme++);
+	AppendLexChar('\0');
+}
+
 int GetNextToken(FILE* in)
 {
+	if(PendingTok)
+	{
+		CurTok = PendingTok;
+		SetLexeme(PendingLexeme);
+
+		PendingTok = 0;
+		free(PendingLexeme);
+		PendingLexeme = NULL;
+
+		return CurTok;
+	}
+
 	CurTok = GetToken(in);
 	return CurTok;
 }
 
+// makes (tok, lexeme) the current token again; the current one will be the next one read
+static void PutBackToken(int tok, const char* lexeme)
+{
+	assert(!PendingTok);
+
+	PendingTok = CurTok;
+	const char* pending = LexemeLength > 0 ? Lexeme : "";
+	PendingLexeme = malloc(strlen(pending) + 1);
+	assert(PendingLexeme);
+	strcpy(PendingLexeme, pending);
+
+	CurTok = tok;
+	SetLexeme(lexeme);
+}
+
 const char* ExprNames[] = {
 	"EXP_BOOL",
 	"EXP_NUMBER",
@@ -34,7 +73,8 @@ const char* ExprNames[] = {
 	"EXP_LAMBDA",
 	"EXP_TYPE_DECL",
 	"EXP_TYPE_CAST",
-	"EXP_MULTI"
+	"EXP_MULTI",
+	"EXP_FOR_IN"
 };
 
 Expr* CreateExpr(ExprType type)
@@ -56,6 +96,77 @@ Expr* CreateExpr(ExprType type)
 
 Expr* ParseExpr(FILE* in);
 
+static Expr* ParseBody(FILE* in)
+{
+	if(CurTok != '{')
+		ErrorExit("Expected '{' to start the body\n");
+	GetNextToken(in);
+
+	Expr* exprHead = NULL;
+	Expr* exprCurrent = NULL;
+
+	while(CurTok != '}')
+	{
+		if(!exprHead)
+		{
+			exprHead = ParseExpr(in);
+			exprCurrent = exprHead;
+		}
+		else
+		{
+			exprCurrent->next = ParseExpr(in);
+			exprCurrent = exprCurrent->next;
+		}
+	}
+
+	GetNextToken(in);
+	return exprHead;
+}
+
+// NOTE: the 'for' and the key name have been read already
+static Expr* ParseForIn(FILE* in, const char* keyName)
+{
+	Expr* exp = CreateExpr(EXP_FOR_IN);
+
+	char valueName[MAX_ID_NAME_LENGTH];
+	valueName[0] = '\0';
+
+	if(CurTok == ',')
+	{
+		GetNextToken(in);
+		if(CurTok != TOK_IDENT)
+			ErrorExit("Expected identifier after ',' in for loop\n");
+		strcpy(valueName, Lexeme);
+		GetNextToken(in);
+	}
+
+	if(CurTok != TOK_IDENT || strcmp(Lexeme, "in") != 0)
+		ErrorExit("Expected 'in' after for loop variables\n");
+	GetNextToken(in);
+
+	static int iterIndex = 0;
+	static char buf[256];
+
+	sprintf(buf, "__it%i__", iterIndex);
+	exp->forinx.iterDecl = DeclareVariable(buf);
+	sprintf(buf, "__iti%i__", iterIndex);
+	exp->forinx.indexDecl = DeclareVariable(buf);
+	sprintf(buf, "__itc%i__", iterIndex++);
+	exp->forinx.comDecl = DeclareVariable(buf);
+
+	exp->forinx.iterable = ParseExpr(in);
+
+	PushScope();
+
+	exp->forinx.keyDecl = DeclareVariable(keyName);
+	exp->forinx.valueDecl = valueName[0] ? DeclareVariable(valueName) : NULL;
+	exp->forinx.bodyHead = ParseBody(in);
+
+	PopScope();
+
+	return exp;
+}
+
 Expr* ParseIf(FILE* in)
 {
 	GetNextToken(in);
@@ -481,8 +592,22 @@ Expr* ParseFactor(FILE* in)
 		
 		case TOK_FOR:
 		{
-			Expr* exp = CreateExpr(EXP_FOR);
 			GetNextToken(in);
+
+			// for key[, value] in iterable { ... }
+			if(CurTok == TOK_IDENT)
+			{
+				char name[MAX_ID_NAME_LENGTH];
+				strcpy(name, Lexeme);
+
+				GetNextToken(in);
+				if(CurTok == ',' || (CurTok == TOK_IDENT && strcmp(Lexeme, "in") == 0))
+					return ParseForIn(in, name);
+
+				PutBackToken(TOK_IDENT, name);
+			}
+
+			Expr* exp = CreateExpr(EXP_FOR);
 			
 			static int comIndex = 0;
 			static char buf[256];
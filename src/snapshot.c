@@ -0,0 +1,317 @@
+// snapshot.c -- writes the objects reachable from the roots of a vm to a file (see snapshot.h)
+#include "vm.h"
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void* ecalloc(size_t size, size_t nmemb)
+{
+	void* mem = calloc(size, nmemb);
+	if(!mem) { fprintf(stderr, "Virtual machine ran out of memory!\n"); exit(1); }
+	return mem;
+}
+
+static void* erealloc(void* mem, size_t newSize)
+{
+	void* newMem = realloc(mem, newSize);
+	if(!newMem) { fprintf(stderr, "Virtual machine ran out of memory!\n"); exit(1); }
+	return newMem;
+}
+
+typedef struct
+{
+	VM* vm;
+	FILE* out;
+
+	// every object found so far in the order it was found (an object's id is
+	// its index); the ones past numWritten still have to be written
+	Object** objects;
+	int numObjects;
+	int objectsCapacity;
+	int numWritten;
+
+	// object -> id + 1 (open addressing; 0 is an empty slot)
+	Object** keys;
+	int* ids;
+	int capacity;	// always a power of 2
+} Snapshot;
+
+static int HashObject(const Object* obj)
+{
+	uintptr_t x = (uintptr_t)obj / GC_SLOT_SIZE;
+	return (int)(uint32_t)(x * 2654435761u);
+}
+
+static void GrowIds(Snapshot* snap)
+{
+	Object** keys = snap->keys;
+	int* ids = snap->ids;
+	int capacity = snap->capacity;
+
+	snap->capacity = capacity ? capacity * 2 : 1024;
+	snap->keys = ecalloc(sizeof(Object*), snap->capacity);
+	snap->ids = ecalloc(sizeof(int), snap->capacity);
+
+	int mask = snap->capacity - 1;
+	for(int i = 0; i < capacity; ++i)
+	{
+		if(!ids[i]) continue;
+
+		int j = HashObject(keys[i]) & mask;
+		while(snap->ids[j])
+			j = (j + 1) & mask;
+
+		snap->keys[j] = keys[i];
+		snap->ids[j] = ids[i];
+	}
+
+	free(keys);
+	free(ids);
+}
+
+// returns the id of obj, queueing it up to be written if it hasn't been seen before
+static int GetObjectId(Snapshot* snap, Object* obj)
+{
+	// keep the load factor under 1/2
+	if((snap->numObjects + 1) * 2 > snap->capacity)
+		GrowIds(snap);
+
+	int mask = snap->capacity - 1;
+	int i = HashObject(obj) & mask;
+
+	while(snap->ids[i])
+	{
+		if(snap->keys[i] == obj)
+			return snap->ids[i] - 1;
+		i = (i + 1) & mask;
+	}
+
+	if(snap->numObjects >= snap->objectsCapacity)
+	{
+		snap->objectsCapacity = snap->objectsCapacity ? snap->objectsCapacity * 2 : 1024;
+		snap->objects = erealloc(snap->objects, sizeof(Object*) * snap->objectsCapacity);
+	}
+
+	int id = snap->numObjects++;
+	snap->objects[id] = obj;
+
+	snap->keys[i] = obj;
+	snap->ids[i] = id + 1;
+
+	return id;
+}
+
+static void WriteQuoted(FILE* out, const char* chars, int length)
+{
+	int truncated = length > SNAPSHOT_MAX_LABEL;
+	if(truncated)
+		length = SNAPSHOT_MAX_LABEL;
+
+	fputc('"', out);
+	for(int i = 0; i < length; ++i)
+	{
+		char c = chars[i];
+
+		if(c == '"' || c == '\\') { fputc('\\', out); fputc(c, out); }
+		else if(c == '\n') fputs("\\n", out);
+		else fputc(c, out);
+	}
+	if(truncated)
+		fputs("...", out);
+	fputs("\"\n", out);
+}
+
+static void WriteEdge(Snapshot* snap, int from, Value to, const char* name)
+{
+	if(!IS_OBJECT(to)) return;
+
+	fprintf(snap->out, "e %d %d ", from, GetObjectId(snap, AS_OBJECT(to)));
+	WriteQuoted(snap->out, name, (int)strlen(name));
+}
+
+static void WriteRoot(Snapshot* snap, Value to, const char* name)
+{
+	if(!IS_OBJECT(to)) return;
+
+	fprintf(snap->out, "r %d ", GetObjectId(snap, AS_OBJECT(to)));
+	WriteQuoted(snap->out, name, (int)strlen(name));
+}
+
+// NOTE: this follows the same references as ScanObject in gc.c (except for the
+// ones natives mark themselves, which the snapshot can't see); weak references
+// don't retain anything so they're left out
+static void WriteObject(Snapshot* snap, int id, Object* obj)
+{
+	VM* vm = snap->vm;
+	FILE* out = snap->out;
+	char name[64];
+
+	fprintf(out, "o %d %s %lu ", id, ObjectTypeNames[obj->type], (unsigned long)(GC_SLOT_SIZE + obj->externalSize));
+
+	if(obj->type == OBJ_STRING)
+	{
+		// NOTE: ropes aren't flattened since that would allocate
+		if(obj->string.isRope)
+			WriteQuoted(out, "(rope)", 6);
+		else
+			WriteQuoted(out, obj->string.raw, obj->string.length);
+	}
+	else if(obj->type == OBJ_FUNC)
+	{
+		const char* funcName = obj->func.isExtern ? vm->externNames[obj->func.index] : vm->functionNames[obj->func.index];
+		if(!funcName)
+			funcName = "";
+		WriteQuoted(out, funcName, (int)strlen(funcName));
+	}
+	else
+		WriteQuoted(out, "", 0);
+
+	if(obj->type == OBJ_STRING)
+	{
+		if(obj->string.isRope)
+		{
+			WriteEdge(snap, id, OBJECT_VAL(obj->string.left), "(left)");
+			WriteEdge(snap, id, OBJECT_VAL(obj->string.right), "(right)");
+		}
+	}
+	else if(obj->type == OBJ_ARRAY)
+	{
+		for(int i = 0; i < obj->array.length; ++i)
+		{
+			sprintf(name, "[%d]", i);
+			WriteEdge(snap, id, obj->array.members[i], name);
+		}
+	}
+	else if(obj->type == OBJ_DICT)
+	{
+		for(int i = 0; i < GetDictEntryCount(obj->dict); ++i)
+		{
+			DictEntry* entry = GetDictEntry(obj->dict, i);
+			if(!entry) continue;
+
+			WriteEdge(snap, id, OBJECT_VAL(entry->key), "(key)");
+
+			if(IS_OBJECT(entry->value) && (!(obj->weakMode & WEAK_VALUES) || !IsWeakReferent(entry->value)))
+			{
+				fprintf(out, "e %d %d ", id, GetObjectId(snap, AS_OBJECT(entry->value)));
+				WriteQuoted(out, entry->key->string.raw, entry->key->string.length);
+			}
+		}
+
+		if(obj->meta)
+			WriteEdge(snap, id, OBJECT_VAL(obj->meta), "(meta)");
+	}
+	else if(obj->type == OBJ_STRUCT)
+	{
+		const StructType* type = &vm->structTypes[obj->structure.typeIndex];
+		for(int i = 0; i < type->numFields; ++i)
+		{
+			if(IS_OBJECT(obj->structure.members[i]))
+			{
+				fprintf(out, "e %d %d ", id, GetObjectId(snap, AS_OBJECT(obj->structure.members[i])));
+				WriteQuoted(out, type->keys[i]->string.raw, type->keys[i]->string.length);
+			}
+		}
+	}
+	else if(obj->type == OBJ_MAP)
+	{
+		for(int i = 0; i < GetMapEntryCount(obj->map); ++i)
+		{
+			MapEntry* entry = GetMapEntry(obj->map, i);
+			if(!entry) continue;
+
+			// weak keys and values are left out (see WEAK_KEYS)
+			if(!(obj->map->weakMode & WEAK_KEYS) || !IsWeakReferent(entry->key))
+				WriteEdge(snap, id, entry->key, "(key)");
+			if((obj->map->weakMode & WEAK_VALUES) && IsWeakReferent(entry->value))
+				continue;
+
+			// the values are named after their keys when those are strings
+			if(GetValueType(entry->key) == OBJ_STRING && !AS_OBJECT(entry->key)->string.isRope && IS_OBJECT(entry->value))
+			{
+				fprintf(out, "e %d %d ", id, GetObjectId(snap, AS_OBJECT(entry->value)));
+				WriteQuoted(out, AS_OBJECT(entry->key)->string.raw, AS_OBJECT(entry->key)->string.length);
+			}
+			else
+				WriteEdge(snap, id, entry->value, "(value)");
+		}
+	}
+	else if(obj->type == OBJ_FUNC)
+	{
+		if(obj->func.env)
+			WriteEdge(snap, id, OBJECT_VAL(obj->func.env), "(env)");
+	}
+	else if(obj->type == OBJ_THREAD)
+	{
+		if(obj->thread)
+		{
+			for(int i = 0; i < obj->thread->stackSize; ++i)
+			{
+				sprintf(name, "stack[%d]", i);
+				WriteEdge(snap, id, obj->thread->stack[i], name);
+			}
+			WriteEdge(snap, id, obj->thread->retVal, "(retval)");
+		}
+	}
+}
+
+void WriteHeapSnapshot(VM* vm, FILE* out)
+{
+	Snapshot snap;
+	memset(&snap, 0, sizeof(Snapshot));
+
+	snap.vm = vm;
+	snap.out = out;
+
+	fprintf(out, "%s %d\n", SNAPSHOT_HEADER, SNAPSHOT_VERSION);
+
+	// the same roots MarkRoots uses
+	char name[64];
+
+	for(int i = 0; i < vm->numGlobals; ++i)
+	{
+		// NOTE: the global names are stored in reverse order (see OP_GET)
+		if(vm->globalNames && vm->globalNames[vm->numGlobals - i - 1])
+			WriteRoot(&snap, vm->globals[i], vm->globalNames[vm->numGlobals - i - 1]);
+		else
+		{
+			sprintf(name, "global %d", i);
+			WriteRoot(&snap, vm->globals[i], name);
+		}
+	}
+
+	for(int i = 0; i < vm->numStringConstants; ++i)
+	{
+		if(vm->stringConstantObjects[i])
+		{
+			sprintf(name, "constant %d", i);
+			WriteRoot(&snap, OBJECT_VAL(vm->stringConstantObjects[i]), name);
+		}
+	}
+
+	int depth = 0;
+	for(VMThread* thread = vm->thread; thread; thread = thread->parent, ++depth)
+	{
+		for(int i = 0; i < thread->stackSize; ++i)
+		{
+			sprintf(name, "thread %d stack[%d]", depth, i);
+			WriteRoot(&snap, thread->stack[i], name);
+		}
+
+		sprintf(name, "thread %d retval", depth);
+		WriteRoot(&snap, thread->retVal, name);
+	}
+
+	// writing an object can find new ones
+	while(snap.numWritten < snap.numObjects)
+	{
+		int id = snap.numWritten++;
+		WriteObject(&snap, id, snap.objects[id]);
+	}
+
+	free(snap.objects);
+	free(snap.keys);
+	free(snap.ids);
+}
@@ -227,6 +227,7 @@ TypeHint* RegisterUserType(const char* name)
 	strcpy(type->user.name, name);
 
 	type->user.numElements = 0;
+	type->user.structIndex = -1;
 	
 	type->next = UserTypes;
 	UserTypes = type;
@@ -651,6 +652,21 @@ TypeHint* InferTypeFromExpr(Expr* exp)
 			super->subType = inf;
 			return super;
 		} break;
+
+		case EXP_FOR_IN:
+		{
+			Expr* node = exp->forinx.bodyHead;
+			TypeHint* inf = NULL;
+			while(node)
+			{
+				if(!node->next)
+					inf = InferTypeFromExpr(node);
+				node = node->next;
+			}
+			TypeHint* super = GetBroadTypeHint(ARRAY);
+			super->subType = inf;
+			return super;
+		} break;
 		
 		default:
 			break;
@@ -817,6 +833,27 @@ void ResolveTypes(Expr* exp)
 			ResolveTypes(exp->forx.iter);
 			ResolveTypesExprList(exp->forx.bodyHead);
 		} break;
+
+		case EXP_FOR_IN:
+		{
+			ResolveTypes(exp->forinx.iterable);
+
+			// the keys of arrays are indices and the keys of dicts are strings
+			const TypeHint* inf = InferTypeFromExpr(exp->forinx.iterable);
+			if(inf && !exp->forinx.keyDecl->type)
+			{
+				if(inf->hint == ARRAY)
+				{
+					exp->forinx.keyDecl->type = GetBroadTypeHint(NUMBER);
+					if(exp->forinx.valueDecl && !exp->forinx.valueDecl->type)
+						exp->forinx.valueDecl->type = inf->subType;
+				}
+				else if(inf->hint == DICT || inf->hint == USERTYPE)
+					exp->forinx.keyDecl->type = GetBroadTypeHint(STRING);
+			}
+
+			ResolveTypesExprList(exp->forinx.bodyHead);
+		} break;
 		
 		case EXP_DOT:
 		{
@@ -9,16 +9,13 @@
 #include <time.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <limits.h>
 #include <assert.h>
 #ifdef MINT_FFI_SUPPORT
 #include <dlfcn.h>
 #endif
 
-Object NullObject = { .type = OBJ_NULL };
-Object TrueObject = { .type = OBJ_BOOL, .boolean = MINT_TRUE };
-Object FalseObject = { .type = OBJ_BOOL, .boolean = MINT_FALSE };
-
-static char* ObjectTypeNames[] =
+const char* ObjectTypeNames[] =
 {
 	"null",
 	"bool",
@@ -28,7 +25,10 @@ static char* ObjectTypeNames[] =
 	"native",
 	"function",
 	"dict",
-	"thread"
+	"thread",
+	"weak",
+	"struct",
+	"map"
 };
 
 static void* _emalloc(size_t size, int line)
@@ -67,21 +67,33 @@ static char* estrdup(const char* string)
 	return newString;
 }
 
-void WriteObject(VM* vm, Object* top);
-void WriteNonVerbose(VM* vm, Object* obj)
+void WriteValue(VM* vm, Value top);
+void WriteNonVerbose(VM* vm, Value val)
 {
-	if(obj->type == OBJ_NUMBER || obj->type == OBJ_STRING || obj->type == OBJ_FUNC)
+	ObjectType type = GetValueType(val);
+	if(type == OBJ_NUMBER || type == OBJ_STRING || type == OBJ_FUNC)
 	{
-		WriteObject(vm, obj);
+		WriteValue(vm, val);
 		printf("\n");
 	}
 	else
-		printf("%s\n", ObjectTypeNames[obj->type]);
+		printf("%s\n", ObjectTypeNames[type]);
 }
 
-Object* GetLocal(VM* vm, int index);
+Value GetLocal(VM* vm, int index);
 void ErrorExitVM(VM* vm, const char* format, ...)
 {
+	// NOTE: there's no thread while the program is being loaded
+	if(!vm->thread)
+	{
+		va_list args;
+		va_start(args, format);
+		fprintf(stderr, "Error: ");
+		vfprintf(stderr, format, args);
+		va_end(args);
+		exit(1);
+	}
+
 	fprintf(stderr, "Error (%s:%i:%i) (last function called: %s):\n", vm->thread->curFile, vm->thread->curLine, vm->thread->pc, vm->lastFunctionName);
 	
 	va_list args;
@@ -148,12 +160,28 @@ void Std_Atan2(VM* vm)
 	ReturnTop(vm);
 }
 
-void WriteObject(VM* vm, Object* top)
+void WriteValue(VM* vm, Value val)
 {
-	if (top->type == OBJ_NUMBER)
-		printf("%g", top->number);
-	else if (top->type == OBJ_STRING)
-		printf("%s", top->string.raw);
+	if (IS_NUMBER(val))
+	{
+		printf("%g", AS_NUMBER(val));
+		return;
+	}
+	else if (IS_NULL(val))
+	{
+		printf("null");
+		return;
+	}
+	else if (IS_BOOL(val))
+	{
+		printf("%s", AS_BOOL(val) ? "true" : "false");
+		return;
+	}
+
+	Object* top = AS_OBJECT(val);
+
+	if (top->type == OBJ_STRING)
+		printf("%s", GetStringChars(top));
 	else if (top->type == OBJ_NATIVE)
 		printf("native pointer (0x%x)", (unsigned int)(intptr_t)(top->native.value));
 	else if (top->type == OBJ_FUNC)
@@ -168,7 +196,7 @@ void WriteObject(VM* vm, Object* top)
 		printf("[");
 		for (int i = 0; i < top->array.length; ++i)
 		{
-			WriteObject(vm, top->array.members[i]);
+			WriteValue(vm, top->array.members[i]);
 			if (i + 1 < top->array.length)
 				printf(",");
 		}
@@ -177,28 +205,58 @@ void WriteObject(VM* vm, Object* top)
 	else if (top->type == OBJ_DICT)
 	{
 		printf("{ ");
-		for (int i = 0; i < top->dict.active.length; ++i)
+		int numWritten = 0;
+		for (int i = 0; i < GetDictEntryCount(top->dict); ++i)
 		{
-			DictNode* node = top->dict.buckets[top->dict.active.data[i]];
+			DictEntry* entry = GetDictEntry(top->dict, i);
+			if (!entry) continue;
 
-			while (node)
-			{
-				printf("%s = ", node->key);
-				WriteObject(vm, node->value);
+			printf("%s = ", entry->key->string.raw);
+			WriteValue(vm, entry->value);
 
-				if (node->next || (i + 1 < top->dict.active.length))
-					printf(", ");
-				node = node->next;
-			}
+			if (++numWritten < top->dict->numEntries)
+				printf(", ");
+		}
+		printf(" }");
+	}
+	else if (top->type == OBJ_STRUCT)
+	{
+		const StructType* type = &vm->structTypes[top->structure.typeIndex];
+
+		printf("{ ");
+		for (int i = 0; i < type->numFields; ++i)
+		{
+			printf("%s = ", type->keys[i]->string.raw);
+			WriteValue(vm, top->structure.members[i]);
+
+			if (i + 1 < type->numFields)
+				printf(", ");
+		}
+		printf(" }");
+	}
+	else if (top->type == OBJ_MAP)
+	{
+		printf("{ ");
+		int numWritten = 0;
+		for (int i = 0; i < GetMapEntryCount(top->map); ++i)
+		{
+			MapEntry* entry = GetMapEntry(top->map, i);
+			if (!entry) continue;
+
+			printf("[");
+			WriteValue(vm, entry->key);
+			printf("] = ");
+			WriteValue(vm, entry->value);
+
+			if (++numWritten < top->map->numEntries)
+				printf(", ");
 		}
 		printf(" }");
 	}
 	else if (top->type == OBJ_THREAD)
 		printf("thread (0x%x)", (unsigned int)(intptr_t)(top->thread));
-	else if (top->type == OBJ_NULL)
-		printf("null");
-	else if (top->type == OBJ_BOOL)
-		printf("%s", top->boolean ? "true" : "false");
+	else if (top->type == OBJ_WEAK)
+		printf("weak (%s)", top->weak ? ObjectTypeNames[top->weak->type] : "collected");
 }
 
 void Std_Printf(VM* vm)
@@ -234,7 +292,7 @@ void Std_Printf(VM* vm)
 
 					case 'o':
 					{
-						WriteObject(vm, PopObject(vm));
+						WriteValue(vm, PopValue(vm));
 					} break;
 					
 					default:
@@ -251,50 +309,134 @@ void Std_Printf(VM* vm)
 	ReturnNullObject(vm);
 }
 
+static Object* PopTypedObject(VM* vm, ObjectType type, const char* expected);
+static Object* ConcatStrings(VM* vm, Object* a, Object* b);
+static Object* ToDict(VM* vm, Value val);
+static void PutDictValue(VM* vm, Object* obj, Object* key, Value value);
+static Object* NewStringAdopt(VM* vm, char* raw, int length);
 void Std_Strcat(VM* vm)
 {
-	const char* a = PopString(vm);
-	const char* b = PopString(vm);
+	Object* a = PopTypedObject(vm, OBJ_STRING, "string");
+	Object* b = PopTypedObject(vm, OBJ_STRING, "string");
+	
+	PushObject(vm, ConcatStrings(vm, a, b));
+	ReturnTop(vm);
+}
+
+typedef struct
+{
+	char* data;
+	int length;
+	int capacity;
+} StringBuilder;
+
+static void Std_FreeStringBuilder(void* sb)
+{
+	free(((StringBuilder*)sb)->data);
+	free(sb);
+}
+
+void Std_StringBuilder(VM* vm)
+{
+	StringBuilder* sb = emalloc(sizeof(StringBuilder));
+	
+	sb->length = 0;
+	sb->capacity = 64;
+	sb->data = emalloc(sb->capacity);
+	
+	Object* obj = PushNative(vm, sb, Std_FreeStringBuilder, NULL);
+	SetExternalSize(vm, obj, sizeof(StringBuilder) + sb->capacity);
+	ReturnTop(vm);
+}
+
+// appends a string (or the character code if the value is a number) to the builder
+void Std_StringBuilderAppend(VM* vm)
+{
+	Object* obj = PopNativeObject(vm);
+	StringBuilder* sb = obj->native.value;
+	Value val = PopValue(vm);
+	
+	char c;
+	const char* chars;
+	int length;
+	
+	if(IS_NUMBER(val))
+	{
+		c = (char)AS_NUMBER(val);
+		chars = &c;
+		length = 1;
+	}
+	else if(GetValueType(val) == OBJ_STRING)
+	{
+		chars = GetStringChars(AS_OBJECT(val));
+		length = AS_OBJECT(val)->string.length;
+	}
+	else
+		ErrorExitVM(vm, "extern 'strbuilder_append' expected a string or a number but received a %s\n", ObjectTypeNames[GetValueType(val)]);
+	
+	if(sb->length + length > sb->capacity)
+	{
+		while(sb->length + length > sb->capacity)
+			sb->capacity *= 2;
+		sb->data = erealloc(sb->data, sb->capacity);
+		SetExternalSize(vm, obj, sizeof(StringBuilder) + sb->capacity);
+	}
 	
-	int la = strlen(a);
-	int lb = strlen(b);
+	memcpy(sb->data + sb->length, chars, length);
+	sb->length += length;
 	
-	char* newString = emalloc(la + lb + 1);
+	ReturnNullObject(vm);
+}
 
-	strcpy(newString, a);
-	strcpy(newString + la, b);
+void Std_StringBuilderToString(VM* vm)
+{
+	StringBuilder* sb = PopNative(vm);
+	
+	char* raw = emalloc(sb->length + 1);
+	memcpy(raw, sb->data, sb->length);
+	raw[sb->length] = '\0';
 	
-	PushString(vm, newString);
+	PushObject(vm, NewStringAdopt(vm, raw, sb->length));
 	ReturnTop(vm);
+}
 
-	free(newString);
+void Std_StringBuilderClear(VM* vm)
+{
+	StringBuilder* sb = PopNative(vm);
+	sb->length = 0;
+	ReturnNullObject(vm);
 }
 
 void Std_Tonumber(VM* vm)
 {
-	Object* obj = PopObject(vm);
+	Value val = PopValue(vm);
 	
-	if(obj->type == OBJ_STRING) PushNumber(vm, strtod(obj->string.raw, NULL));
-	else if(obj->type == OBJ_NUMBER) PushObject(vm, obj);
-	else PushNumber(vm, (intptr_t)(obj));
+	if(IS_NUMBER(val)) PushValue(vm, val);
+	else if(IS_OBJECT(val) && AS_OBJECT(val)->type == OBJ_STRING) PushNumber(vm, strtod(GetStringChars(AS_OBJECT(val)), NULL));
+	else if(IS_OBJECT(val)) PushNumber(vm, (intptr_t)(AS_OBJECT(val)));
+	else PushNumber(vm, 0);
 	ReturnTop(vm);
 }
 
 void Std_Tostring(VM* vm)
 {
-	Object* obj = PopObject(vm);
+	Value val = PopValue(vm);
+	Object* obj = IS_OBJECT(val) ? AS_OBJECT(val) : NULL;
 	char buf[128] = { 0 };
-	switch(obj->type)
+	switch(GetValueType(val))
 	{
 		case OBJ_NULL: sprintf(buf, "null"); break;
-		case OBJ_STRING: PushObject(vm, obj); return;
-		case OBJ_NUMBER: sprintf(buf, "%g", obj->number); break;
+		case OBJ_STRING: PushValue(vm, val); ReturnTop(vm); return;
+		case OBJ_NUMBER: sprintf(buf, "%g", AS_NUMBER(val)); break;
 		case OBJ_ARRAY: sprintf(buf, "array(%i)", obj->array.length); break;
 		case OBJ_FUNC: sprintf(buf, "func %s", obj->func.isExtern ? vm->externNames[obj->func.index] : vm->functionNames[obj->func.index]); break;
-		case OBJ_DICT: sprintf(buf, "dict(%i)", obj->dict.numEntries); break; 
+		case OBJ_DICT: sprintf(buf, "dict(%i)", obj->dict->numEntries); break; 
+		case OBJ_STRUCT: sprintf(buf, "dict(%i)", vm->structTypes[obj->structure.typeIndex].numFields); break;
+		case OBJ_MAP: sprintf(buf, "map(%i)", obj->map->numEntries); break;
 		case OBJ_NATIVE: sprintf(buf, "native(%x)", (unsigned int)(intptr_t)(obj->native.value)); break;
 		case OBJ_THREAD: sprintf(buf, "thread(%x)", (unsigned int)(intptr_t)(obj->thread)); break;
-		case OBJ_BOOL: sprintf(buf, "%s", obj->boolean ? "true" : "false"); break;
+		case OBJ_WEAK: sprintf(buf, "weak(%s)", obj->weak ? ObjectTypeNames[obj->weak->type] : "collected"); break;
+		case OBJ_BOOL: sprintf(buf, "%s", AS_BOOL(val) ? "true" : "false"); break;
 	}
 	
 	PushString(vm, buf);
@@ -303,8 +445,10 @@ void Std_Tostring(VM* vm)
 
 void Std_Typeof(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	PushString(vm, ObjectTypeNames[obj->type]);
+	Value val = PopValue(vm);
+	// NOTE: structs are only a different representation of dicts
+	ObjectType type = GetValueType(val);
+	PushString(vm, ObjectTypeNames[type == OBJ_STRUCT ? OBJ_DICT : type]);
 	ReturnTop(vm);
 }
 
@@ -319,16 +463,38 @@ void Std_Assert(VM* vm)
 	ReturnNullObject(vm);
 }
 
+// removes an element of an array (or the entry of a map; then it returns whether there was one)
 void Std_Erase(VM* vm)
 {
-	Object* obj = PopArrayObject(vm);
+	Value val = PopValue(vm);
+	ObjectType type = GetValueType(val);
+
+	if(type == OBJ_MAP)
+	{
+		Value key = PopValue(vm);
+		PushBool(vm, IsValidMapKey(key) && MapRemove(AS_OBJECT(val)->map, key, NULL));
+		ReturnTop(vm);
+		return;
+	}
+	else if(type == OBJ_DICT || type == OBJ_STRUCT)
+	{
+		Object* obj = ToDict(vm, val);
+		Object* key = PopTypedObject(vm, OBJ_STRING, "string");
+		PushBool(vm, DictRemove(obj->dict, key, NULL));
+		ReturnTop(vm);
+		return;
+	}
+	else if(type != OBJ_ARRAY)
+		ErrorExitVM(vm, "Expected array, dict or map but received %s\n", ObjectTypeNames[type]);
+
+	Object* obj = AS_OBJECT(val);
 	int index = (int)PopNumber(vm);
 	
 	if(index < 0 || index >= obj->array.length)
 		ErrorExitVM(vm, "Attempted to erase non-existent index %i\n", index);
 	
 	if(index < obj->array.length - 1 && obj->array.length > 1)
-		memmove(&obj->array.members[index], &obj->array.members[index + 1], sizeof(Object*) * (obj->array.length - index - 1));
+		memmove(&obj->array.members[index], &obj->array.members[index + 1], sizeof(Value) * (obj->array.length - index - 1));
 	--obj->array.length;
 	
 	ReturnNullObject(vm);
@@ -347,7 +513,7 @@ void Std_Fopen(VM* vm)
 	FILE* file = fopen(filename, mode);
 	if(!file)
 	{	
-		PushObject(vm, &NullObject);
+		ReturnNullObject(vm);
 		return;
 	}
 	
@@ -401,7 +567,7 @@ void Std_Joinchars(VM* vm)
 	char* str = emalloc(obj->array.length + 1);
 
 	for(int i = 0; i < obj->array.length; ++i)
-		str[i] = (char)obj->array.members[i]->number;
+		str[i] = (char)AS_NUMBER(obj->array.members[i]);
 	
 	str[obj->array.length] = '\0';
 	
@@ -450,7 +616,8 @@ void Std_Bytes(VM* vm)
 	ba->length = length;
 	ba->bytes = ecalloc(sizeof(unsigned char), length);
 	
-	PushNative(vm, ba, Std_FreeBytes, NULL);
+	Object* obj = PushNative(vm, ba, Std_FreeBytes, NULL);
+	SetExternalSize(vm, obj, sizeof(ByteArray) + length);
 	ReturnTop(vm);
 }
 
@@ -564,7 +731,8 @@ void Std_NumberToBytes(VM* vm)
 		case NBA_POINTER: memcpy(ba->bytes, &number, sizeof(void*)); break;
 	}
 	
-	PushNative(vm, ba, Std_FreeBytes, NULL);
+	Object* obj = PushNative(vm, ba, Std_FreeBytes, NULL);
+	SetExternalSize(vm, obj, sizeof(ByteArray) + length);
 	ReturnTop(vm);
 }
 
@@ -611,15 +779,16 @@ void Std_GetFuncByName(VM* vm)
 	if(index >= 0)
 		PushFunc(vm, index, MINT_FALSE, NULL);
 	else
-		PushObject(vm, &NullObject);
+		PushNull(vm);
 	ReturnTop(vm);
 }
 
 void Std_GetFuncName(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_FUNC)
-		ErrorExitVM(vm, "extern 'getfuncname' expected a function pointer as its argument but received a %s\n", ObjectTypeNames[obj->type]);
+	Value val = PopValue(vm);
+	if(GetValueType(val) != OBJ_FUNC)
+		ErrorExitVM(vm, "extern 'getfuncname' expected a function pointer as its argument but received a %s\n", ObjectTypeNames[GetValueType(val)]);
+	Object* obj = AS_OBJECT(val);
 	
 	PushString(vm, vm->functionNames[obj->func.index]);
 	ReturnTop(vm);
@@ -627,9 +796,10 @@ void Std_GetFuncName(VM* vm)
 
 void Std_GetNumArgs(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_FUNC)
-		ErrorExitVM(vm, "extern 'getnumargs' expected a function pointer as its argument but received a %s\n", ObjectTypeNames[obj->type]);
+	Value val = PopValue(vm);
+	if(GetValueType(val) != OBJ_FUNC)
+		ErrorExitVM(vm, "extern 'getnumargs' expected a function pointer as its argument but received a %s\n", ObjectTypeNames[GetValueType(val)]);
+	Object* obj = AS_OBJECT(val);
 	
 	PushNumber(vm, vm->functionNumArgs[obj->func.index]);
 	ReturnTop(vm);
@@ -637,9 +807,10 @@ void Std_GetNumArgs(VM* vm)
 
 void Std_HasEllipsis(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_FUNC)
-		ErrorExitVM(vm, "extern 'hasellipsis' expected a function pointer as its argument but received a %s\n", ObjectTypeNames[obj->type]);
+	Value val = PopValue(vm);
+	if(GetValueType(val) != OBJ_FUNC)
+		ErrorExitVM(vm, "extern 'hasellipsis' expected a function pointer as its argument but received a %s\n", ObjectTypeNames[GetValueType(val)]);
+	Object* obj = AS_OBJECT(val);
 		
 	PushNumber(vm, vm->functionHasEllipsis[obj->func.index]);
 	ReturnTop(vm);
@@ -647,8 +818,131 @@ void Std_HasEllipsis(VM* vm)
 
 void Std_StringHash(VM* vm)
 {
-	const char* string = PopString(vm);	
-	PushNumber(vm, SuperFastHash(string, strlen(string)));
+	PushNumber(vm, PopStringObject(vm)->string.hash);
+	ReturnTop(vm);
+}
+
+static void SetStatValue(VM* vm, Object* obj, const char* name, Value value)
+{
+	PutDictValue(vm, obj, InternString(vm, name, (int)strlen(name)), value);
+}
+
+// returns a dict of collector stats (see GcStats); times are in milliseconds
+void Std_GcStats(VM* vm)
+{
+	GcStats stats;
+	GetGcStats(vm, &stats);
+	
+	Object* obj = PushDict(vm);
+	
+	SetStatValue(vm, obj, "minor", NUMBER_VAL(stats.numMinor));
+	SetStatValue(vm, obj, "major", NUMBER_VAL(stats.numMajor));
+	SetStatValue(vm, obj, "pauses", NUMBER_VAL(stats.numPauses));
+	SetStatValue(vm, obj, "totalpause", NUMBER_VAL(stats.totalPause * 1000.0));
+	SetStatValue(vm, obj, "maxpause", NUMBER_VAL(stats.maxPause * 1000.0));
+	
+	Object* histogram = PushArray(vm, GC_PAUSE_BUCKETS);
+	for(int i = 0; i < GC_PAUSE_BUCKETS; ++i)
+		histogram->array.members[i] = NUMBER_VAL(stats.pauseHistogram[i]);
+	SetStatValue(vm, obj, "histogram", PopValue(vm));
+	
+	Object* objects = PushDict(vm);
+	Object* bytes = PushDict(vm);
+	for(int type = OBJ_STRING; type <= OBJ_MAP; ++type)
+	{
+		SetStatValue(vm, objects, ObjectTypeNames[type], NUMBER_VAL(stats.numObjects[type]));
+		SetStatValue(vm, bytes, ObjectTypeNames[type], NUMBER_VAL((double)stats.numBytes[type]));
+	}
+	SetStatValue(vm, obj, "bytes", PopValue(vm));
+	SetStatValue(vm, obj, "objects", PopValue(vm));
+	
+	SetStatValue(vm, obj, "heapbytes", NUMBER_VAL((double)vm->heap.numBytes));
+	SetStatValue(vm, obj, "allocated", NUMBER_VAL((double)stats.allocatedBytes));
+	SetStatValue(vm, obj, "allocrate", NUMBER_VAL(stats.allocationRate));
+	SetStatValue(vm, obj, "pages", NUMBER_VAL(stats.numPages));
+	SetStatValue(vm, obj, "freepages", NUMBER_VAL(stats.numFreePages));
+	SetStatValue(vm, obj, "freeslots", NUMBER_VAL(stats.numFreeSlots));
+	
+	ReturnTop(vm);
+}
+
+// returns a weak reference to any object (numbers, bools and null can't be referenced weakly)
+void Std_WeakRef(VM* vm)
+{
+	Value val = PopValue(vm);
+	if(!IS_OBJECT(val))
+		ErrorExitVM(vm, "Attempted to create a weak reference to a %s\n", ObjectTypeNames[GetValueType(val)]);
+	
+	PushWeak(vm, AS_OBJECT(val));
+	ReturnTop(vm);
+}
+
+// returns the target of a weak reference (or null if it has been collected)
+void Std_WeakGet(VM* vm)
+{
+	Object* obj = PopWeakObject(vm);
+	
+	if(obj->weak)
+		PushObject(vm, obj->weak);
+	else
+		PushNull(vm);
+	ReturnTop(vm);
+}
+
+// returns an empty dict whose values are weak ("v")
+// NOTE: the keys of a dict are strings, so they can't be weak (see WEAK_KEYS)
+void Std_WeakDict(VM* vm)
+{
+	const char* mode = PopString(vm);
+	
+	if(strcmp(mode, "v") != 0)
+		ErrorExitVM(vm, "Invalid weak dict mode '%s' (expected 'v'; use a weakmap for weak keys)\n", mode);
+	
+	PushWeakDict(vm, WEAK_VALUES);
+	ReturnTop(vm);
+}
+
+// returns an empty map (which can be keyed by anything but null and NaN)
+void Std_Map(VM* vm)
+{
+	PushMap(vm);
+	ReturnTop(vm);
+}
+
+// returns an empty map whose keys ("k"), values ("v") or both ("kv") are weak
+void Std_WeakMap(VM* vm)
+{
+	const char* mode = PopString(vm);
+	char weakMode = 0;
+	
+	for(const char* c = mode; *c; ++c)
+	{
+		if(*c == 'k') weakMode |= WEAK_KEYS;
+		else if(*c == 'v') weakMode |= WEAK_VALUES;
+		else ErrorExitVM(vm, "Invalid weak map mode '%s' (expected 'k', 'v' or 'kv')\n", mode);
+	}
+	
+	PushWeakMap(vm, weakMode);
+	ReturnTop(vm);
+}
+
+// writes a heap snapshot (see snapshot.h) to the given file; returns false if it couldn't be opened
+void Std_HeapSnapshot(VM* vm)
+{
+	const char* filename = PopString(vm);
+	
+	FILE* file = fopen(filename, "w");
+	if(!file)
+	{
+		PushBool(vm, MINT_FALSE);
+		ReturnTop(vm);
+		return;
+	}
+	
+	WriteHeapSnapshot(vm, file);
+	fclose(file);
+	
+	PushBool(vm, MINT_TRUE);
 	ReturnTop(vm);
 }
 
@@ -690,19 +984,20 @@ void Std_Malloc(VM* vm)
 	size_t size = (size_t)PopNumber(vm);
 	void* mem = emalloc(size);
 	
-	PushNative(vm, mem, NULL, NULL);
+	Object* obj = PushNative(vm, mem, NULL, NULL);
+	SetExternalSize(vm, obj, size);
 	ReturnTop(vm);
 }
 
 void Std_Memcpy(VM* vm)
 {
 	void* dest = PopNative(vm);
-	Object* srcobj = PopObject(vm);
+	Value src = PopValue(vm);
 	size_t size = (size_t)PopNumber(vm);
 	
-	if(srcobj->type == OBJ_NATIVE) memcpy(dest, srcobj->native.value, size);
-	else if(srcobj->type == OBJ_NULL) memset(dest, 0, size);
-	else ErrorExitVM(vm, "Invalid memcpy source parameter (%s instead of null or native)\n", ObjectTypeNames[srcobj->type]);
+	if(GetValueType(src) == OBJ_NATIVE) memcpy(dest, AS_OBJECT(src)->native.value, size);
+	else if(IS_NULL(src)) memset(dest, 0, size);
+	else ErrorExitVM(vm, "Invalid memcpy source parameter (%s instead of null or native)\n", ObjectTypeNames[GetValueType(src)]);
 	ReturnNullObject(vm);
 }
 
@@ -741,7 +1036,7 @@ void Std_GetStructMember(VM* vm)
 			if(ptr)
 				PushNative(vm, ptr, NULL, NULL);
 			else
-				PushObject(vm, &NullObject);
+				PushNull(vm);
 			ReturnTop(vm);
 			return;
 		} break;
@@ -756,13 +1051,13 @@ void Std_SetStructMember(VM* vm)
 	char* addr = PopNative(vm);
 	size_t offset = PopNumber(vm);
 	int type = PopNumber(vm);
-	Object* obj = PopObject(vm);
+	Value val = PopValue(vm);
 	
-	if(obj->type != OBJ_NUMBER && obj->type != OBJ_NATIVE && obj->type != OBJ_NULL)
+	if(!IS_NUMBER(val) && !IS_NULL(val) && GetValueType(val) != OBJ_NATIVE)
 		ErrorExitVM(vm, "'setstructmember' only accepts numbers, native pointers, or null as values\n");
 	
-	double number = obj->number;
-	void* pointer = obj->native.value;
+	double number = IS_NUMBER(val) ? AS_NUMBER(val) : 0;
+	void* pointer = IS_OBJECT(val) ? AS_OBJECT(val)->native.value : NULL;
 	
 	unsigned char u8n = (unsigned char)(number);
 	unsigned short u16n = (unsigned short)(number);
@@ -793,7 +1088,7 @@ void Std_SetStructMember(VM* vm)
 		
 		case NBA_POINTER: 
 		{
-			if(obj->type != OBJ_NULL)
+			if(!IS_NULL(val))
 				memcpy(addr + offset, pointer, sizeof(void*)); 
 			else
 				memset(addr + offset, 0, sizeof(void*));
@@ -833,9 +1128,10 @@ void Std_Sizeof(VM* vm)
 
 void Std_Addressof(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_NATIVE)
-		ErrorExitVM(vm, "'addressof' expected a native pointer but received a %s\n", ObjectTypeNames[obj->type]);
+	Value val = PopValue(vm);
+	if(GetValueType(val) != OBJ_NATIVE)
+		ErrorExitVM(vm, "'addressof' expected a native pointer but received a %s\n", ObjectTypeNames[GetValueType(val)]);
+	Object* obj = AS_OBJECT(val);
 	
 	PushNative(vm, &obj->native.value, NULL, NULL);
 	ReturnTop(vm);
@@ -869,7 +1165,7 @@ void Std_AtAddress(VM* vm)
 			if(ptr)
 				PushNative(vm, ptr, NULL, NULL);
 			else
-				PushObject(vm, &NullObject);
+				PushNull(vm);
 			ReturnTop(vm);
 			return;
 		} break;
@@ -881,12 +1177,10 @@ void Std_AtAddress(VM* vm)
 
 void Std_ExternAddr(VM* vm)
 {
-	Object* ext = PopObject(vm);
-	if(ext->type != OBJ_FUNC)
-		ErrorExitVM(vm, "Expected func but received %s\n", ObjectTypeNames[ext->type]);
+	Object* ext = PopFuncObject(vm);
 	
 	if(!ext->func.isExtern)
-		PushObject(vm, &NullObject);
+		PushNull(vm);
 	else
 		PushNative(vm, (void*)vm->externs[ext->func.index], NULL, NULL);
 	ReturnTop(vm);
@@ -932,16 +1226,12 @@ void Std_FfiCall(VM* vm)
 	void* funcptr = PopNative(vm);
 	ffi_type* rtype = PopNative(vm);
 	
-	Object* types = PopObject(vm);
-	if(types->type != OBJ_ARRAY)
-		ErrorExitVM(vm, "Expected 3rd argument to 'ffi_call' to be an array but received %s\n", ObjectTypeNames[types->type]);
+	Object* types = PopArrayObject(vm);
 	unsigned int nargs = types->array.length;
 	if(nargs >= MAX_CIF_ARGS)
 		ErrorExitVM(vm, "Cannot pass more than %d arguments to foreign C function\n", MAX_CIF_ARGS);
 
-	Object* args = PopObject(vm);
-	if(args->type != OBJ_ARRAY)
-		ErrorExitVM(vm, "Expected 4th argument to 'ffi_call' to be an array but received %s\n", ObjectTypeNames[args->type]);
+	Object* args = PopArrayObject(vm);
 	
 	if(args->array.length != nargs)
 		ErrorExitVM(vm, "Length of argument array does not match length of type array\n");
@@ -949,10 +1239,10 @@ void Std_FfiCall(VM* vm)
 	ffi_type* argtypes[MAX_CIF_ARGS];
 	for(int i = 0; i < nargs; ++i)
 	{
-		if(types->array.members[i]->type != OBJ_NATIVE)	
+		if(GetValueType(types->array.members[i]) != OBJ_NATIVE)	
 			ErrorExitVM(vm, "Invalid argument type in 'ffi_prep' argument type list\n");
 		
-		argtypes[i] = types->array.members[i]->native.value;
+		argtypes[i] = AS_OBJECT(types->array.members[i])->native.value;
 	}
 	
 	if(ffi_prep_cif(&vm->cif, FFI_DEFAULT_ABI, nargs, rtype, argtypes) == FFI_OK)
@@ -967,24 +1257,26 @@ void Std_FfiCall(VM* vm)
 			ffi_type* type = argtypes[i];
 			void* value = &vm->cifStack[vm->cifStackSize];
 			vm->cifStackSize += type->size;
-			Object* obj = args->array.members[i];
+			Value val = args->array.members[i];
 			
 			if(type != &ffi_type_pointer)
 			{
-				if(obj->type != OBJ_NUMBER)
-					ErrorExitVM(vm, "ffi arg type value mismatch for argument %d (object type %s)\n", (i + 1), ObjectTypeNames[obj->type]);
+				if(!IS_NUMBER(val))
+					ErrorExitVM(vm, "ffi arg type value mismatch for argument %d (object type %s)\n", (i + 1), ObjectTypeNames[GetValueType(val)]);
 				
-				unsigned char ucn = (unsigned char)obj->number;
-				unsigned short usn = (unsigned short)obj->number;
-				unsigned int uin = (unsigned int)obj->number;
-				unsigned long uln = (unsigned long)obj->number;
+				double number = AS_NUMBER(val);
+
+				unsigned char ucn = (unsigned char)number;
+				unsigned short usn = (unsigned short)number;
+				unsigned int uin = (unsigned int)number;
+				unsigned long uln = (unsigned long)number;
 				
-				char cn = (char)obj->number;
-				short sn = (short)obj->number;
-				int in = (int)obj->number;
-				long ln = (long)obj->number;
+				char cn = (char)number;
+				short sn = (short)number;
+				int in = (int)number;
+				long ln = (long)number;
 			
-				float fn = (float)obj->number;
+				float fn = (float)number;
 			
 				if(type == &ffi_type_uchar) memcpy(value, &ucn, type->size);
 				else if(type == &ffi_type_ushort) memcpy(value, &usn, type->size);
@@ -995,18 +1287,22 @@ void Std_FfiCall(VM* vm)
 				else if(type == &ffi_type_sint) memcpy(value, &in, type->size);
 				else if(type == &ffi_type_slong) memcpy(value, &ln, type->size);
 				else if(type == &ffi_type_float) memcpy(value, &fn, type->size);
-				else if(type == &ffi_type_double) memcpy(value, &obj->number, type->size);
+				else if(type == &ffi_type_double) memcpy(value, &number, type->size);
 				else memset(value, 0, type->size);
 			}
 			else
 			{
-				if(obj->type != OBJ_NULL && obj->type != OBJ_NATIVE && obj->type != OBJ_STRING)
-					ErrorExitVM(vm, "ffi arg type value mismatch for argument %d (object type %s)\n", (i + 1), ObjectTypeNames[obj->type]);
+				ObjectType vtype = GetValueType(val);
+				if(vtype != OBJ_NULL && vtype != OBJ_NATIVE && vtype != OBJ_STRING)
+					ErrorExitVM(vm, "ffi arg type value mismatch for argument %d (object type %s)\n", (i + 1), ObjectTypeNames[vtype]);
 				
-				if(obj->type == OBJ_NATIVE)
-					memcpy(value, &obj->native.value, type->size);
-				else if(obj->type == OBJ_STRING)
-					memcpy(value, &obj->string.raw, type->size);
+				if(vtype == OBJ_NATIVE)
+					memcpy(value, &AS_OBJECT(val)->native.value, type->size);
+				else if(vtype == OBJ_STRING)
+				{
+					GetStringChars(AS_OBJECT(val));
+					memcpy(value, &AS_OBJECT(val)->string.raw, type->size);
+				}
 				else
 					memset(value, 0, type->size);
 			}
@@ -1036,8 +1332,7 @@ void Std_FfiCall(VM* vm)
 			else if(t == &ffi_type_double) number = *(double*)(p);
 			else number = 0;
 			
-			PushNumber(vm, number);
-			vm->stack[ffi_result_id] = PopObject(vm);
+			vm->globals[ffi_result_id] = NUMBER_VAL(number);
 		}
 		else
 		{
@@ -1048,10 +1343,10 @@ void Std_FfiCall(VM* vm)
 				if(at_p)
 				{
 					PushNative(vm, at_p, NULL, NULL);
-					vm->stack[ffi_result_id] = PopObject(vm);
+					vm->globals[ffi_result_id] = PopValue(vm);
 				}
 				else
-					vm->stack[ffi_result_id] = &NullObject;
+					vm->globals[ffi_result_id] = NULL_VAL;
 			}
 		}
 		
@@ -1087,9 +1382,7 @@ void Std_FfiStructTypeMark(void* type)
 
 void Std_FfiStructType(VM* vm)
 {
-	Object* memberTypes = PopObject(vm);
-	if(memberTypes->type != OBJ_ARRAY)
-		ErrorExitVM(vm, "'ffi_struct_type' expected an array but received a %s\n", ObjectTypeNames[memberTypes->type]);
+	Object* memberTypes = PopArrayObject(vm);
 	if(memberTypes->array.length == 0)
 		ErrorExitVM(vm, "empty member type array\n");
 
@@ -1102,9 +1395,9 @@ void Std_FfiStructType(VM* vm)
 	
 	for(int i = 0; i < memberTypes->array.length; ++i)
 	{
-		if(memberTypes->array.members[i]->type != OBJ_NATIVE)
+		if(GetValueType(memberTypes->array.members[i]) != OBJ_NATIVE)
 			ErrorExitVM(vm, "invalid member type\n");
-		elements[i] = memberTypes->array.members[i]->native.value;
+		elements[i] = AS_OBJECT(memberTypes->array.members[i])->native.value;
 	}
 	elements[memberTypes->array.length] = NULL;
 	
@@ -1113,7 +1406,7 @@ void Std_FfiStructType(VM* vm)
 	if(ffi_prep_cif(&vm->cif, FFI_DEFAULT_ABI, 1, &ffi_type_void, argtypes) == FFI_OK)
 		PushNative(vm, structType, Std_FreeFfiStructType, Std_FfiStructTypeMark);
 	else
-		PushObject(vm, &NullObject);
+		PushNull(vm);
 	ReturnTop(vm);
 }
 
@@ -1136,8 +1429,7 @@ void Std_FfiStructTypeOffsets(VM* vm)
 	ffi_type* structType = PopNative(vm);
 	int numElements = (int)PopNumber(vm);
 
-	PushArray(vm, numElements);
-	Object* obj = PopObject(vm);
+	Object* obj = PushArray(vm, numElements);
 
 	ffi_type** element = structType->elements;
 	
@@ -1147,15 +1439,13 @@ void Std_FfiStructTypeOffsets(VM* vm)
 #define ALIGN(v, a)  (((((size_t) (v))-1) | ((a)-1))+1)
 	for(int i = 0; i < obj->array.length; ++i)
 	{
-		PushNumber(vm, offset);
-		obj->array.members[i] = PopObject(vm);
+		obj->array.members[i] = NUMBER_VAL(offset);
 		
 		offset = ALIGN(offset, (*element)->alignment);
 		offset += (*element)->size;
 		++element;
 	}
 #undef ALIGN
-	PushObject(vm, obj);
 	ReturnTop(vm);
 }
 #endif
@@ -1168,68 +1458,130 @@ void Std_ArrayCopy(VM* vm)
 	int start2 = (int)PopNumber(vm);
 	size_t len = (size_t)PopNumber(vm);
 	
-	memcpy(&obj1->array.members[start1], &obj2->array.members[start2], len * sizeof(Object*)); 
+	RememberObject(vm, obj1);
+	memcpy(&obj1->array.members[start1], &obj2->array.members[start2], len * sizeof(Value)); 
 }
 
-void CallFunction(VM* vm, int id, Word numArgs);
-int Std_ArraySortCmp(VM* vm, Object* a, Object* b, int cmpIdx, Object* arg)
-{	
-	PushObject(vm, b);
-	PushObject(vm, a);
-	if(arg)
-	{	
-		PushObject(vm, arg);
-		CallFunction(vm, cmpIdx, 3);
-	}
-	else
-		CallFunction(vm, cmpIdx, 2);
-	int result = (int)vm->thread->retVal->number;
-	return result;
-}
+// NOTE: arraysort is a bottom-up merge sort whose state lives on top of the
+// stack; every comparison is an ordinary frame which continues the sort
+// (see ResumeArraySort) when it returns, so comparators are free to yield
+enum
+{
+	SORT_COMP,
+	SORT_ARRAY,
+	SORT_TEMP,
+	SORT_LENGTH,
+	SORT_WIDTH,
+	SORT_LEFT,
+	SORT_I,
+	SORT_J,
+	SORT_K,
+	SORT_STATE_SIZE
+};
 
-void Std_ArraySortQsort(VM* vm, Object** mem, int len, Object* comp)
+static void CallResumable(VM* vm, int id, int nargs, ResumeKind resume);
+
+static void StepArraySort(VM* vm)
 {
-	int idx = -1;
-	Object* arg = NULL;
+	Value* state = &vm->thread->stack[vm->thread->stackSize - SORT_STATE_SIZE];
 	
-	if(comp->type == OBJ_FUNC)
-		idx = comp->func.index;
-	else if(comp->type == OBJ_DICT)
-	{
-		Object* fobj = DictGet(&comp->dict, "CALL");
-		idx = fobj->func.index;
-		arg = comp;
-	}
-	else
-		ErrorExitVM(vm, "Expected either CALL overloaded dict or function in comparator argument to arraysort\n");
-
-	if(len > 1)
+	Object* comp = AS_OBJECT(state[SORT_COMP]);
+	Object* obj = AS_OBJECT(state[SORT_ARRAY]);
+	Object* tmp = AS_OBJECT(state[SORT_TEMP]);
+	int n = (int)AS_NUMBER(state[SORT_LENGTH]);
+	int width = (int)AS_NUMBER(state[SORT_WIDTH]);
+	int left = (int)AS_NUMBER(state[SORT_LEFT]);
+	int i = (int)AS_NUMBER(state[SORT_I]);
+	int j = (int)AS_NUMBER(state[SORT_J]);
+	int k = (int)AS_NUMBER(state[SORT_K]);
+	
+	if(obj->array.length != n)
+		ErrorExitVM(vm, "Array was resized while it was being sorted by arraysort\n");
+	
+	while(width < n)
 	{
-		Object* pivot = mem[(len / 2) - 1];
-		int left = 0;
-		int right = len - 1;
+		int mid = left + width < n ? left + width : n;
+		int right = left + 2 * width < n ? left + 2 * width : n;
 		
-		while(left <= right)
+		if(i < mid && j < right)
 		{
-			while(Std_ArraySortCmp(vm, mem[left], pivot, idx, arg) < 0)
-				left += 1;
-			while(Std_ArraySortCmp(vm, mem[right], pivot, idx, arg) > 0)
-				right -= 1;
-				
-			if(left <= right)
+			state[SORT_WIDTH] = NUMBER_VAL(width);
+			state[SORT_LEFT] = NUMBER_VAL(left);
+			state[SORT_I] = NUMBER_VAL(i);
+			state[SORT_J] = NUMBER_VAL(j);
+			state[SORT_K] = NUMBER_VAL(k);
+			
+			PushValue(vm, obj->array.members[j]);
+			PushValue(vm, obj->array.members[i]);
+			if(comp->type == OBJ_DICT)
 			{
-				Object* tmp = mem[left];
-				mem[left] = mem[right];
-				mem[right] = tmp;
-				
-				left += 1;
-				right -= 1;
+				PushObject(vm, comp);
+				CallResumable(vm, AS_OBJECT(*DictGetString(comp->dict, "CALL"))->func.index, 3, RESUME_ARRAYSORT);
 			}
+			else
+				CallResumable(vm, comp->func.index, 2, RESUME_ARRAYSORT);
+			return;
+		}
+		
+		while(i < mid)
+		{
+			WriteBarrier(vm, tmp, obj->array.members[i]);
+			tmp->array.members[k++] = obj->array.members[i++];
+		}
+		
+		while(j < right)
+		{
+			WriteBarrier(vm, tmp, obj->array.members[j]);
+			tmp->array.members[k++] = obj->array.members[j++];
+		}
+		
+		left += 2 * width;
+		if(left >= n)
+		{
+			RememberObject(vm, obj);
+			memcpy(obj->array.members, tmp->array.members, n * sizeof(Value));
+			
+			width *= 2;
+			left = 0;
 		}
 		
-		Std_ArraySortQsort(vm, mem, right + 1, comp);
-		Std_ArraySortQsort(vm, &mem[left], len - left, comp);
+		i = left;
+		j = left + width < n ? left + width : n;
+		k = left;
 	}
+	
+	vm->thread->stackSize -= SORT_STATE_SIZE;
+	vm->thread->retVal = NULL_VAL;
+}
+
+// Called once the comparator returns 'result'
+static void ResumeArraySort(VM* vm, Value result)
+{
+	if(!IS_NUMBER(result))
+		ErrorExitVM(vm, "Expected arraysort comparator to return a number but it returned a %s\n", ObjectTypeNames[GetValueType(result)]);
+	
+	Value* state = &vm->thread->stack[vm->thread->stackSize - SORT_STATE_SIZE];
+	
+	Object* obj = AS_OBJECT(state[SORT_ARRAY]);
+	Object* tmp = AS_OBJECT(state[SORT_TEMP]);
+	int k = (int)AS_NUMBER(state[SORT_K]);
+	
+	if(obj->array.length != (int)AS_NUMBER(state[SORT_LENGTH]))
+		ErrorExitVM(vm, "Array was resized while it was being sorted by arraysort\n");
+	
+	// NOTE: ties are taken from the left run so that the sort is stable
+	int index = SORT_I;
+	if((int)AS_NUMBER(result) > 0)
+		index = SORT_J;
+	
+	int from = (int)AS_NUMBER(state[index]);
+	WriteBarrier(vm, tmp, obj->array.members[from]);
+	tmp->array.members[k] = obj->array.members[from];
+	
+	state[index] = NUMBER_VAL(from + 1);
+	state[SORT_K] = NUMBER_VAL(k + 1);
+	
+	StepArraySort(vm);
 }
 
 void Std_ArraySort(VM* vm)
@@ -1237,14 +1589,36 @@ void Std_ArraySort(VM* vm)
 	Object* obj = PopArrayObject(vm);
 	Object* comp = PopObject(vm);
 	
-	Std_ArraySortQsort(vm, obj->array.members, obj->array.length, comp);
+	if(comp->type == OBJ_DICT)
+	{
+		Value* fval = DictGetString(comp->dict, "CALL");
+		if(!fval || GetValueType(*fval) != OBJ_FUNC)
+			ErrorExitVM(vm, "Expected either CALL overloaded dict or function in comparator argument to arraysort\n");
+	}
+	else if(comp->type != OBJ_FUNC)
+		ErrorExitVM(vm, "Expected either CALL overloaded dict or function in comparator argument to arraysort\n");
+	
+	int n = obj->array.length;
+	
+	PushObject(vm, comp);
+	PushObject(vm, obj);
+	PushArray(vm, n);
+	PushNumber(vm, n);
+	PushNumber(vm, 1);
+	PushNumber(vm, 0);
+	PushNumber(vm, 0);
+	PushNumber(vm, n < 1 ? n : 1);
+	PushNumber(vm, 0);
+	
+	StepArraySort(vm);
 }
 
 void Std_ArrayFill(VM* vm)
 {
 	Object* obj = PopArrayObject(vm);
-	Object* filler = PopObject(vm);
+	Value filler = PopValue(vm);
 	
+	WriteBarrier(vm, obj, filler);
 	for(int i = 0; i < obj->array.length; ++i)
 		obj->array.members[i] = filler;
 }
@@ -1389,21 +1763,21 @@ static void InitThread(VMThread* thread)
 	thread->pc = 0;
 	thread->fp = 0;
 	thread->numExpandedArgs = 0;
-	thread->retVal = NULL;
+	thread->retVal = NULL_VAL;
 	thread->parent = NULL;
-
-	memset(thread->stack, 0, sizeof(thread->stack));
+	thread->hasEnv = false;
 }
 
 void InitVM(VM* vm)
 {
-	NullObject.type = OBJ_NULL;
-
 	vm->inExternBody = MINT_FALSE;
 
 	vm->program = NULL;
 	vm->programLength = 0;
 	
+	vm->code = NULL;
+	vm->codeLength = 0;
+	
 	vm->entryPoint = 0;
 	
 	vm->numFunctions = 0;
@@ -1425,12 +1799,18 @@ void InitVM(VM* vm)
 	
 	vm->numStringConstants = 0;
 	vm->stringConstants = NULL;
+	vm->stringConstantObjects = NULL;
+
+	vm->numDictCaches = 0;
+	vm->dictCaches = NULL;
+
+	vm->numStructTypes = 0;
+	vm->structTypes = NULL;
 	
-	vm->gcHead = NULL;
-	vm->freeHead = NULL;
+	InitStringTable(&vm->strings);
+	InitHeap(&vm->heap);
 	
 	vm->numObjects = 0;
-	vm->maxObjectsUntilGc = INIT_GC_THRESH;
 	
 	vm->numGlobals = 0;
 	vm->globalNames = NULL;
@@ -1457,13 +1837,15 @@ VM* NewVM()
 	return vm;
 }
 
-static void FreeObject(VM* vm, Object* obj);
 void ResetVM(VM* vm)
 {
 	if(vm->thread) ErrorExitVM(vm, "Attempted to reset a running virtual machine\n");
 	
 	if(vm->program)
 		free(vm->program);
+	
+	if(vm->code)
+		free(vm->code);
 		
 	if(vm->functionHasEllipsis)
 		free(vm->functionHasEllipsis);
@@ -1489,6 +1871,20 @@ void ResetVM(VM* vm)
 		for(int i = 0; i < vm->numStringConstants; ++i)
 			free(vm->stringConstants[i]);
 		free(vm->stringConstants);
+		free(vm->stringConstantObjects);
+	}
+
+	if(vm->dictCaches)
+		free(vm->dictCaches);
+
+	if(vm->structTypes)
+	{
+		for(int i = 0; i < vm->numStructTypes; ++i)
+		{
+			free(vm->structTypes[i].name);
+			free(vm->structTypes[i].keys);
+		}
+		free(vm->structTypes);
 	}
 
 	if(vm->globalNames)
@@ -1511,33 +1907,8 @@ void ResetVM(VM* vm)
 	if (vm->globals)
 		free(vm->globals);
 
-	Object* obj = vm->freeHead;
-	Object* next = NULL;
-	
-	while(obj)
-	{
-		next = obj->next;
-		// No need to call FreeObject since the object data has already been free (it's in the free list after all)
-		if(obj != &NullObject &&
-		   obj != &TrueObject &&
-		   obj != &FalseObject) free(obj);
-		obj = next;
-	}
-
-	obj = vm->gcHead;
-	next = NULL;
-
-	while (obj)
-	{
-		next = obj->next;
-		
-		FreeObject(vm, obj);
-
-		if (obj != &NullObject &&
-			obj != &TrueObject &&
-			obj != &FalseObject) free(obj);
-		obj = next;
-	}
+	FreeHeap(vm);
+	FreeStringTable(&vm->strings);
 	
 	InitVM(vm);
 }
@@ -1567,62 +1938,317 @@ number constants as doubles
 
 number of string constants
 string length followed by string as chars
+
+number of dict access caches (the operand of OP_DICT_GET and OP_DICT_SET is an index into these) as integer
+string constant index of the key each cache is for as integers
+
+number of struct types (the first operand of OP_PUSH_STRUCT, OP_STRUCT_SET and OP_STRUCT_GET is an index into these) as integer
+for each one: name [string length followed by string as chars], number of fields as integer and the string constant index of each field's name as integers
 */
 
-void LoadBinaryFile(VM* vm, FILE* in)
-{
-	const char expectedMagic[] = VM_BIN_MAGIC;
-	char magic[5];
+// Operands of each instruction as they're laid out in the binary file, one
+// character per operand: 'b' is a Word and anything else is an int. When the
+// program is decoded, 'n', 's' and 'c' (indices of a number constant, string
+// constant and dict cache) and 'g' (a global) become pointers to what they
+// index, 'j' (a jump target) becomes a pc in the decoded code and 'f' (a
+// function) gets the function's pc put in front of it. 'e' (an extern), 't'
+// (a struct type) and 'm' (a field of the struct type before it) are only
+// checked, and 'i' is any other integer.
+#define REGISTER_ARITH_LAYOUTS(op) [OP_##op##_RR] = "ii", [OP_##op##_RK] = "in", [OP_##op##_RR_TO] = "iii", [OP_##op##_RK_TO] = "ini"
+#define REGISTER_REL_LAYOUTS(op) [OP_##op##_RR] = "ii", [OP_##op##_RK] = "in", [OP_##op##_RR_GOTOZ] = "iij", [OP_##op##_RK_GOTOZ] = "inj"
+
+static const char* OperandLayouts[NUM_OPCODES] =
+{
+	[OP_PUSH_NUMBER] = "n",
+	[OP_PUSH_STRING] = "s",
+	[OP_CREATE_ARRAY_BLOCK] = "i",
+	[OP_PUSH_FUNC] = "bbi",
+	[OP_DICT_SET] = "c",
+	[OP_DICT_GET] = "c",
+	[OP_PUSH_STRUCT] = "t",
+	[OP_STRUCT_SET] = "tm",
+	[OP_STRUCT_GET] = "tm",
+	[OP_ITER_NEXT] = "j",
+	[OP_SET] = "g",
+	[OP_GET] = "g",
+	[OP_GOTO] = "j",
+	[OP_GOTOZ] = "j",
+	[OP_CALL] = "bf",
+	[OP_CALLP] = "b",
+	[OP_CALLF] = "e",
+	[OP_GETLOCAL] = "i",
+	[OP_SETLOCAL] = "i",
+	[OP_SETVMDEBUG] = "b",
+	[OP_GETARGS] = "i",
+	[OP_FILE] = "s",
+	[OP_LINE] = "i",
+
+	REGISTER_ARITH_LAYOUTS(ADD),
+	REGISTER_ARITH_LAYOUTS(SUB),
+	REGISTER_ARITH_LAYOUTS(MUL),
+	REGISTER_ARITH_LAYOUTS(DIV),
+	REGISTER_REL_LAYOUTS(LT),
+	REGISTER_REL_LAYOUTS(LTE),
+	REGISTER_REL_LAYOUTS(GT),
+	REGISTER_REL_LAYOUTS(GTE),
+	[OP_MOVE_R] = "ii",
+	[OP_MOVE_K] = "ni",
+	[OP_GETINDEX_RR] = "ii"
+};
 
-	fread(magic, 1, sizeof(expectedMagic) - 1, in);
-	magic[4] = '\0';
+#undef REGISTER_ARITH_LAYOUTS
+#undef REGISTER_REL_LAYOUTS
 
-	if (strcmp(magic, expectedMagic) != 0)
-		ErrorExitVM(vm, "Invalid binary file.\n");
-	
-	int entryPoint;
-	fread(&entryPoint, sizeof(int), 1, in);
+// Returns the size of the instruction at pc in the binary file (or 0 if it
+// isn't a valid instruction) and puts its size once it's decoded in decodedSize
+static int GetInstructionSize(VM* vm, int pc, int* decodedSize)
+{
+	Word op = vm->program[pc];
+	if(op >= NUM_OPCODES)
+		return 0;
 	
-	vm->entryPoint = entryPoint;
+	const char* layout = OperandLayouts[op] ? OperandLayouts[op] : "";
 	
-	int programLength;
-	fread(&programLength, sizeof(int), 1, in);
+	int size = 1;
+	*decodedSize = 1;
 	
-	if (programLength > 0)
+	for(const char* c = layout; *c; ++c)
 	{
-		vm->program = emalloc(sizeof(Word) * programLength);
-		vm->programLength = programLength;
-
-		fread(vm->program, sizeof(Word), programLength, in);
+		size += *c == 'b' ? 1 : sizeof(int);
+		*decodedSize += *c == 'f' ? 2 : 1;
 	}
+	
+	return pc + size <= vm->programLength ? size : 0;
+}
 
-	int numGlobals;
-	fread(&numGlobals, sizeof(int), 1, in);
+int GetDecodedPc(VM* vm, int pc)
+{
+	int decodedPc = 0;
 	
-	if (numGlobals > 0)
+	for(int i = 0; i < vm->programLength;)
 	{
-		vm->globals = emalloc(sizeof(Object*) * numGlobals);
-		memset(vm->globals, 0, sizeof(Object*) * numGlobals);
-
-		vm->globalNames = emalloc(sizeof(char*) * numGlobals);
-
-		for (int i = 0; i < numGlobals; ++i)
+		if(i == pc)
+			return decodedPc;
+		
+		int decodedSize;
+		int size = GetInstructionSize(vm, i, &decodedSize);
+		if(!size)
+			break;
+		
+		i += size;
+		decodedPc += decodedSize;
+	}
+	
+	return -1;
+}
+
+// Translates vm->program into vm->code (see Instr); the constants, caches and
+// struct types have to be loaded already since operands are checked against them
+static void DecodeProgram(VM* vm, int version)
+{
+	// NOTE: the opcodes of older versions don't mean the same thing, so they can't
+	// be decoded as if they were the current ones
+	if(version < VM_BIN_VERSION)
+		ErrorExitVM(vm, "Invalid binary file.\n");
+	
+	// decoded pc of every instruction in the binary file (-1 in between them)
+	int* pcs = emalloc(sizeof(int) * (vm->programLength + 1));
+	int codeLength = 0;
+	
+	for(int i = 0; i <= vm->programLength; ++i)
+		pcs[i] = -1;
+	
+	for(int i = 0; i < vm->programLength;)
+	{
+		int decodedSize;
+		int size = GetInstructionSize(vm, i, &decodedSize);
+		if(!size)
+			ErrorExitVM(vm, "Invalid binary file.\n");
+		
+		pcs[i] = codeLength;
+		i += size;
+		codeLength += decodedSize;
+	}
+	
+	pcs[vm->programLength] = codeLength;
+	
+	if(vm->entryPoint < 0 || vm->entryPoint > vm->programLength || pcs[vm->entryPoint] < 0)
+		ErrorExitVM(vm, "Invalid binary file.\n");
+	vm->entryPoint = pcs[vm->entryPoint];
+	
+	for(int i = 0; i < vm->numFunctions; ++i)
+	{
+		if(vm->functionPcs[i] < 0 || vm->functionPcs[i] > vm->programLength || pcs[vm->functionPcs[i]] < 0)
+			ErrorExitVM(vm, "Invalid binary file.\n");
+		vm->functionPcs[i] = pcs[vm->functionPcs[i]];
+	}
+	
+	vm->code = emalloc(sizeof(Instr) * (codeLength > 0 ? codeLength : 1));
+	vm->codeLength = codeLength;
+	
+	Instr* code = vm->code;
+	
+	for(int i = 0; i < vm->programLength;)
+	{
+		Word op = vm->program[i++];
+		const char* layout = OperandLayouts[op] ? OperandLayouts[op] : "";
+		int typeIndex = 0;
+		
+		(code++)->i = op;
+		
+		for(const char* c = layout; *c; ++c)
 		{
-			int len;
-			fread(&len, sizeof(int), 1, in);
-			char* string = emalloc(len + 1);
-			fread(string, sizeof(char), len, in);
-			string[len] = '\0';
-			vm->globalNames[i] = string;
+			if(*c == 'b')
+			{
+				(code++)->i = vm->program[i++];
+				continue;
+			}
+			
+			int value;
+			memcpy(&value, &vm->program[i], sizeof(int));
+			i += sizeof(int);
+			
+			int max = INT_MAX;
+			switch(*c)
+			{
+				case 'n': max = vm->numNumberConstants; break;
+				case 's': max = vm->numStringConstants; break;
+				case 'c': max = vm->numDictCaches; break;
+				case 'g': max = vm->numGlobals; break;
+				case 'f': max = vm->numFunctions; break;
+				case 'e': max = vm->numExterns; break;
+				case 't': max = vm->numStructTypes; break;
+				case 'm': max = vm->structTypes[typeIndex].numFields; break;
+				case 'j': max = vm->programLength + 1; break;
+			}
+			
+			if(*c != 'i' && (value < 0 || value >= max))
+				ErrorExitVM(vm, "Invalid binary file.\n");
+			
+			switch(*c)
+			{
+				case 'n': code->value = NUMBER_VAL(vm->numberConstants[value]); break;
+				case 's': code->obj = vm->stringConstantObjects[value]; break;
+				case 'c': code->cache = &vm->dictCaches[value]; break;
+				case 'g': code->global = &vm->globals[value]; break;
+				
+				case 'f':
+				{
+					(code++)->i = vm->functionPcs[value];
+					code->i = value;
+				} break;
+				
+				case 'j':
+				{
+					if(pcs[value] < 0)
+						ErrorExitVM(vm, "Invalid binary file.\n");
+					code->i = pcs[value];
+				} break;
+				
+				case 't': typeIndex = value; // fallthrough
+				default: code->i = value; break;
+			}
+			
+			++code;
 		}
 	}
+	
+	free(pcs);
+}
+
+// Reads count items into dest; a file which ends early isn't a valid binary
+static void ReadBinary(VM* vm, void* dest, size_t size, int count, FILE* in)
+{
+	if(count > 0 && fread(dest, size, count, in) != (size_t)count)
+		ErrorExitVM(vm, "Invalid binary file.\n");
+}
+
+// Reads a count or a length (of a table or a string) from a binary file; every
+// item takes up at least a byte, so it can't be more than what's left of the file
+static int ReadBinaryLength(VM* vm, FILE* in, long fileSize)
+{
+	int length;
+	ReadBinary(vm, &length, sizeof(int), 1, in);
+	
+	if(length < 0 || (fileSize >= 0 && length > fileSize - ftell(in)))
+		ErrorExitVM(vm, "Invalid binary file.\n");
+	return length;
+}
+
+// Reads a string which is stored as its length followed by its characters
+static char* ReadBinaryString(VM* vm, FILE* in, long fileSize, int* length)
+{
+	int len = ReadBinaryLength(vm, in, fileSize);
+	char* string = emalloc(len + 1);
+	
+	ReadBinary(vm, string, sizeof(char), len, in);
+	string[len] = '\0';
+	
+	if(length)
+		*length = len;
+	return string;
+}
+
+void LoadBinaryFile(VM* vm, FILE* in)
+{
+	// NOTE: this is -1 if the file can't be seeked (the lengths aren't checked against it then)
+	long fileSize = -1;
+	long start = ftell(in);
+	if(start >= 0 && fseek(in, 0, SEEK_END) == 0)
+	{
+		fileSize = ftell(in);
+		fseek(in, start, SEEK_SET);
+	}
+	
+	const char expectedMagic[] = VM_BIN_MAGIC;
+	char magic[5];
+
+	ReadBinary(vm, magic, 1, sizeof(expectedMagic) - 1, in);
+	magic[4] = '\0';
+
+	if (strcmp(magic, expectedMagic) != 0)
+		ErrorExitVM(vm, "Invalid binary file.\n");
+	
+	int version;
+	ReadBinary(vm, &version, sizeof(int), 1, in);
+	
+	if(version > VM_BIN_VERSION)
+		ErrorExitVM(vm, "Invalid binary file.\n");
+	
+	int entryPoint;
+	ReadBinary(vm, &entryPoint, sizeof(int), 1, in);
+	
+	vm->entryPoint = entryPoint;
+	
+	int programLength = ReadBinaryLength(vm, in, fileSize);
+	
+	if (programLength > 0)
+	{
+		vm->program = emalloc(sizeof(Word) * programLength);
+		vm->programLength = programLength;
+
+		ReadBinary(vm, vm->program, sizeof(Word), programLength, in);
+	}
+
+	int numGlobals = ReadBinaryLength(vm, in, fileSize);
+	
+	if (numGlobals > 0)
+	{
+		vm->globals = emalloc(sizeof(Value) * numGlobals);
+		for (int i = 0; i < numGlobals; ++i)
+			vm->globals[i] = NULL_VAL;
+
+		vm->globalNames = emalloc(sizeof(char*) * numGlobals);
+
+		for (int i = 0; i < numGlobals; ++i)
+			vm->globalNames[i] = ReadBinaryString(vm, in, fileSize, NULL);
+	}
 
 	vm->numGlobals = numGlobals;
-	vm->maxObjectsUntilGc += numGlobals;
 		
 	int numFunctions, numNumberConstants, numStringConstants;
 	
-	fread(&numFunctions, sizeof(int), 1, in);
+	numFunctions = ReadBinaryLength(vm, in, fileSize);
 	vm->numFunctions = numFunctions;
 	
 	if(numFunctions > 0)
@@ -1631,72 +2257,106 @@ void LoadBinaryFile(VM* vm, FILE* in)
 		vm->functionHasEllipsis = emalloc(sizeof(char) * numFunctions);
 		vm->functionNumArgs = emalloc(sizeof(Word) * numFunctions);
 		vm->functionPcs = emalloc(sizeof(int) * numFunctions);
-		fread(vm->functionPcs, sizeof(int), numFunctions, in);
-		fread(vm->functionHasEllipsis, sizeof(char), numFunctions, in);
-		fread(vm->functionNumArgs, sizeof(Word), numFunctions, in);
+
+		ReadBinary(vm, vm->functionPcs, sizeof(int), numFunctions, in);
+		ReadBinary(vm, vm->functionHasEllipsis, sizeof(char), numFunctions, in);
+		ReadBinary(vm, vm->functionNumArgs, sizeof(Word), numFunctions, in);
 	}
 	
 	for(int i = 0; i < numFunctions; ++i)
-	{
-		int len;
-		fread(&len, sizeof(int), 1, in);
-		char* string = emalloc(len + 1);
-		fread(string, sizeof(char), len, in);
-		string[len] = '\0';
-		vm->functionNames[i] = string;
-	}
-	
-	int numExterns;
-	fread(&numExterns, sizeof(int), 1, in);
+		vm->functionNames[i] = ReadBinaryString(vm, in, fileSize, NULL);
 	
-	vm->numExterns = numExterns;
+	int numExterns = ReadBinaryLength(vm, in, fileSize);
 	
 	if(numExterns > 0)
 	{
 		vm->externNames = emalloc(sizeof(char*) * numExterns);
-		vm->externs = emalloc(sizeof(ExternFunction) * numExterns);
+		vm->externs = ecalloc(sizeof(ExternFunction), numExterns);
 	}
 	
+	vm->numExterns = numExterns;
+	
 	for(int i = 0; i < vm->numExterns; ++i)
-	{
-		int nameLength;
-		fread(&nameLength, sizeof(int), 1, in);
-		
-		char* name = emalloc(sizeof(char) * (nameLength + 1));
-		fread(name, sizeof(char), nameLength, in);
-		
-		name[nameLength] = '\0';
-		vm->externNames[i] = name;
-		vm->externs[i] = NULL;
-	}
+		vm->externNames[i] = ReadBinaryString(vm, in, fileSize, NULL);
 	
-	fread(&numNumberConstants, sizeof(int), 1, in);
-	vm->numNumberConstants = numNumberConstants;
+	numNumberConstants = ReadBinaryLength(vm, in, fileSize);
 	
 	if(numNumberConstants > 0)
 	{
 		vm->numberConstants = emalloc(sizeof(double) * numNumberConstants);
-		fread(vm->numberConstants, sizeof(double), numNumberConstants, in);
+		ReadBinary(vm, vm->numberConstants, sizeof(double), numNumberConstants, in);
 	}
 	
-	fread(&numStringConstants, sizeof(int), 1, in);
-	vm->numStringConstants = numStringConstants;
+	vm->numNumberConstants = numNumberConstants;
+	
+	numStringConstants = ReadBinaryLength(vm, in, fileSize);
 	
 	if(numStringConstants > 0)
+	{
 		vm->stringConstants = emalloc(sizeof(char*) * numStringConstants);
+		// NOTE: this is filled in as the constants are read, and the gc
+		// might run in between (it skips the NULL entries)
+		vm->stringConstantObjects = ecalloc(sizeof(Object*), numStringConstants);
+	}
+	
+	vm->numStringConstants = numStringConstants;
 	
 	for(int i = 0; i < numStringConstants; ++i)
 	{
 		int stringLength;
-		fread(&stringLength, sizeof(int), 1, in);
-		
-		char* string = emalloc(sizeof(char) * (stringLength + 1));
-		fread(string, sizeof(char), stringLength, in);
-		
-		string[stringLength] = '\0';
+		char* string = ReadBinaryString(vm, in, fileSize, &stringLength);
 		
 		vm->stringConstants[i] = string;
+		vm->stringConstantObjects[i] = InternString(vm, string, stringLength);
+	}
+
+	int numDictCaches = ReadBinaryLength(vm, in, fileSize);
+	vm->numDictCaches = numDictCaches;
+
+	// NOTE: zeroed caches are empty
+	if(numDictCaches > 0)
+		vm->dictCaches = ecalloc(sizeof(DictCache), numDictCaches);
+
+	for(int i = 0; i < numDictCaches; ++i)
+	{
+		int key;
+		ReadBinary(vm, &key, sizeof(int), 1, in);
+
+		if(key < 0 || key >= numStringConstants)
+			ErrorExitVM(vm, "Invalid binary file.\n");
+		vm->dictCaches[i].key = vm->stringConstantObjects[key];
+	}
+
+	int numStructTypes = ReadBinaryLength(vm, in, fileSize);
+
+	if(numStructTypes > 0)
+		vm->structTypes = ecalloc(sizeof(StructType), numStructTypes);
+
+	for(int i = 0; i < numStructTypes; ++i)
+	{
+		StructType* type = &vm->structTypes[i];
+		// NOTE: counted as it's filled in so ResetVM frees what was read
+		vm->numStructTypes = i + 1;
+
+		type->name = ReadBinaryString(vm, in, fileSize, NULL);
+
+		type->numFields = ReadBinaryLength(vm, in, fileSize);
+		if(type->numFields == 0)
+			ErrorExitVM(vm, "Invalid binary file.\n");
+
+		type->keys = emalloc(sizeof(Object*) * type->numFields);
+		for(int j = 0; j < type->numFields; ++j)
+		{
+			int key;
+			ReadBinary(vm, &key, sizeof(int), 1, in);
+
+			if(key < 0 || key >= numStringConstants)
+				ErrorExitVM(vm, "Invalid binary file.\n");
+			type->keys[j] = vm->stringConstantObjects[key];
+		}
 	}
+
+	DecodeProgram(vm, version);
 }
 
 void HookStandardLibrary(VM* vm)
@@ -1709,6 +2369,10 @@ void HookStandardLibrary(VM* vm)
 	HookExternNoWarn(vm, "atan2", Std_Atan2);
 	HookExternNoWarn(vm, "printf", Std_Printf);
 	HookExternNoWarn(vm, "strcat", Std_Strcat);
+	HookExternNoWarn(vm, "strbuilder", Std_StringBuilder);
+	HookExternNoWarn(vm, "strbuilder_append", Std_StringBuilderAppend);
+	HookExternNoWarn(vm, "strbuilder_tostring", Std_StringBuilderToString);
+	HookExternNoWarn(vm, "strbuilder_clear", Std_StringBuilderClear);
 	HookExternNoWarn(vm, "tonumber", Std_Tonumber);
 	HookExternNoWarn(vm, "tostring", Std_Tostring);
 	HookExternNoWarn(vm, "typeof", Std_Typeof);
@@ -1734,6 +2398,13 @@ void HookStandardLibrary(VM* vm)
 	HookExternNoWarn(vm, "getnumargs", Std_GetNumArgs);
 	HookExternNoWarn(vm, "hasellipsis", Std_HasEllipsis);
 	HookExternNoWarn(vm, "stringhash", Std_StringHash);
+	HookExternNoWarn(vm, "gcstats", Std_GcStats);
+	HookExternNoWarn(vm, "heapsnapshot", Std_HeapSnapshot);
+	HookExternNoWarn(vm, "weakref", Std_WeakRef);
+	HookExternNoWarn(vm, "weakget", Std_WeakGet);
+	HookExternNoWarn(vm, "weakdict", Std_WeakDict);
+	HookExternNoWarn(vm, "map", Std_Map);
+	HookExternNoWarn(vm, "weakmap", Std_WeakMap);
 	HookExternNoWarn(vm, "number_to_bytes", Std_NumberToBytes);
 	HookExternNoWarn(vm, "bytes_to_number", Std_BytesToNumber);
 	
@@ -1828,253 +2499,276 @@ int GetFunctionId(VM* vm, const char* name)
 	return -1;
 }
 
-void MarkObject(VM* vm, Object* obj)
+void PushValue(VM* vm, Value value)
 {
-	if(!obj)
-	{
-		fprintf(stderr, "Attempted to mark null object\n");
-		return;
-	}
-	
-	if(obj == &NullObject) return;
-	if(obj->marked) return;
-	
-	obj->marked = MINT_TRUE;
-	
-	if(vm->debug)
-		printf("marking %s\n", ObjectTypeNames[obj->type]); 
-	
-	if(obj->type == OBJ_NATIVE)
-	{
-		if(obj->native.onMark)
-			obj->native.onMark(obj->native.value);
-	}
-	else if(obj->type == OBJ_ARRAY)
-	{
-		for(int i = 0; i < obj->array.length; ++i)
-		{
-			Object* mem = obj->array.members[i];
-			if(mem)
-				MarkObject(vm, mem);
-		}
-	}
-	else if(obj->type == OBJ_DICT)
-	{
-		for(int i = 0; i < obj->dict.capacity; ++i)
-		{	
-			DictNode* node = obj->dict.buckets[i];
-			
-			while(node)
-			{
-				if(node->value)
-					MarkObject(vm, node->value);
-				node = node->next;
-			}
-		}
-
-		if(obj->meta)
-			MarkObject(vm, obj->meta);
-	}
-	else if (obj->type == OBJ_THREAD)
-	{
-        // If the thread has an env (was created using a lambda or something)
-        // then make sure that the environment stays alive
-		if(obj->thread && obj->thread->hasEnv)
-			MarkObject(vm, obj->thread->stack[0]);
-	}
+	if(vm->thread->stackSize == MAX_STACK) ErrorExitVM(vm, "Stack overflow!\n");
+	vm->thread->stack[vm->thread->stackSize++] = value;
 }
 
-void MarkAll(VM* vm)
+void PushObject(VM* vm, Object* obj)
 {
-	for (int i = 0; i < vm->numGlobals; ++i)
-		MarkObject(vm, vm->globals[i]);
-
-	VMThread* current = vm->thread;
+	assert(obj);
+	PushValue(vm, OBJECT_VAL(obj));
+}
 
-	while (current)
-	{
-		for (int i = 0; i < current->stackSize; ++i)
-		{
-			Object* reachable = current->stack[i];
-			MarkObject(vm, reachable);
-		}
+void PushBool(VM* vm, char value)
+{
+	PushValue(vm, BOOL_VAL(value));
+}
 
-		current = current->parent;
-	}
+Value PopValue(VM* vm)
+{
+	if(vm->thread->stackSize <= 0) ErrorExitVM(vm, "Stack underflow!\n");
+	return vm->thread->stack[--vm->thread->stackSize];
 }
 
-static void FreeObject(VM* vm, Object* obj)
+Object* PopObject(VM* vm)
 {
-	assert(obj);
+	Value val = PopValue(vm);
+	if(!IS_OBJECT(val)) ErrorExitVM(vm, "Expected object but received %s\n", ObjectTypeNames[GetValueType(val)]);
+	return AS_OBJECT(val);
+}
 
-	if(obj->type == OBJ_STRING)
-		free(obj->string.raw);
-	else if(obj->type == OBJ_NATIVE)
-	{
-		if(obj->native.onFree)
-			obj->native.onFree(obj->native.value);
-	}
-	else if (obj->type == OBJ_ARRAY)
-	{
-		free(obj->array.members);
-		obj->array.capacity = 0;
-		obj->array.length = 0;
-	}
-	else if(obj->type == OBJ_DICT)
-	{
-		/*Object* onGc = DictGet(&obj->dict, "DISPOSED");
-		if(onGc)
-		{
-			if(onGc->type == OBJ_FUNC)
-			{
-				if(onGc->func.isExtern)
-					ErrorExitVM(vm, "Dict has invalid DISPOSED callback (it is an extern)\n");
-				else
-				{
-					PushObject(vm, obj);
-					CallFunction(vm, onGc->func.index, 1);
-				}
-			}
-			else if(onGc->type == OBJ_DICT)
-			{
-				Object* cb = DictGet(&onGc->dict, "CALL");
-				if(cb->type != OBJ_FUNC)
-					ErrorExitVM(vm, "Dict has invalid CALL overload (%s instead of a func)\n", ObjectTypeNames[cb->type]);
-				
-				if(cb->func.isExtern)
-					ErrorExitVM(vm, "Dict has invalid DISPOSED callback (it calls an extern)\n");
-				else
-				{
-					PushObject(vm, onGc);
-					PushObject(vm, obj);
-					CallFunction(vm, cb->func.index, 2);
-				}
-			}
-		}*/
-		
-		FreeDict(&obj->dict);
-	}
+char PopBool(VM* vm)
+{
+	Value val = PopValue(vm);
+	if (!IS_BOOL(val)) ErrorExitVM(vm, "Expected bool but received %s\n", ObjectTypeNames[GetValueType(val)]);
+	return AS_BOOL(val);
 }
 
-static void Sweep(VM* vm)
+void PushNumber(VM* vm, double value)
 {
-	Object** obj = &vm->gcHead;
-	while(*obj)
-	{
-		if(!(*obj)->marked)
-		{
-			Object* unreached = *obj;
-			*(obj) = unreached->next;
-			FreeObject(vm, unreached);
-			
-			unreached->next = vm->freeHead;
-			vm->freeHead = unreached;
-			
-			--vm->numObjects;
-		}
-		else 
-		{
-			(*obj)->marked = MINT_FALSE;
-			obj = &(*obj)->next;
-		}
-	}
+	PushValue(vm, NUMBER_VAL(value));
 }
 
-void CollectGarbage(VM* vm)
+// Creates a string object which takes ownership of raw (which has to be a
+// malloc'd, null terminated string of the given length)
+static Object* NewString(VM* vm, char* raw, int length, uint32_t hash)
 {
-	if(vm->debug)
-		printf("collecting garbage...\n");
-	int numObjects = vm->numObjects;
-	MarkAll(vm);
-	if(vm->debug)
-		printf("marked all objects\n");
-	Sweep(vm);
-	if(vm->debug)
-		printf("cleaned objects\n");
-	vm->maxObjectsUntilGc = vm->numObjects * 2 + vm->numGlobals;
+	Object* obj = NewObject(vm, OBJ_STRING);
+	
+	obj->string.raw = raw;
+	obj->string.length = length;
+	obj->string.hash = hash;
+	SetExternalSize(vm, obj, length + 1);
+	
+	return obj;
+}
 
-	if(vm->debug)
+// Like NewString but short strings are interned (in which case raw may be freed)
+static Object* NewStringAdopt(VM* vm, char* raw, int length)
+{
+	if(length <= MAX_SHORT_STRING_LENGTH)
 	{
-		printf("objects before collection: %i\n"
-			   "objects after collection: %i\n", numObjects, vm->numObjects);
+		Object* obj = InternString(vm, raw, length);
+		free(raw);
+		return obj;
 	}
+
+	return NewString(vm, raw, length, SuperFastHash(raw, length));
 }
 
-Object* NewObject(VM* vm, ObjectType type)
+Object* InternString(VM* vm, const char* string, int length)
 {
-	if(!vm->inExternBody && vm->numObjects >= vm->maxObjectsUntilGc) 
-		CollectGarbage(vm);
-
-	if(vm->debug)
-		printf("creating object: %s\n", ObjectTypeNames[type]);
+	uint32_t hash = SuperFastHash(string, length);
+	Object* obj = StringTableFind(&vm->strings, string, length, hash);
 	
-	Object* obj;
-	if (!vm->freeHead)
-		obj = ecalloc(sizeof(Object), 1);
-	else
+	if(obj)
 	{
-		obj = vm->freeHead;
-		vm->freeHead = obj->next;
+		ReadBarrier(vm, obj);
+		return obj;
 	}
 	
-	obj->type = type;
-
-	obj->next = vm->gcHead;
-	vm->gcHead = obj;
+	char* raw = emalloc(length + 1);
+	memcpy(raw, string, length);
+	raw[length] = '\0';
 	
-	++vm->numObjects;
+	obj = NewString(vm, raw, length, hash);
+	obj->string.interned = MINT_TRUE;
+	StringTableAdd(&vm->strings, obj);
 	
 	return obj;
 }
 
-void PushObject(VM* vm, Object* obj)
+Object* InternStringObject(VM* vm, Object* obj)
 {
-	assert(obj);
-	if(vm->thread->stackSize == MAX_STACK) ErrorExitVM(vm, "Stack overflow!\n");
-	vm->thread->stack[vm->thread->stackSize++] = obj;
+	if(obj->string.interned) return obj;
+	
+	GetStringChars(obj);
+	Object* interned = StringTableFind(&vm->strings, obj->string.raw, obj->string.length, obj->string.hash);
+	if(interned)
+	{
+		ReadBarrier(vm, interned);
+		return interned;
+	}
+	
+	obj->string.interned = MINT_TRUE;
+	StringTableAdd(&vm->strings, obj);
+	
+	return obj;
 }
 
-void PushBool(VM* vm, char value)
+// Stores a value under a key which might not be in the dict yet
+static void PutDictValue(VM* vm, Object* obj, Object* key, Value value)
 {
-	if (value) PushObject(vm, &TrueObject);
-	else PushObject(vm, &FalseObject);
+	key = InternStringObject(vm, key);
+	
+	WriteBarrier(vm, obj, OBJECT_VAL(key));
+	WriteBarrier(vm, obj, value);
+	DictPut(obj->dict, key, value);
+	
+	SetExternalSize(vm, obj, sizeof(Dict) + DictMemory(obj->dict));
 }
 
-Object* PopObject(VM* vm)
+// Looks up the key of the cache in the dict; the indices cached for the
+// instruction are checked first (and the index the key is found at is added)
+static inline Value* GetCachedDictValue(DictCache* cache, Dict* dict)
 {
-	if(vm->thread->stackSize <= 0) ErrorExitVM(vm, "Stack underflow!\n");
-	return vm->thread->stack[--vm->thread->stackSize];
-}
+	Object* key = cache->key;
 
-char PopBool(VM* vm)
-{
-	Object* obj = PopObject(vm);
-	if (obj->type != OBJ_BOOL) ErrorExitVM(vm, "Expected bool but received %s\n", ObjectTypeNames[obj->type]);
-	return obj->boolean;
+	for(int i = 0; i < cache->numIndices; ++i)
+	{
+		int index = cache->indices[i];
+		if(index < GetDictEntryCount(dict) && LocateDictEntry(dict, index)->key == key)
+			return &LocateDictEntry(dict, index)->value;
+	}
+
+	// the instruction sees too many different layouts for caching to pay off
+	if(cache->numIndices < 0)
+		return DictGet(dict, key);
+
+	int index;
+	Value* val = DictGetIndexed(dict, key, &index);
+
+	if(index >= 0)
+	{
+		if(cache->numIndices < DICT_CACHE_SIZE)
+			cache->indices[cache->numIndices++] = index;
+		else
+			cache->numIndices = -1;
+	}
+
+	return val;
 }
 
-void PushNumber(VM* vm, double value)
+const char* FlattenRope(Object* obj)
 {
-	Object* obj = NewObject(vm, OBJ_NUMBER);
-	obj->number = value;
-	PushObject(vm, obj);
+	int length = obj->string.length;
+	char* raw = emalloc(length + 1);
+	raw[length] = '\0';
+	
+	// NOTE: the pieces are copied from the back without recursing since
+	// ropes built up in a loop can be very deep
+	Object* stackBuf[64];
+	Object** stack = stackBuf;
+	int stackSize = 0;
+	int stackCapacity = 64;
+	
+	stack[stackSize++] = obj;
+	int pos = length;
+	
+	while(stackSize > 0)
+	{
+		Object* node = stack[--stackSize];
+		
+		if(!node->string.isRope)
+		{
+			pos -= node->string.length;
+			memcpy(raw + pos, node->string.raw, node->string.length);
+			continue;
+		}
+		
+		if(stackSize + 2 > stackCapacity)
+		{
+			stackCapacity *= 2;
+			if(stack == stackBuf)
+			{
+				stack = emalloc(sizeof(Object*) * stackCapacity);
+				memcpy(stack, stackBuf, sizeof(stackBuf));
+			}
+			else
+				stack = erealloc(stack, sizeof(Object*) * stackCapacity);
+		}
+		
+		stack[stackSize++] = node->string.left;
+		stack[stackSize++] = node->string.right;
+	}
+	
+	if(stack != stackBuf)
+		free(stack);
+	
+	obj->string.isRope = MINT_FALSE;
+	obj->string.raw = raw;
+	obj->string.hash = SuperFastHash(raw, length);
+	
+	// NOTE: a rope only takes up its slot until now (the pieces are counted by themselves)
+	SetObjectExternalSize(obj, length + 1);
+	
+	return raw;
 }
 
-void PushString(VM* vm, const char* string)
+static Object* ConcatStrings(VM* vm, Object* a, Object* b)
 {
+	int length = a->string.length + b->string.length;
+	
+	if(a->string.length == 0) return b;
+	if(b->string.length == 0) return a;
+	
+	if(length < MIN_ROPE_LENGTH)
+	{
+		char* raw = emalloc(length + 1);
+		
+		memcpy(raw, GetStringChars(a), a->string.length);
+		memcpy(raw + a->string.length, GetStringChars(b), b->string.length + 1);
+		
+		return NewStringAdopt(vm, raw, length);
+	}
+	
+	// keep the pieces alive in case allocating the rope triggers a collection
+	PushObject(vm, a);
+	PushObject(vm, b);
 	Object* obj = NewObject(vm, OBJ_STRING);
+	vm->thread->stackSize -= 2;
 	
-	obj->string.raw = estrdup(string);
+	obj->string.length = length;
+	WriteBarrier(vm, obj, OBJECT_VAL(a));
+	WriteBarrier(vm, obj, OBJECT_VAL(b));
+	obj->string.isRope = MINT_TRUE;
+	obj->string.left = a;
+	obj->string.right = b;
 	
-	PushObject(vm, obj);
+	return obj;
+}
+
+void PushString(VM* vm, const char* string)
+{
+	int length = (int)strlen(string);
+	
+	if(length <= MAX_SHORT_STRING_LENGTH)
+	{
+		PushObject(vm, InternString(vm, string, length));
+		return;
+	}
+	
+	char* raw = emalloc(length + 1);
+	memcpy(raw, string, length + 1);
+	
+	PushObject(vm, NewString(vm, raw, length, SuperFastHash(raw, length)));
 }
 
 Object* PushFunc(VM* vm, int id, Word isExtern, Object* env)
 {
+	// keep the env alive in case allocating the function triggers a collection
+	if(env)
+		PushObject(vm, env);
 	Object* obj = NewObject(vm, OBJ_FUNC);
+	if(env)
+		--vm->thread->stackSize;
 	
 	obj->func.index = id;
 	obj->func.isExtern = isExtern;
+	if(env)
+		WriteBarrier(vm, obj, OBJECT_VAL(env));
 	obj->func.env = env;
 	
 	PushObject(vm, obj);
@@ -2091,8 +2785,12 @@ Object* PushArray(VM* vm, int length)
 	else
 		obj->array.capacity = length;
 	
-	obj->array.members = ecalloc(sizeof(Object*), obj->array.capacity);
+	obj->array.members = emalloc(sizeof(Value) * obj->array.capacity);
 	obj->array.length = length;
+	SetExternalSize(vm, obj, sizeof(Value) * obj->array.capacity);
+
+	for(int i = 0; i < length; ++i)
+		obj->array.members[i] = NULL_VAL;
 	
 	PushObject(vm, obj);
 	return obj;
@@ -2102,25 +2800,32 @@ Object* PushDict(VM* vm)
 {
 	Object* obj = NewObject(vm, OBJ_DICT);
 	obj->meta = NULL;
-	InitDict(&obj->dict);
+	obj->dict = emalloc(sizeof(Dict));
+	InitDict(obj->dict);
+	SetExternalSize(vm, obj, sizeof(Dict));
 	PushObject(vm, obj);
 	return obj;
 }
 
-void PushNative(VM* vm, void* value, void (*onFree)(void*), void (*onMark)(void*))
+Object* PushNative(VM* vm, void* value, void (*onFree)(void*), void (*onMark)(void*))
 {
 	Object* obj = NewObject(vm, OBJ_NATIVE);
 	obj->native.value = value;
 	obj->native.onFree = onFree;
 	obj->native.onMark = onMark;
 	PushObject(vm, obj);
+	return obj;
 }
 
 void PushThread(VM* vm, Object* funcObj)
 {
+	// keep the function (and its env) alive in case allocating the thread triggers a collection
+	PushObject(vm, funcObj);
 	Object* obj = NewObject(vm, OBJ_THREAD);
+	--vm->thread->stackSize;
 
 	VMThread* thread = obj->thread = emalloc(sizeof(VMThread));
+	SetExternalSize(vm, obj, sizeof(VMThread));
 
 	InitThread(thread);
 
@@ -2132,49 +2837,158 @@ void PushThread(VM* vm, Object* funcObj)
         thread->hasEnv = true;
 		thread->fp = 1;
 		thread->stackSize = 1;
-		thread->stack[0] = funcObj->func.env;
+		thread->stack[0] = OBJECT_VAL(funcObj->func.env);
 	}
 
 	PushObject(vm, obj);
 }
 
+Object* PushWeakDict(VM* vm, char weakMode)
+{
+	Object* obj = PushDict(vm);
+	obj->weakMode = weakMode;
+	RegisterWeakObject(vm, obj);
+	return obj;
+}
+
+Object* PushWeak(VM* vm, Object* target)
+{
+	// keep the target alive in case allocating the reference triggers a collection
+	PushObject(vm, target);
+	Object* obj = NewObject(vm, OBJ_WEAK);
+	--vm->thread->stackSize;
+
+	obj->weak = target;
+	PushObject(vm, obj);
+	return obj;
+}
+
+Object* PushMap(VM* vm)
+{
+	Object* obj = NewObject(vm, OBJ_MAP);
+	obj->map = emalloc(sizeof(Map));
+	InitMap(obj->map);
+	SetExternalSize(vm, obj, sizeof(Map));
+	PushObject(vm, obj);
+	return obj;
+}
+
+Object* PushWeakMap(VM* vm, char weakMode)
+{
+	Object* obj = PushMap(vm);
+	obj->map->weakMode = weakMode;
+	RegisterWeakObject(vm, obj);
+	return obj;
+}
+
+Object* PushStruct(VM* vm, int typeIndex)
+{
+	Object* obj = NewObject(vm, OBJ_STRUCT);
+	int numFields = vm->structTypes[typeIndex].numFields;
+
+	obj->structure.typeIndex = typeIndex;
+	obj->structure.members = emalloc(sizeof(Value) * numFields);
+	SetExternalSize(vm, obj, sizeof(Value) * numFields);
+
+	for(int i = 0; i < numFields; ++i)
+		obj->structure.members[i] = NULL_VAL;
+
+	PushObject(vm, obj);
+	return obj;
+}
+
+// returns a pointer to the member of the struct for the field 'key' (or NULL if
+// the struct's type has no such field); the key can be any string object
+static Value* GetStructMember(VM* vm, Object* obj, Object* key)
+{
+	const StructType* type = &vm->structTypes[obj->structure.typeIndex];
+	for(int i = 0; i < type->numFields; ++i)
+	{
+		if(StringsEqual(type->keys[i], key))
+			return &obj->structure.members[i];
+	}
+
+	return NULL;
+}
+
+// Turns a struct into a dict with the same entries (in place, so every reference
+// to it sees the dict); this happens whenever it's used in a way a struct can't be
+static void StructToDict(VM* vm, Object* obj)
+{
+	const StructType* type = &vm->structTypes[obj->structure.typeIndex];
+	Value* members = obj->structure.members;
+
+	Dict* dict = emalloc(sizeof(Dict));
+	InitDict(dict);
+
+	for(int i = 0; i < type->numFields; ++i)
+		DictPut(dict, type->keys[i], members[i]);
+
+	free(members);
+
+	// NOTE: the keys are string constants and the values were already referenced
+	// by the object so there's no need for a write barrier
+	ChangeObjectType(vm, obj, OBJ_DICT);
+	obj->dict = dict;
+	obj->meta = NULL;
+	obj->weakMode = 0;
+	SetExternalSize(vm, obj, sizeof(Dict) + DictMemory(dict));
+}
+
+static Object* ToDict(VM* vm, Value val)
+{
+	ObjectType type = GetValueType(val);
+	if(type == OBJ_STRUCT)
+		StructToDict(vm, AS_OBJECT(val));
+	else if(type != OBJ_DICT)
+		ErrorExitVM(vm, "Expected dictionary but received %s\n", ObjectTypeNames[type]);
+
+	return AS_OBJECT(val);
+}
+
 void PushNull(VM* vm)
 {
-	PushObject(vm, &NullObject);
+	PushValue(vm, NULL_VAL);
 }
 
 double PopNumber(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_NUMBER) ErrorExitVM(vm, "Expected number but recieved %s\n", ObjectTypeNames[obj->type]);
-	return obj->number;
+	Value val = PopValue(vm);
+	if(!IS_NUMBER(val)) ErrorExitVM(vm, "Expected number but recieved %s\n", ObjectTypeNames[GetValueType(val)]);
+	return AS_NUMBER(val);
+}
+
+// NOTE: The Pop*Object functions check the type before assuming the value is on the heap
+static Object* PopTypedObject(VM* vm, ObjectType type, const char* expected)
+{
+	Value val = PopValue(vm);
+	ObjectType valType = GetValueType(val);
+	if(valType != type) ErrorExitVM(vm, "Expected %s but received %s\n", expected, ObjectTypeNames[valType]);
+	return AS_OBJECT(val);
 }
 
 const char* PopString(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_STRING) ErrorExitVM(vm, "Expected string but recieved %s\n", ObjectTypeNames[obj->type]);
-	return obj->string.raw;
+	return GetStringChars(PopTypedObject(vm, OBJ_STRING, "string"));
 }
 
 Object* PopStringObject(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_STRING) ErrorExitVM(vm, "Expected string but received '%s'\n", ObjectTypeNames[obj->type]);
+	Object* obj = PopTypedObject(vm, OBJ_STRING, "string");
+	GetStringChars(obj);
 	return obj;
 }
 
 Object* PopFuncObject(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_FUNC) ErrorExitVM(vm, "Expected function but received %s\n", ObjectTypeNames[obj->type]);
-	return obj;
+	return PopTypedObject(vm, OBJ_FUNC, "function");
 }
 
-Object** PopArray(VM* vm, int* length)
+Value* PopArray(VM* vm, int* length)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_ARRAY) ErrorExitVM(vm, "Expected array but recieved %s\n", ObjectTypeNames[obj->type]);
+	Object* obj = PopTypedObject(vm, OBJ_ARRAY, "array");
+	// the caller can write anything into the members
+	RememberObject(vm, obj);
 	if(length)
 		*length = obj->array.length;
 	return obj->array.members;
@@ -2182,45 +2996,40 @@ Object** PopArray(VM* vm, int* length)
 
 Object* PopArrayObject(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_ARRAY) ErrorExitVM(vm, "Expected array but received %s\n", ObjectTypeNames[obj->type]);
-	return obj;
+	return PopTypedObject(vm, OBJ_ARRAY, "array");
 }
 
 Object* PopDict(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_DICT) ErrorExitVM(vm, "Expected dictionary but received %s\n", ObjectTypeNames[obj->type]);
-	return obj;
+	return ToDict(vm, PopValue(vm));
 }
 
 Object* PopNativeObject(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_NATIVE) ErrorExitVM(vm, "Expected native pointer but recieved %s\n", ObjectTypeNames[obj->type]);
-	return obj;
+	return PopTypedObject(vm, OBJ_NATIVE, "native pointer");
 }
 
 Object* PopThreadObject(VM * vm)
 {
-	Object* obj = PopObject(vm);
-	if (obj->type != OBJ_THREAD) ErrorExitVM(vm, "Expected thread but received %s\n", ObjectTypeNames[obj->type]);
-	return obj;
+	return PopTypedObject(vm, OBJ_THREAD, "thread");
+}
+
+Object* PopWeakObject(VM* vm)
+{
+	return PopTypedObject(vm, OBJ_WEAK, "weak reference");
 }
 
 void* PopNative(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_NATIVE) ErrorExitVM(vm, "Expected native pointer but recieved %s\n", ObjectTypeNames[obj->type]);
-	return obj->native.value;
+	return PopTypedObject(vm, OBJ_NATIVE, "native pointer")->native.value;
 }
 
 void* PopNativeOrNull(VM* vm)
 {
-	Object* obj = PopObject(vm);
-	if(obj->type != OBJ_NATIVE && obj->type != OBJ_NULL) ErrorExitVM(vm, "Expected native pointer or null but received %s\n", ObjectTypeNames[obj->type]);
-	if(obj->type == OBJ_NULL) return NULL;
-	return obj->native.value;
+	Value val = PopValue(vm);
+	if(IS_NULL(val)) return NULL;
+	if(GetValueType(val) != OBJ_NATIVE) ErrorExitVM(vm, "Expected native pointer or null but received %s\n", ObjectTypeNames[GetValueType(val)]);
+	return AS_OBJECT(val)->native.value;
 }
 
 VMThread* PopThread(VM * vm)
@@ -2241,32 +3050,20 @@ void* NativeStackAlloc(VM* vm, size_t size)
 
 void ReturnTop(VM* vm)
 {
-	Object* top = PopObject(vm);
-	vm->thread->retVal = top;
+	vm->thread->retVal = PopValue(vm);
 }
 
 void ReturnNullObject(VM* vm)
 {
-	vm->thread->retVal = &NullObject;
-}
-
-int ReadInteger(VM* vm)
-{
-	int value;
-	Word* vp = (Word*)(&value);
-	
-	for(int i = 0; i < sizeof(int) / sizeof(Word); ++i)
-		vp[i] = vm->program[vm->thread->pc++];
-	
-	return value;
+	vm->thread->retVal = NULL_VAL;
 }
 
-void SetLocal(VM* vm, int index, Object* value)
+void SetLocal(VM* vm, int index, Value value)
 {
 	vm->thread->stack[vm->thread->fp + index] = value;
 }
 
-Object* GetLocal(VM* vm, int index)
+Value GetLocal(VM* vm, int index)
 {
 	return vm->thread->stack[vm->thread->fp + index];
 }
@@ -2299,26 +3096,28 @@ static void YieldCurrentThread(VM* vm)
 	// sets the ret val to it, then calls this function
 	// Point is, the retval stores the yielded value
 
-	Object* obj = vm->thread->retVal;
+	Value val = vm->thread->retVal;
 	vm->thread = vm->thread->parent;
-	vm->thread->retVal = obj;
+	vm->thread->retVal = val;
 }
 
-void PushIndir(VM* vm, int nargs)
+void PushIndir(VM* vm, int nargs, ResumeKind resume)
 {
-	if(vm->thread->indirStackSize + 4 >= MAX_INDIR) ErrorExitVM(vm, "Imminent callstack overlflow\n");
+	if(vm->thread->indirStackSize + FRAME_SIZE >= MAX_INDIR) ErrorExitVM(vm, "Imminent callstack overlflow\n");
 
 	vm->thread->indirStack[vm->thread->indirStackSize++] = nargs;
 	vm->thread->indirStack[vm->thread->indirStackSize++] = vm->thread->fp;
 	vm->thread->indirStack[vm->thread->indirStackSize++] = vm->thread->pc;
 	vm->thread->indirStack[vm->thread->indirStackSize++] = vm->nativeStackSize;
+	vm->thread->indirStack[vm->thread->indirStackSize++] = resume;
 	
 	vm->thread->fp = vm->thread->stackSize;
 
 	vm->numExpandedArgs = 0;
 }
 
-void PopIndir(VM* vm)
+// returns what has to be done now that the frame is gone (see ResumeKind)
+ResumeKind PopIndir(VM* vm)
 {
 	if(vm->thread->indirStackSize <= 0)
 	{
@@ -2330,37 +3129,80 @@ void PopIndir(VM* vm)
 			vm->thread->parent->retVal = vm->thread->retVal;
 		
 		vm->thread = vm->thread->parent;
-		return;
+		return RESUME_NONE;
 	}
 	
-	if(vm->thread->indirStackSize - 3 < 0) ErrorExitVM(vm, "Imminent callstack underflow\n");
-
-	if(vm->debug)
-		printf("previous fp: %i\n", vm->thread->fp);
+	if(vm->thread->indirStackSize - FRAME_SIZE < 0) ErrorExitVM(vm, "Imminent callstack underflow\n");
 
 	vm->thread->stackSize = vm->thread->fp;
 	
+	ResumeKind resume = (ResumeKind)vm->thread->indirStack[--vm->thread->indirStackSize];
 	vm->nativeStackSize = vm->thread->indirStack[--vm->thread->indirStackSize];
 	vm->thread->pc = vm->thread->indirStack[--vm->thread->indirStackSize];
 	vm->thread->fp = vm->thread->indirStack[--vm->thread->indirStackSize];
 	vm->thread->stackSize -= vm->thread->indirStack[--vm->thread->indirStackSize];
 
-	if(vm->debug)
-		printf("new fp: %i\nnew stack size: %i\n", vm->thread->fp, vm->thread->stackSize);
+	return resume;
 }
 
-void ExecuteCycle(VM* vm);
+// Calls the function (whose arguments have been pushed) in a new frame of the
+// current thread; the instruction which called it is finished off according
+// to 'resume' once it returns
+static void CallResumable(VM* vm, int id, int nargs, ResumeKind resume)
+{
+	PushIndir(vm, nargs, resume);
+	vm->thread->pc = vm->functionPcs[id];
+}
+
+// Finishes off the instruction which pushed the frame that just returned
+static void ResumeAfterReturn(VM* vm, ResumeKind resume)
+{
+	switch(resume)
+	{
+		case RESUME_NONE: break;
+		
+		case RESUME_PUSH_RETVAL:
+		{
+			PushValue(vm, vm->thread->retVal);
+		} break;
+		
+		case RESUME_PUSH_NOT_RETVAL:
+		{
+			Value result = vm->thread->retVal;
+			PushBool(vm, IS_BOOL(result) ? !AS_BOOL(result) : (IS_NUMBER(result) && (int)AS_NUMBER(result) == 0));
+		} break;
+		
+		case RESUME_ARRAYSORT:
+		{
+			ResumeArraySort(vm, vm->thread->retVal);
+		} break;
+		
+		// NOTE: the return pc is right after the instruction, so its last operand is just before it
+		case RESUME_SETLOCAL:
+		{
+			SetLocal(vm, vm->code[vm->thread->pc - 1].i, vm->thread->retVal);
+		} break;
+		
+		case RESUME_GOTOZ:
+		{
+			Value result = vm->thread->retVal;
+			if(IS_NULL(result) || result == FALSE_VAL)
+				vm->thread->pc = vm->code[vm->thread->pc - 1].i;
+		} break;
+	}
+}
+
+static void Execute(VM* vm, int stopFp);
 void CallFunction(VM* vm, int id, Word numArgs)
 {
 	if(id < 0) return;
 
 	int startFp = vm->thread->fp;
-	PushIndir(vm, numArgs);
+	PushIndir(vm, numArgs, RESUME_NONE);
 	
 	vm->thread->pc = vm->functionPcs[id];
 	
-	while(vm->thread->fp > startFp && vm->thread->pc >= 0)
-		ExecuteCycle(vm);
+	Execute(vm, startFp);
 }
 
 
@@ -2375,7 +3217,7 @@ int GetGlobalId(VM* vm, const char* name)
 	return -1;
 }
 
-Object* GetGlobal(VM* vm, int id)
+Value GetGlobal(VM* vm, int id)
 {
 	assert(id >= 0 && id < vm->numGlobals);
 	return vm->globals[id];
@@ -2384,1040 +3226,419 @@ Object* GetGlobal(VM* vm, int id)
 void SetGlobal(VM* vm, int id)
 {
 	assert(id >= 0 && id < vm->numGlobals);
-	vm->globals[id] = PopObject(vm);
+	vm->globals[id] = PopValue(vm);
 }
 
 /* ALL OF THIS IS TERRIBLE; ABSOLUTELY HORRIBLE */
-void CallOverloadedOperator(VM* vm, const char* name, Object* val1, Object* val2)
+const char* MetaOperatorNames[NUM_META_OPERATORS] =
+{
+	"ADD",
+	"SUB",
+	"MUL",
+	"DIV",
+	"MOD",
+	"OR",
+	"AND",
+	"LT",
+	"LTE",
+	"GT",
+	"GTE",
+	"LOGICAL_AND",
+	"LOGICAL_OR",
+	"SHL",
+	"SHR",
+	"EQUALS",
+	"GETINDEX",
+	"SETINDEX",
+	"CALL",
+	"LENGTH",
+	"NEG",
+	"NOT"
+};
+
+static Object* CheckOverload(VM* vm, Value func, MetaOperator op)
+{
+	if(GetValueType(func) != OBJ_FUNC)
+		ErrorExitVM(vm, "Expected member '%s' in dictionary to be a function\n", MetaOperatorNames[op]);
+	return AS_OBJECT(func);
+}
+
+// Looks up the overload of op in the metadict of val (returns NULL if there is no such overload)
+static Object* GetOverload(VM* vm, Value val, MetaOperator op)
+{
+	if(GetValueType(val) != OBJ_DICT) return NULL;
+	
+	Object* obj = AS_OBJECT(val);
+	if(!obj->meta) return NULL;
+
+	Dict* meta = obj->meta->dict;
+	MetaCache* cache = meta->metaCache;
+
+	// NOTE: the cache isn't counted towards the dict's size; it's small and there are few metadicts
+	if(!cache)
+	{
+		cache = emalloc(sizeof(MetaCache));
+		cache->version = meta->version - 1;
+		meta->metaCache = cache;
+	}
+
+	if(cache->version != meta->version)
+	{
+		for(int i = 0; i < NUM_META_OPERATORS; ++i)
+			cache->indices[i] = META_UNRESOLVED;
+		cache->version = meta->version;
+	}
+
+	int index = cache->indices[op];
+	if(index == META_UNRESOLVED)
+	{
+		Value* func = DictGetStringIndexed(meta, MetaOperatorNames[op], &index);
+
+		index = func ? index : META_MISSING;
+		cache->indices[op] = index;
+	}
+
+	if(index == META_MISSING)
+		return NULL;
+	return CheckOverload(vm, LocateDictEntry(meta, index)->value, op);
+}
+
+// NOTE: the result of the overload is dealt with once it returns (see ResumeKind)
+void CallOverloadedOperator(VM* vm, MetaOperator op, Value val1, Value val2, ResumeKind resume)
 {
+	const char* name = MetaOperatorNames[op];
 	if(vm->debug)
 		printf("overload %s\n", name);
-	if(val1->type != OBJ_DICT || !val1->meta)
-        ErrorExitVM(vm, "Invalid binary operation between '%s' and '%s'\n", ObjectTypeNames[val1->type], ObjectTypeNames[val2->type]);
+	if(GetValueType(val1) != OBJ_DICT || !AS_OBJECT(val1)->meta)
+        ErrorExitVM(vm, "Invalid binary operation between '%s' and '%s'\n", ObjectTypeNames[GetValueType(val1)], ObjectTypeNames[GetValueType(val2)]);
     
-    Object* binFunc = DictGet(&val1->meta->dict, name);
+    Object* binFunc = GetOverload(vm, val1, op);
     
     if(!binFunc)
         ErrorExitVM(vm, "Attempted to perform binary operation with dictionary as lhs (and no operator overload) for op '%s'\n", name);
-	if(binFunc->type != OBJ_FUNC)
-        ErrorExitVM(vm, "Expected member '%s' in dictionary to be a function\n", name);									
 	if(vm->functionNumArgs[binFunc->func.index] != 2) ErrorExitVM(vm, "Expected member function '%s' in dictionary to take 2 arguments\n", name);
 	vm->lastFunctionName = name;																	
-	PushObject(vm, val2);			
-	PushObject(vm, val1);
-	CallFunction(vm, binFunc->func.index, 2);
-	PushObject(vm, vm->thread->retVal);
+	PushValue(vm, val2);			
+	PushValue(vm, val1);
+	CallResumable(vm, binFunc->func.index, 2, resume);
 }
 
-char CallOverloadedOperatorIf(VM* vm, const char* name, Object* val1, Object* val2)
+// returns MINT_FALSE if there is no such overload
+char CallOverloadedOperatorIf(VM* vm, MetaOperator op, Value val1, Value val2, ResumeKind resume)
 {
+	const char* name = MetaOperatorNames[op];
 	if(vm->debug)
 		printf("overload %s\n", name);
-	if(val1->type != OBJ_DICT)																														
+	if(GetValueType(val1) != OBJ_DICT)																														
 		ErrorExitVM(vm, "Invalid binary operation\n");																								
-	if(!val1->meta)
-		return MINT_FALSE;
 
-	Object* binFunc = DictGet(&val1->meta->dict, name);
+	Object* binFunc = GetOverload(vm, val1, op);
 	if(!binFunc)
-		return 0;
-	if(binFunc->type != OBJ_FUNC)																													
-		ErrorExitVM(vm, "Expected member '%s' in dictionary to be a function\n", name);									
+		return MINT_FALSE;
 	if(vm->functionNumArgs[binFunc->func.index] != 2) ErrorExitVM(vm, "Expected member function '%s' in dictionary to take 2 arguments\n", name);
 	vm->lastFunctionName = name;																	
-	PushObject(vm, val2);			
-	PushObject(vm, val1);
-	CallFunction(vm, binFunc->func.index, 2);
+	PushValue(vm, val2);			
+	PushValue(vm, val1);
+	CallResumable(vm, binFunc->func.index, 2, resume);
 	return MINT_TRUE;
 }
 
-char CallOverloadedOperatorEx(VM* vm, const char* name, Object* val1, Object* val2, Object* val3)
+// NOTE: the return value of the overload is discarded
+char CallOverloadedOperatorEx(VM* vm, MetaOperator op, Value val1, Value val2, Value val3)
 {
+	const char* name = MetaOperatorNames[op];
 	if(vm->debug)
 		printf("overload %s\n", name);
-	if(val1->type != OBJ_DICT)																														
+	if(GetValueType(val1) != OBJ_DICT)																														
 		ErrorExitVM(vm, "Invalid binary operation\n");																								
-	if(!val1->meta)
-		return MINT_FALSE;
-	Object* binFunc = DictGet(&val1->meta->dict, name);
+
+	Object* binFunc = GetOverload(vm, val1, op);
 	if(!binFunc)
 		return MINT_FALSE;
-	if(binFunc->type != OBJ_FUNC)																													
-		ErrorExitVM(vm, "Expected member '%s' in dictionary to be a function\n", name);									
 	if(vm->functionNumArgs[binFunc->func.index] != 3) ErrorExitVM(vm, "Expected member function '%s' in dictionary to take 2 arguments\n", name);
 	vm->lastFunctionName = name;
-	PushObject(vm, val3);
-	PushObject(vm, val2);			
-	PushObject(vm, val1);
-	CallFunction(vm, binFunc->func.index, 3);
+	PushValue(vm, val3);
+	PushValue(vm, val2);			
+	PushValue(vm, val1);
+	CallResumable(vm, binFunc->func.index, 3, RESUME_NONE);
 	return MINT_TRUE;
 }
-/* END OF HORRIBLENESS; FOR NOW :P
-   VALVE PLS FIX */
 
-void ExecuteCycle(VM* vm)
+// Calls the unary overload of the dict val (its result is pushed once it returns)
+static void CallUnaryOverload(VM* vm, Object* func, Value val)
 {
-	VMThread* thread = vm->thread;
+	PushValue(vm, val);
+	CallResumable(vm, func->func.index, 1, RESUME_PUSH_RETVAL);
+}
 
-	if (!thread) return;
+// Pushes objVal[indexVal] (for OP_GETINDEX and OP_GETINDEX_RR); the GETINDEX
+// overload of a dict without the key is called instead if it has one
+static void PushIndex(VM* vm, Value objVal, Value indexVal)
+{
+	ObjectType type = GetValueType(objVal);
 
-	if(vm->debug)
-		printf("(%s:%i:%i): ", vm->thread->curFile, vm->thread->curLine, vm->thread->pc);
-	
-	switch(vm->program[thread->pc])
+	if(type == OBJ_ARRAY)
 	{
-		case OP_GET_RETVAL:
-		{
-			if(vm->debug)
-				printf("get_retval\n");
-			++thread->pc;
-			if(thread->retVal != NULL)
-				PushObject(vm, thread->retVal);
-			else
-				PushObject(vm, &NullObject);
-		} break;
+		Object* obj = AS_OBJECT(objVal);
+		if(!IS_NUMBER(indexVal))
+			ErrorExitVM(vm, "Attempted to index array with a %s (expected number)\n", ObjectTypeNames[GetValueType(indexVal)]);
 
-		case OP_SET_RETVAL:
-		{
-			if (vm->debug)
-				printf("set_retval\n");
-			++thread->pc;
+		int index = (int)AS_NUMBER(indexVal);
 
-			thread->retVal = PopObject(vm);
-		} break;
-		
-		case OP_PUSH_NULL:
-		{
-			if(vm->debug)
-				printf("push_null\n");
-			++thread->pc;
-			PushObject(vm, &NullObject);
-		} break;
+		if(index >= 0 && index < obj->array.length)
+			PushValue(vm, obj->array.members[index]);
+		else
+			ErrorExitVM(vm, "Invalid array index %i\n", index);
+	}
+	else if(type == OBJ_STRING)
+	{
+		Object* obj = AS_OBJECT(objVal);
+		if(!IS_NUMBER(indexVal))
+			ErrorExitVM(vm, "Attempted to index string with a %s (expected number)\n", ObjectTypeNames[GetValueType(indexVal)]);
 
-		case OP_PUSH_TRUE:
-		{
-			if (vm->debug)
-				printf("push_true\n");
-			++thread->pc;
-			PushBool(vm, MINT_TRUE);
-		} break;
-		
-		case OP_PUSH_FALSE:
-		{
-			if (vm->debug)
-				printf("push_false\n");
-			++thread->pc;
-			PushBool(vm, MINT_FALSE);
-		} break;
+		// NOTE: the null terminator can be read too (scripts use it to find the end of a string)
+		int index = (int)AS_NUMBER(indexVal);
+		if(index < 0 || index > obj->string.length)
+			ErrorExitVM(vm, "Invalid string index %i\n", index);
 
-		case OP_PUSH_NUMBER:
-		{
-			++thread->pc;
-			int index = ReadInteger(vm);
-			
-			if(vm->debug)
-				printf("push_number %g (%d)\n", vm->numberConstants[index], index);
-			PushNumber(vm, vm->numberConstants[index]);
-		} break;
-		
-		case OP_PUSH_STRING:
-		{
-			++thread->pc;
-			int index = ReadInteger(vm);
-			if(vm->debug)
-				printf("push_string %s (%d)\n", vm->stringConstants[index], index);
-			PushString(vm, vm->stringConstants[index]);
-		} break;
-		
-		case OP_PUSH_FUNC:
-		{
-			if(vm->debug)
-				printf("push_func\n");
-			Word hasEnv = vm->program[++thread->pc];
-			Word isExtern = vm->program[++thread->pc];
-			++thread->pc;
-			int index = ReadInteger(vm);
-			
-			Object* env = NULL;
-			if(hasEnv)
-				env = PopObject(vm);
-			PushFunc(vm, index, isExtern, env);
-		} break;
-		
-		case OP_PUSH_DICT:
-		{
-			if(vm->debug)
-				printf("push_dict\n");
-			++thread->pc;
-			PushDict(vm);
-		} break;
+		PushNumber(vm, GetStringChars(obj)[index]);
+	}
+	else if(type == OBJ_MAP)
+	{
+		Value* val = IsValidMapKey(indexVal) ? MapGet(AS_OBJECT(objVal)->map, indexVal) : NULL;
+		PushValue(vm, val ? *val : NULL_VAL);
+	}
+	else if(type == OBJ_STRUCT)
+	{
+		// NOTE: a struct has no metadict, so there's no GETINDEX to fall back on
+		Value* member = GetValueType(indexVal) == OBJ_STRING ? GetStructMember(vm, AS_OBJECT(objVal), AS_OBJECT(indexVal)) : NULL;
+		PushValue(vm, member ? *member : NULL_VAL);
+	}
+	else if(type == OBJ_DICT)
+	{
+		Object* obj = AS_OBJECT(objVal);
+		Value* val = GetValueType(indexVal) == OBJ_STRING ? DictGet(obj->dict, AS_OBJECT(indexVal)) : NULL;
 
-		case OP_PUSH_THREAD:
-		{
-			if (vm->debug)
-				printf("push_thread\n");
-			++thread->pc;
-
-			Object* obj = PopFuncObject(vm);
-			if (obj->func.isExtern)
-				ErrorExitVM(vm, "Expected function but received extern %s instead\n", vm->externNames[obj->func.index]);
-			PushThread(vm, obj);
-		} break;
+		if(val)
+			PushValue(vm, *val);
+		else if(!CallOverloadedOperatorIf(vm, META_GETINDEX, objVal, indexVal, RESUME_PUSH_RETVAL))
+			PushNull(vm);
+	}
+	else
+		ErrorExitVM(vm, "Attempted to index a %s\n", ObjectTypeNames[type]);
+}
 
-		/* REMOVED: see header
-		 * case OP_CREATE_DICT_BLOCK:
-		{
-			if(vm->debug)
-				printf("create_dict_block\n");
-			++vm->pc;
-			int length = ReadInteger(vm);
-			Object* obj = PushDict(vm);
-			if(length > 0)
-			{
-				// stack (before dict) is filled with key-value pairs (backwards, key is higher on stack)
-				for(int i = 0; i < length * 2; i += 2)
-					DictPut(&obj->dict, vm->stack[vm->stackSize - i - 2]->string.raw, vm->stack[vm->stackSize - i - 3]);
-				vm->stackSize -= length * 2;
-				vm->stack[vm->stackSize - 1] = obj;
-			}
-		} break;*/
+// Pushes the value of the field 'key' of a dict or struct (the same way
+// OP_DICT_GET does, but without an inline cache)
+static void GetField(VM* vm, Value objVal, Object* key)
+{
+	if(GetValueType(objVal) == OBJ_STRUCT)
+	{
+		Value* member = GetStructMember(vm, AS_OBJECT(objVal), key);
+		PushValue(vm, member ? *member : NULL_VAL);
+		return;
+	}
 
-		case OP_CREATE_ARRAY:
-		{
-			if(vm->debug)
-				printf("create_array\n");
-			++thread->pc;
-			int length = (int)PopNumber(vm);
-			PushArray(vm, length);
-		} break;
-		
-		case OP_CREATE_ARRAY_BLOCK:
-		{
-			if(vm->debug)
-				printf("create_array_block\n");
-			++thread->pc;
-			int length = ReadInteger(vm);
-			Object* obj = PushArray(vm, length);
-			
-			if(length > 0)
-			{
-				for(int i = 0; i < length; ++i)
-					obj->array.members[length - i - 1] = thread->stack[thread->stackSize - 2 - i];
-				thread->stackSize -= length + 1;
-				thread->stack[thread->stackSize++] = obj;
-			}
-		} break;
+	Object* obj = ToDict(vm, objVal);
+	Value* val = DictGet(obj->dict, key);
 
-		case OP_EXPAND_ARRAY:
-		{
-			if(vm->debug)
-				printf("expand_array\n");
-			++thread->pc;
-			Object* obj = PopObject(vm);
-			if(obj->type != OBJ_ARRAY)
-				ErrorExitVM(vm, "Expected array when expanding but received %s\n", ObjectTypeNames[obj->type]);
-			int expand_amount = (int)PopNumber(vm);
-			
-			if(expand_amount < 0 || expand_amount > obj->array.length)
-				ErrorExitVM(vm, "Expansion length out of array bounds\n");
-			
-			for(int i = expand_amount - 1; i >= 0; --i)
-				PushObject(vm, obj->array.members[i]);
-			
-			vm->numExpandedArgs += expand_amount;
-		} break;
+	if(val)
+		PushValue(vm, *val);
+	else if(!CallOverloadedOperatorIf(vm, META_GETINDEX, objVal, OBJECT_VAL(key), RESUME_PUSH_RETVAL))
+		PushNull(vm);
+}
 
-		case OP_PUSH_STACK:
-		{
-			if(vm->debug)
-				printf("push_stack\n");
-			++thread->pc;
-			thread->indirStack[thread->indirStackSize++] = thread->stackSize;
-		} break;
-		
-		case OP_POP_STACK:
-		{
-			if(vm->debug)
-				printf("pop_stack\n");
-			++thread->pc;
-			thread->stackSize = thread->indirStack[--thread->indirStackSize];
-		} break;
-		
-		case OP_LENGTH:
+// Sets the field 'key' of a dict or struct (the same way OP_DICT_SET does, but
+// without an inline cache); a struct without the field is turned into a dict
+static void SetField(VM* vm, Value objVal, Object* key, Value value)
+{
+	if(GetValueType(objVal) == OBJ_STRUCT)
+	{
+		Value* member = GetStructMember(vm, AS_OBJECT(objVal), key);
+		if(member)
 		{
-			if(vm->debug)
-				printf("length\n");
-			++thread->pc;
-			Object* obj = PopObject(vm);
-			if(obj->type == OBJ_STRING)
-				PushNumber(vm, strlen(obj->string.raw));
-			else if(obj->type == OBJ_ARRAY)
-				PushNumber(vm, obj->array.length);
-			else if(obj->type == OBJ_DICT && obj->meta)
-			{
-				Object* lenFunc = DictGet(&obj->meta->dict, "LENGTH");
-				if(!lenFunc)
-					ErrorExitVM(vm, "Attempted to get length of dictionary without 'LENGTH' overload\n");					
+			WriteBarrier(vm, AS_OBJECT(objVal), value);
+			*member = value;
+			return;
+		}
+	}
 
-				PushObject(vm, obj);
-				CallFunction(vm, lenFunc->func.index, 1);
-				PushObject(vm, thread->retVal);
-			}
-			else
-				ErrorExitVM(vm, "Attempted to get length of %s\n", ObjectTypeNames[obj->type]);
-		} break;
-		
-		case OP_ARRAY_PUSH:
-		{
-			if(vm->debug)
-				printf("array_push\n");
-			++thread->pc;
-			
-			Object* obj = PopArrayObject(vm);
-			Object* value = PopObject(vm);
-
-			while(obj->array.length + 1 >= obj->array.capacity)
-			{
-				obj->array.capacity *= 2;
-				obj->array.members = erealloc(obj->array.members, obj->array.capacity * sizeof(Object*));
-			}
-			
-			obj->array.members[obj->array.length++] = value;
-		} break;
-		
-		case OP_ARRAY_POP:
-		{
-			if(vm->debug)
-				printf("array_pop\n");
-			++thread->pc;
-			Object* obj = PopArrayObject(vm);
-			if(obj->array.length <= 0)
-				ErrorExitVM(vm, "Cannot pop from empty array\n");
-			
-			PushObject(vm, obj->array.members[--obj->array.length]);
-		} break;
-		
-		case OP_ARRAY_CLEAR:
-		{
-			if(vm->debug)
-				printf("array_clear\n");
-			++thread->pc;
-			Object* obj = PopArrayObject(vm);
-			obj->array.length = 0;
-		} break;
+	Object* obj = ToDict(vm, objVal);
+	WriteBarrier(vm, obj, value);
 
-		case OP_SET_META:
-		{
-			if(vm->debug)
-				printf("set_meta\n");
-			++thread->pc;
-
-			Object* obj = PopDict(vm);
-			Object* meta = PopDict(vm);
-
-			obj->meta = meta;
-		} break;
+	Value* val = DictGet(obj->dict, key);
+	if(val)
+		*val = value;
+	else if(!CallOverloadedOperatorEx(vm, META_SETINDEX, objVal, OBJECT_VAL(key), value))
+		PutDictValue(vm, obj, key, value);
+}
 
-		case OP_GET_META:
-		{
-			if(vm->debug)
-				printf("get_meta\n");
-			++thread->pc;
+// Pushes an array of the [key, value] pairs of a map
+// NOTE: the map has to be on the stack so the allocations can't collect it
+static void PushMapPairs(VM* vm, Object* obj)
+{
+	Map* map = obj->map;
+	Object* aobj = PushArray(vm, map->numEntries);
 
-			Object* obj = PopDict(vm);
-			if(obj->meta)
-				PushObject(vm, obj->meta);
-			else
-				PushObject(vm, &NullObject);
-		} break;
+	int len = 0;
+	for(int i = 0; i < GetMapEntryCount(map); ++i)
+	{
+		if(!GetMapEntry(map, i)) continue;
 
-		case OP_DICT_SET:
-		{
-			++thread->pc;
-			if(vm->debug)
-				printf("dict_set");
+		Object* pair = PushArray(vm, 2);
 
-			Object* obj = PopDict(vm);
-			Object* index = PopStringObject(vm);
-			Object* value = PopObject(vm);
-			
-			if(vm->debug)
-			{
-				printf(" '%s' ", index->string.raw);
-				WriteNonVerbose(vm, value);
-				printf("\n");
-			}
-			
-			Object* val = index->type == OBJ_STRING ? DictGet(&obj->dict, index->string.raw) : NULL;
-			if(val)
-				DictPut(&obj->dict, index->string.raw, value);
-			else if(CallOverloadedOperatorEx(vm, "SETINDEX", obj, index, value))
-				PushObject(vm, thread->retVal);
-			else
-				DictPut(&obj->dict, index->string.raw, value);
-		} break;
-		
-		case OP_DICT_GET:
+		// NOTE: a weak map's entries may have been removed by now
+		MapEntry* entry = GetMapEntry(map, i);
+		if(!entry)
 		{
-			++thread->pc;
-			if(vm->debug)
-				printf("dict_get");
-				
-			Object* obj = PopDict(vm);
-			Object* index = PopObject(vm);
-			
-			if(vm->debug)
-				printf(" %s\n", index->string.raw);
-			
-			Object* val = index->type == OBJ_STRING ? DictGet(&obj->dict, index->string.raw) : NULL;
-
-			if(val)
-				PushObject(vm, val);
-			else if(!CallOverloadedOperatorIf(vm, "GETINDEX", obj, index))
-				PushObject(vm, &NullObject);
-			else
-				PushObject(vm, thread->retVal);
-		} break;
-		
-		case OP_DICT_SET_RAW:
-		{
-			++thread->pc;
-			
-			Object* obj = PopDict(vm);
-			const char* index = PopString(vm);
-			Object* value = PopObject(vm);
-			
-			DictPut(&obj->dict, index, value);
-		} break;
-		
-		case OP_DICT_GET_RAW:
-		{
-			++thread->pc;
-			
-			Object* obj = PopDict(vm);
-			const char* index = PopString(vm);
-			
-			Object* value = DictGet(&obj->dict, index);
-			if(value)
-				PushObject(vm, value);
-			else
-				PushObject(vm, &NullObject);
-		} break;
+			PopValue(vm);
+			continue;
+		}
 
-		case OP_DICT_PAIRS:
-		{
-			if(vm->debug)
-				printf("dict_pairs\n");
-			++thread->pc;
-			Object* obj = PopDict(vm);
-			Object* aobj = PushArray(vm, obj->dict.numEntries);
-			
-			int len = 0;
-			for(int i = 0; i < obj->dict.capacity; ++i)
-			{
-				DictNode* node = obj->dict.buckets[i];
-				while(node)
-				{
-					Object* pair = PushArray(vm, 2);
-					
-					Object* key = NewObject(vm, OBJ_STRING);
-					key->string.raw = estrdup(node->key);
-					
-					pair->array.members[0] = key;
-					pair->array.members[1] = node->value;
-					
-					aobj->array.members[len++] = PopObject(vm);
-					
-					node = node->next;
-				}
-			}
-		} break;
-		
-		case OP_CAT:
-		{
-			++thread->pc;
-			if(vm->debug)
-				printf("cat\n");
+		// a collection may have promoted the arrays by now
+		WriteBarrier(vm, pair, entry->key);
+		WriteBarrier(vm, pair, entry->value);
+		pair->array.members[0] = entry->key;
+		pair->array.members[1] = entry->value;
 
-			const char* b = PopString(vm);
-			const char* a = PopString(vm);
+		WriteBarrier(vm, aobj, OBJECT_VAL(pair));
+		aobj->array.members[len++] = PopValue(vm);
+	}
 
-			size_t la = strlen(a);
-			size_t lb = strlen(b);
+	aobj->array.length = len;
+}
 
-			char* cat = emalloc(la + lb + 1);
+// NOTE: the position of an iteration is the index of an entry of the dict or
+// map (so it's still valid after entries are added, updated or removed), a
+// field of a struct or an element of an array
+static int GetIterCount(VM* vm, Value container)
+{
+	Object* obj = AS_OBJECT(container);
 
-			strcpy(cat, a);
-			strcpy(cat + la, b);
-			
-			PushString(vm, cat);
+	switch(obj->type)
+	{
+		case OBJ_DICT: return GetDictEntryCount(obj->dict);
+		case OBJ_STRUCT: return vm->structTypes[obj->structure.typeIndex].numFields;
+		case OBJ_MAP: return GetMapEntryCount(obj->map);
+		case OBJ_ARRAY: return obj->array.length;
+		default: return 0;
+	}
+}
 
-			free(cat);
-		} break;
+// The indices of a dict's or map's entries only change when they're compacted,
+// which a put of a new key does once at least half of them have been removed.
+// So that a loop can tell if that happened since it got to its position, the
+// (low bits of the) number of compactions is kept above the index in the
+// number the loop keeps its position in.
+#define ITER_INDEX_RANGE		4294967296.0
+#define ITER_COMPACTIONS_MASK	0xfffff
 
-		case OP_THREAD_RUN:
-		{
-			++thread->pc;
-			VMThread* newThread = PopThread(vm);
-			if (!newThread) ErrorExitVM(vm, "Attempted to run deleted thread\n");
+static uint32_t GetIterCompactions(Value container)
+{
+	Object* obj = AS_OBJECT(container);
 
-			if (vm->debug)
-				printf("thread_run");
+	switch(obj->type)
+	{
+		case OBJ_DICT: return obj->dict->compactions & ITER_COMPACTIONS_MASK;
+		case OBJ_MAP: return obj->map->compactions & ITER_COMPACTIONS_MASK;
+		default: return 0;
+	}
+}
 
-			vm->thread = newThread;
-		} break;
+static inline double MakeIterPosition(Value container, int index)
+{
+	return GetIterCompactions(container) * ITER_INDEX_RANGE + index;
+}
 
-		case OP_THREAD_YIELD:
-		{
-			if (vm->debug)
-				printf("thread_yield");
-			++thread->pc;
-			// NOTE: yields value to the parent thread
-			Object* obj = PopObject(vm);
-
-			vm->thread->retVal = obj;
-			YieldCurrentThread(vm);
-		} break;
+static inline int GetIterIndex(double position)
+{
+	return (int)fmod(position, ITER_INDEX_RANGE);
+}
 
-		case OP_THREAD_DONE:
-		{
-			if (vm->debug)
-				printf("thread_done");
-			++thread->pc;
+// returns MINT_FALSE if there's no entry at index (anymore)
+static char GetIterEntry(VM* vm, Value container, int index, Value* key, Value* value)
+{
+	Object* obj = AS_OBJECT(container);
 
-			VMThread* t = PopThread(vm);
-			PushBool(vm, t->pc < 0);
-		} break;
+	if(index < 0 || index >= GetIterCount(vm, container))
+		return MINT_FALSE;
 
-		case OP_THREAD_DELETE:
+	switch(obj->type)
+	{
+		case OBJ_DICT:
 		{
-			++thread->pc;
-			Object* obj = PopThreadObject(vm);
+			DictEntry* entry = GetDictEntry(obj->dict, index);
+			if(!entry) return MINT_FALSE;
 
-			if (vm->debug)
-				printf("thread_delete");
-			
-			free(obj->thread);
-			obj->thread = NULL;
+			*key = OBJECT_VAL(entry->key);
+			*value = entry->value;
 		} break;
 
-		#define BIN_OP_TYPE(op, operator, ty) case OP_##op: { ++thread->pc; if(vm->debug) printf("%s\n", #op); Object* b = PopObject(vm); Object* a = PopObject(vm); { if(a->type != OBJ_NUMBER) CallOverloadedOperator(vm, #op, a, b); else if(b->type == OBJ_NUMBER) PushNumber(vm, (ty)a->number operator (ty)b->number); else ErrorExitVM(vm, "Invalid binary operation between %s and %s\n", ObjectTypeNames[a->type], ObjectTypeNames[b->type]); } } break;
-		#define REL_OP(op, operator) case OP_##op: { ++thread->pc; if(vm->debug) printf("%s\n", #op); Object* b = PopObject(vm); Object* a = PopObject(vm); { if(a->type != OBJ_NUMBER) CallOverloadedOperator(vm, #op, a, b); else if(b->type == OBJ_NUMBER) PushBool(vm, a->number operator b->number); else ErrorExitVM(vm, "Invalid binary operation between %s and %s\n", ObjectTypeNames[a->type], ObjectTypeNames[b->type]); } } break;
-		#define BIN_OP(op, operator) BIN_OP_TYPE(op, operator, double)
-		
-		BIN_OP(ADD, +)
-		BIN_OP(SUB, -)
-		BIN_OP(MUL, *)
-		BIN_OP(DIV, /)
-		BIN_OP_TYPE(MOD, %, long)
-		BIN_OP_TYPE(OR, |, long)
-		BIN_OP_TYPE(AND, &, long)
-		REL_OP(LT, <)
-		REL_OP(LTE, <=)
-		REL_OP(GT, >)
-		REL_OP(GTE, >=)
-		BIN_OP_TYPE(LOGICAL_AND, &&, long)
-		BIN_OP_TYPE(LOGICAL_OR, ||, long)
-		BIN_OP_TYPE(SHL, <<, long)
-		BIN_OP_TYPE(SHR, >>, long)
-
-		case OP_EQU:
-		{
-			++thread->pc;
-			Object* o2 = PopObject(vm);
-			Object* o1 = PopObject(vm);
-			if(vm->debug)
-				printf("equ %s %s\n", ObjectTypeNames[o1->type], ObjectTypeNames[o2->type]);
-			
-			if(o1->type != o2->type && o1->type != OBJ_DICT) PushBool(vm, 0);
-			else
-			{
-				if(o1->type == OBJ_STRING) { PushBool(vm, strcmp(o1->string.raw, o2->string.raw) == 0); }
-				else if(o1->type == OBJ_NUMBER) { PushBool(vm, o1->number == o2->number); }
-				else if(o1->type == OBJ_DICT && CallOverloadedOperatorIf(vm, "EQUALS", o1, o2)) { PushObject(vm, thread->retVal); }
-				else if(o1->type == OBJ_NULL) PushBool(vm, 1);
-				else PushBool(vm, o1 == o2);
-			}
-		} break;
-		
-		case OP_NEQU:
+		case OBJ_STRUCT:
 		{
-			++thread->pc;
-			Object* o2 = PopObject(vm);
-			Object* o1 = PopObject(vm);
-			
-			if(vm->debug)
-				printf("nequ %s %s\n", ObjectTypeNames[o1->type], ObjectTypeNames[o2->type]);
-				
-			if(o1->type != o2->type && o1->type != OBJ_DICT) PushBool(vm, 1);
-			else
-			{
-				if(o1->type == OBJ_STRING) { PushBool(vm, strcmp(o1->string.raw, o2->string.raw) != 0); }
-				else if(o1->type == OBJ_NUMBER) { PushBool(vm, o1->number != o2->number); }
-				else if(o1->type == OBJ_DICT && CallOverloadedOperatorIf(vm, "EQUALS", o1, o2)) { int result = (int)thread->retVal->number; PushBool(vm, !result); }
-				else PushBool(vm, o1 != o2);
-			}
+			*key = OBJECT_VAL(vm->structTypes[obj->structure.typeIndex].keys[index]);
+			*value = obj->structure.members[index];
 		} break;
-		
-		case OP_NEG:
-		{
-			if(vm->debug)
-				printf("neg\n");
-			
-			++thread->pc;
-			Object* obj = PopObject(vm);
 
-			if (obj->type == OBJ_DICT)
-			{
-				if (obj->meta)
-				{
-					Object* negFunc = DictGet(&obj->meta->dict, "NEG");
-					if (negFunc && negFunc->type == OBJ_FUNC)
-					{
-						PushObject(vm, obj);
-						CallFunction(vm, negFunc->func.index, 1);
-						PushObject(vm, thread->retVal);
-					}
-					else
-						ErrorExitVM(vm, "Invalid negation of dictionary\n");
-				}
-				else
-					ErrorExitVM(vm, "Invalid negation of dictionary\n");
-			}
-			else if (obj->type == OBJ_NUMBER)
-				PushNumber(vm, -obj->number);
-			else
-				ErrorExitVM(vm, "Attempted to negate object of type %s\n", ObjectTypeNames[obj->type]);
-		} break;
-		
-		case OP_LOGICAL_NOT:
-		{	
-			++thread->pc;
-			Object* obj = PopObject(vm);
-			if (obj->type == OBJ_DICT)
-			{
-				if (obj->meta)
-				{
-					if (vm->debug)
-						printf("NOT dict\n");
-
-					Object* notFunc = DictGet(&obj->meta->dict, "NOT");
-					if (notFunc && notFunc->type == OBJ_FUNC)
-					{
-						PushObject(vm, obj);
-						CallFunction(vm, notFunc->func.index, 1);
-						PushObject(vm, thread->retVal);
-					}
-					else
-						ErrorExitVM(vm, "Invalid logical not-ing of dictionary\n");
-				}
-				else
-					ErrorExitVM(vm, "Invalid logical not-ing of dictionary\n");
-			}
-			else if (obj->type == OBJ_BOOL)
-			{
-				if (vm->debug)
-					printf("NOT %s\n", obj->boolean ? "true" : "false");
-				PushBool(vm, !obj->boolean);
-			}
-			else
-				ErrorExitVM(vm, "Attempted to use '!' operator on value of type %s\n", ObjectTypeNames[obj->type]);
-		} break;
-		
-		case OP_SETINDEX:
+		case OBJ_MAP:
 		{
-			++thread->pc;
+			MapEntry* entry = GetMapEntry(obj->map, index);
+			if(!entry) return MINT_FALSE;
 
-			Object* obj = PopObject(vm);
-			Object* indexObj = PopObject(vm);
-			Object* value = PopObject(vm);
-			if(vm->debug)
-				printf("setindex\n");
-			
-			if(obj->type == OBJ_ARRAY)
-			{
-				if(indexObj->type != OBJ_NUMBER)
-					ErrorExitVM(vm, "Attempted to index array with a %s (expected number)\n", ObjectTypeNames[indexObj->type]);
-				
-				int index = (int)indexObj->number;
-				
-				int arrayLength = obj->array.length;
-				Object** members = obj->array.members;
-				
-				if(index >= 0 && index < arrayLength)
-					members[index] = value;
-				else
-					ErrorExitVM(vm, "Invalid array index %i\n", index);
-			}
-			else if(obj->type == OBJ_STRING)
-			{				
-				if(indexObj->type != OBJ_NUMBER)
-					ErrorExitVM(vm, "Attempted to index string with a %s (expected number)\n", ObjectTypeNames[indexObj->type]);
-				
-				if(value->type != OBJ_NUMBER)
-					ErrorExitVM(vm, "Attempted to assign a %s to an index of a string '%s' (expected number/character)\n", ObjectTypeNames[value->type], obj->string.raw);
-				
-				obj->string.raw[(int)indexObj->number] = (char)value->number;
-			}
-			else if(obj->type == OBJ_DICT)
-			{
-				Object* val = indexObj->type == OBJ_STRING ? DictGet(&obj->dict, indexObj->string.raw) : NULL;
-				if(val)
-					DictPut(&obj->dict, indexObj->string.raw, value);
-				else if(CallOverloadedOperatorEx(vm, "SETINDEX", obj, indexObj, value))
-					PushObject(vm, thread->retVal);
-				else
-					DictPut(&obj->dict, indexObj->string.raw, value);
-			}
-			else
-				ErrorExitVM(vm, "Attempted to index a %s\n", ObjectTypeNames[obj->type]);
+			*key = entry->key;
+			*value = entry->value;
 		} break;
 
-		case OP_GETINDEX:
+		case OBJ_ARRAY:
 		{
-			++thread->pc;
-
-			Object* obj = PopObject(vm);
-			Object* indexObj = PopObject(vm);
-
-			if(obj->type == OBJ_ARRAY)
-			{
-				if(indexObj->type != OBJ_NUMBER)
-					ErrorExitVM(vm, "Attempted to index array with a %s (expected number)\n", ObjectTypeNames[indexObj->type]);
-				
-				int index = (int)indexObj->number;
-				
-				int arrayLength = obj->array.length;
-				Object** members = obj->array.members;
-				
-				if(index >= 0 && index < arrayLength)
-				{
-					if(members[index])
-						PushObject(vm, members[index]);
-					else
-						PushObject(vm, &NullObject);
-					if(vm->debug)
-						printf("getindex %i\n", index);
-				}
-				else
-					ErrorExitVM(vm, "Invalid array index %i\n", index);
-			}
-			else if(obj->type == OBJ_STRING)
-			{
-				if(indexObj->type != OBJ_NUMBER)
-					ErrorExitVM(vm, "Attempted to index string with a %s (expected number)\n", ObjectTypeNames[indexObj->type]);
-				
-				PushNumber(vm, obj->string.raw[(int)indexObj->number]);
-			}
-			else if(obj->type == OBJ_DICT)
-			{
-				Object* val = indexObj->type == OBJ_STRING ? DictGet(&obj->dict, indexObj->string.raw) : NULL;
-
-				if(val)
-					PushObject(vm, val);
-				else if(!CallOverloadedOperatorIf(vm, "GETINDEX", obj, indexObj))
-					PushObject(vm, &NullObject);
-				else
-					PushObject(vm, thread->retVal);
-			}
-			else 
-				ErrorExitVM(vm, "Attempted to index a %s\n", ObjectTypeNames[obj->type]);
+			*key = NUMBER_VAL(index);
+			*value = obj->array.members[index];
 		} break;
 
-		case OP_SET:
-		{
-			if(vm->numGlobals == 0)
-				ErrorExitVM(vm, "Invalid access to global variables\n");
+		default:
+			return MINT_FALSE;
+	}
 
-			++thread->pc;
-			int index = ReadInteger(vm);
-			
-			Object* top = PopObject(vm);
-			vm->globals[index] = top;
-			
-			if(vm->debug)
-			{
-				printf("set %s to ", vm->globalNames[vm->numGlobals - index - 1]);
-				WriteObject(vm, top);
-				printf("\n");
-			}
-		} break;
-		
-		case OP_GET:
-		{
-			if(vm->numGlobals == 0)
-				ErrorExitVM(vm, "Invalid access to global variables\n");
+	return MINT_TRUE;
+}
 
-			++thread->pc;
-			int index = ReadInteger(vm);
-			if(vm->globals[index])
-				PushObject(vm, (vm->globals[index]));
-			else
-				PushObject(vm, &NullObject);
-				
-			if(vm->debug)
-				printf("get %s\n", vm->globalNames[vm->numGlobals - index - 1]);
-		} break;
-		
-		case OP_WRITE:
-		{
-			if(vm->debug)
-				printf("write\n");
-			Object* top = PopObject(vm);
-			WriteObject(vm, top);
-			printf("\n");
-			++thread->pc;
-		} break;
-		
-		case OP_READ:
-		{
-			if(vm->debug)
-				printf("read\n");
-			char* string = ReadStringFromStdin();
-			PushString(vm, string);
-			free(string);
-			++thread->pc;
-		} break;
-		
-		case OP_GOTO:
-		{
-			++thread->pc;
-			int pc = ReadInteger(vm);
-			thread->pc = pc;
-		
-			if(vm->debug)
-				printf("goto %i\n", thread->pc);
-		} break;
-		
-		case OP_GOTOZ:
-		{
-			++thread->pc;
-			int pc = ReadInteger(vm);
-			
-			Object* top = PopObject(vm);
+/* END OF HORRIBLENESS; FOR NOW :P
+   VALVE PLS FIX */
 
-			if(top->type == OBJ_NULL || (top->type == OBJ_BOOL && !top->boolean))
-			{
-				thread->pc = pc;
-				if(vm->debug)
-					printf("gotoz %i\n", thread->pc);
-			}
-		} break;
-		
-		case OP_CALL:
-		{
-			Word nargs = vm->program[++thread->pc];
-			++thread->pc;
-			int index = ReadInteger(vm);
-
-			if(vm->debug)
-				printf("call %s\n", vm->functionNames[index]);
-			vm->lastFunctionName = vm->functionNames[index];
-			vm->lastFunctionIndex = index;
-			
-			if(!vm->functionHasEllipsis[index])
-			{
-				if(vm->functionNumArgs[index] != nargs + thread->numExpandedArgs)
-					ErrorExitVM(vm, "Invalid number of arguments (%i) to function '%s' which expects %i arguments\n", nargs + thread->numExpandedArgs, vm->functionNames[index], vm->functionNumArgs[index]);
-			}
-			else
-			{
-				if(vm->functionNumArgs[index] > nargs + thread->numExpandedArgs)
-					ErrorExitVM(vm, "Invalid number of arguments (%i) to function '%s' which expects at least %i arguments\n", nargs + thread->numExpandedArgs, vm->functionNames[index], vm->functionNumArgs[index]);
-			}
-			
-			PushIndir(vm, nargs + thread->numExpandedArgs);
+// Whether the interpreter loop has to give control back, i.e the thread is
+// done or the frame which was pushed on top of stopFp has returned
+static inline char ShouldStop(VM* vm, int stopFp)
+{
+	return !vm->thread || vm->thread->pc < 0 || vm->thread->fp <= stopFp;
+}
 
-			thread->pc = vm->functionPcs[index];
-		} break;
-		
-		case OP_CALLP:
-		{
-			int id;
-			Word hasEllipsis, isExtern, numArgs;
-			Word nargs = vm->program[++thread->pc];
-			
-			++thread->pc;
-			
-			Object* obj = PopObject(vm);
-			Object* env = NULL;
-			
-			if(obj->type == OBJ_FUNC)
-			{
-				id = obj->func.index;
-				isExtern = obj->func.isExtern;
-				if(!isExtern)
-				{
-					numArgs = vm->functionNumArgs[id];
-					hasEllipsis = vm->functionHasEllipsis[id];	
-				}
-				
-				env = obj->func.env;
-			}
-			else if(obj->type == OBJ_DICT)
-			{
-				Object* meta = obj->meta;
-				Object* callFn = NULL; 
-				if(meta && (callFn = DictGet(&meta->dict, "CALL")) && callFn->type == OBJ_FUNC)
-				{
-					if(callFn->func.env)
-						ErrorExitVM(vm, "Dictionary CALL overload has enclosing environment (i.e closure); This is not a valid overload\n");
-					
-					id = callFn->func.index;
-					isExtern = callFn->func.isExtern;
-					numArgs = vm->functionNumArgs[id];
-					hasEllipsis = vm->functionHasEllipsis[id];
-					env = obj;
-				}
-				else
-					ErrorExitVM(vm, "Attempted to call pure dict (no CALL meta overload found)\n");
-			}
-			else
-				ErrorExitVM(vm, "Expected func or dict but received '%s'\n", ObjectTypeNames[obj->type]);
+#define INTERP_NAME RunFast
+#define INTERP_TRACE 0
+#include "interp.h"
 
-			if(vm->debug)
-				printf("callp %s%s\n", isExtern ? "extern " : "", isExtern ? vm->externNames[id] : vm->functionNames[id]);
-				
-			vm->lastFunctionName = isExtern ? vm->externNames[id] : vm->functionNames[id];
-			vm->lastFunctionIndex = id;
-			
-			nargs += vm->numExpandedArgs;
-			if(env)
-				nargs += 1;
-			
-			if(isExtern)
-			{
-				vm->inExternBody = MINT_TRUE;
-				vm->externs[id](vm);
-				vm->inExternBody = MINT_FALSE;
-			}
-			else
-			{
-				if(!hasEllipsis)
-				{
-					if(nargs != numArgs)
-						ErrorExitVM(vm, "Function '%s' expected %i args but recieved %i args\n", vm->functionNames[id], numArgs, nargs);
-				}
-				else
-				{
-					if(nargs < numArgs)
-						ErrorExitVM(vm, "Function '%s' expected at least %i args but recieved %i args\n", vm->functionNames[id], numArgs, nargs);
-				}
-				
-				if(env)
-					PushObject(vm, env);
-				PushIndir(vm, nargs);
-				thread->pc = vm->functionPcs[id];
-			}
-		} break;
-		
-		case OP_RETURN:
-		{
-			if(vm->debug)
-				printf("ret\n");
-			thread->retVal = NULL;
-			PopIndir(vm);
-		} break;
-		
-		case OP_RETURN_VALUE:
-		{
-			if(vm->debug)
-				printf("retval\n");
-			Object* returnValue = PopObject(vm);
-			thread->retVal = returnValue;
-			PopIndir(vm);
-		} break;
-		
-		case OP_CALLF:
-		{
-			++thread->pc;
-			int index = ReadInteger(vm);
-			if(vm->debug)
-				printf("callf %s\n", vm->externNames[index]);
-			vm->lastFunctionIndex = index;
-			
-			vm->inExternBody = MINT_TRUE;
-			vm->externs[index](vm);
-			vm->inExternBody = MINT_FALSE;
-		} break;
+#define INTERP_NAME RunTraced
+#define INTERP_TRACE 1
+#include "interp.h"
 
-		case OP_GETLOCAL:
-		{
-			++thread->pc;
-			int index = ReadInteger(vm);
-			PushObject(vm, GetLocal(vm, index));
-			if(vm->debug)
-				printf("getlocal %i (fp: %i, stack size: %i)\n", index, thread->fp, thread->stackSize);
-		} break;
-		
-		case OP_SETLOCAL:
-		{
-			++thread->pc;
-			int index = ReadInteger(vm);
-			if(vm->debug)
-				printf("setlocal %i\n", index);
-			SetLocal(vm, index, PopObject(vm));
-		} break;
-		
-		case OP_HALT:
-		{
-			if(vm->debug)
-				printf("halt\n");
-			vm->thread = NULL;
-		} break;
-		
-		case OP_SETVMDEBUG:
-		{
-			if(vm->debug)
-				printf("setvmdebug\n");
-			char debug = vm->program[++thread->pc];
-			++thread->pc;
-			vm->debug = debug;
-		} break;
-		
-		case OP_GETARGS:
-		{
-			++thread->pc;
-			int startArgIndex = -ReadInteger(vm) - 1;
-			
-			if(vm->debug)
-				printf("getargs %i\n", -startArgIndex + 1);
-			
-			Word nargs = thread->indirStack[thread->indirStackSize - 4]; // number of arguments passed to the function
-			
-			if(nargs == 0) PushArray(vm, 0);
-			else
-			{
-				Object* obj = PushArray(vm, nargs - startArgIndex);
-				
-				for(int i = startArgIndex; i < nargs; ++i)
-					obj->array.members[i - startArgIndex] = GetLocal(vm, -i - 1);
-			}
-		} break;
-		
-		case OP_FILE:
-		{
-			++thread->pc;
-			int fileIndex = ReadInteger(vm);
-			if(vm->debug)
-				printf("\r\n");
-			thread->curFile = vm->stringConstants[fileIndex];
-		} break;
-		
-		case OP_LINE:
-		{
-			++thread->pc;
-			thread->curLine = ReadInteger(vm);
-			if(vm->debug)
-				printf("\r\n");
-		} break;
-		
-		default:
-			printf("(%s:%i:%i): Invalid instruction\n", thread->curFile, thread->curLine, thread->pc);
-			break;
+// Runs until the thread is done or the frame pushed on top of stopFp returns
+// (pass -1 to run until the vm halts); vm->debug chooses the loop
+static void Execute(VM* vm, int stopFp)
+{
+	while(!ShouldStop(vm, stopFp))
+	{
+		if(vm->debug)
+			RunTraced(vm, stopFp, MINT_FALSE);
+		else
+			RunFast(vm, stopFp);
 	}
 }
 
+// Executes a single instruction
+void ExecuteCycle(VM* vm)
+{
+	RunTraced(vm, -1, MINT_TRUE);
+}
+
 void RunVM(VM* vm)
 {
 	for(int i = 0; i < vm->numExterns; ++i)
@@ -3429,8 +3650,7 @@ void RunVM(VM* vm)
 	vm->thread = &vm->mainThread;
 
 	vm->thread->pc = vm->entryPoint;
-	while(vm->thread)
-		ExecuteCycle(vm);
+	Execute(vm, -1);
 }
 
 void DeleteVM(VM* vm)
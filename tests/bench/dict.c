@@ -0,0 +1,178 @@
+// dict.c -- measures how long dict inserts, lookups, removals and iteration
+// take (in nanoseconds per entry) for small, medium and large dicts, and the
+// longest a single insert takes while a dict grows
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// every measurement does (roughly) this many operations in total
+#define NUM_OPS 4000000
+
+static double Now(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+// sums up the values of every entry
+static double SumValues(const Dict* dict)
+{
+	double sum = 0;
+	for(int i = 0; i < GetDictEntryCount(dict); ++i)
+	{
+		const DictEntry* entry = GetDictEntry(dict, i);
+		if(entry)
+			sum += AS_NUMBER(entry->value);
+	}
+	return sum;
+}
+
+static void Run(VM* vm, int numKeys)
+{
+	Object** keys = malloc(sizeof(Object*) * numKeys);
+	Object** shuffled = malloc(sizeof(Object*) * numKeys);
+
+	char buf[32];
+	for(int i = 0; i < numKeys; ++i)
+	{
+		sprintf(buf, "key%d", i);
+		keys[i] = InternString(vm, buf, (int)strlen(buf));
+		shuffled[i] = keys[i];
+	}
+
+	// lookups and removals happen in a different order from the inserts
+	unsigned int seed = 12345;
+	for(int i = numKeys - 1; i > 0; --i)
+	{
+		seed = seed * 1103515245 + 12345;
+		int j = (int)((seed >> 8) % (unsigned int)(i + 1));
+		Object* tmp = shuffled[i];
+		shuffled[i] = shuffled[j];
+		shuffled[j] = tmp;
+	}
+
+	// the dicts are worked on in batches so that timing a small one doesn't
+	// take longer than the operations being timed
+	int batchSize = 65536 / numKeys;
+	if(batchSize < 1)
+		batchSize = 1;
+
+	int numBatches = NUM_OPS / (batchSize * numKeys);
+	if(numBatches < 1)
+		numBatches = 1;
+
+	Dict* dicts = malloc(sizeof(Dict) * batchSize);
+
+	double insert = 0, lookup = 0, removal = 0, iterate = 0;
+	double check = 0;
+
+	for(int batch = 0; batch < numBatches; ++batch)
+	{
+		for(int d = 0; d < batchSize; ++d)
+			InitDict(&dicts[d]);
+
+		double start = Now();
+		for(int d = 0; d < batchSize; ++d)
+		{
+			for(int i = 0; i < numKeys; ++i)
+				DictPut(&dicts[d], keys[i], NUMBER_VAL(i));
+		}
+		insert += Now() - start;
+
+		start = Now();
+		for(int d = 0; d < batchSize; ++d)
+		{
+			for(int i = 0; i < numKeys; ++i)
+				check += AS_NUMBER(*DictGet(&dicts[d], shuffled[i]));
+		}
+		lookup += Now() - start;
+
+		start = Now();
+		for(int d = 0; d < batchSize; ++d)
+			check += SumValues(&dicts[d]);
+		iterate += Now() - start;
+
+		start = Now();
+		for(int d = 0; d < batchSize; ++d)
+		{
+			for(int i = 0; i < numKeys; ++i)
+				DictRemove(&dicts[d], shuffled[i], NULL);
+		}
+		removal += Now() - start;
+
+		for(int d = 0; d < batchSize; ++d)
+		{
+			if(dicts[d].numEntries != 0)
+			{
+				fprintf(stderr, "dict still has %d entries after removing every key\n", dicts[d].numEntries);
+				exit(1);
+			}
+			FreeDict(&dicts[d]);
+		}
+	}
+
+	double ops = (double)numBatches * batchSize * numKeys;
+
+	printf("%8d entries: insert %7.1f ns, lookup %7.1f ns, remove %7.1f ns, iterate %7.1f ns (%g)\n", numKeys,
+		insert * 1e9 / ops, lookup * 1e9 / ops, removal * 1e9 / ops, iterate * 1e9 / ops, check);
+
+	free(dicts);
+	free(keys);
+	free(shuffled);
+}
+
+// the longest a single insert takes while a dict grows to numKeys entries
+static void RunGrowth(VM* vm, int numKeys)
+{
+	Object** keys = malloc(sizeof(Object*) * numKeys);
+
+	char buf[32];
+	for(int i = 0; i < numKeys; ++i)
+	{
+		sprintf(buf, "grow%d", i);
+		keys[i] = InternString(vm, buf, (int)strlen(buf));
+	}
+
+	Dict dict;
+	InitDict(&dict);
+
+	double longest = 0;
+	double start = Now();
+
+	for(int i = 0; i < numKeys; ++i)
+	{
+		double insertStart = Now();
+		DictPut(&dict, keys[i], NUMBER_VAL(i));
+		double elapsed = Now() - insertStart;
+
+		if(elapsed > longest)
+			longest = elapsed;
+	}
+
+	double total = Now() - start;
+
+	printf("%8d entries: growing took %.1f ms, longest insert %.3f ms\n", numKeys, total * 1e3, longest * 1e3);
+
+	FreeDict(&dict);
+	free(keys);
+}
+
+int main(int argc, char** argv)
+{
+	VM* vm = NewVM();
+	vm->thread = &vm->mainThread;
+
+	// the keys are only referenced from here, so they can't be collected
+	vm->inExternBody = MINT_TRUE;
+	vm->heap.stepWork = 0;
+
+	Run(vm, 8);
+	Run(vm, 1000);
+	Run(vm, argc > 1 ? atoi(argv[1]) : 1000000);
+	RunGrowth(vm, argc > 1 ? atoi(argv[1]) : 1000000);
+
+	vm->thread = NULL;
+	DeleteVM(vm);
+	return 0;
+}
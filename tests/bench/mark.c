@@ -0,0 +1,129 @@
+// mark.c -- measures how fast the collector traces deep and wide object graphs
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_RUNS 5
+
+// number of threads used to mark (0 leaves the default alone)
+static int MarkThreads = 0;
+
+// the graph is built with the collector disabled and then rooted on the stack
+static VM* BeginGraph(void)
+{
+	VM* vm = NewVM();
+	vm->thread = &vm->mainThread;
+	vm->inExternBody = MINT_TRUE;
+	vm->heap.stepWork = 0;
+	if(MarkThreads > 0)
+		vm->heap.numMarkThreads = MarkThreads;
+	return vm;
+}
+
+static void EndGraph(VM* vm)
+{
+	vm->inExternBody = MINT_FALSE;
+}
+
+// linked list of dicts: { next = { next = ... } }
+static VM* BuildList(int length)
+{
+	VM* vm = BeginGraph();
+
+	Object* value = InternString(vm, "value", 5);
+	Object* next = InternString(vm, "next", 4);
+
+	Value prev = NULL_VAL;
+	for(int i = 0; i < length; ++i)
+	{
+		Object* obj = PushDict(vm);
+		DictPut(obj->dict, value, NUMBER_VAL(i));
+		DictPut(obj->dict, next, prev);
+		prev = PopValue(vm);
+	}
+
+	PushValue(vm, prev);
+	EndGraph(vm);
+	return vm;
+}
+
+// binary tree of arrays: [left, right]
+static Value BuildTree(VM* vm, int depth)
+{
+	Object* obj = PushArray(vm, 2);
+	if(depth > 0)
+	{
+		obj->array.members[0] = BuildTree(vm, depth - 1);
+		obj->array.members[1] = BuildTree(vm, depth - 1);
+	}
+	return PopValue(vm);
+}
+
+static VM* BuildWideTree(int depth)
+{
+	VM* vm = BeginGraph();
+	PushValue(vm, BuildTree(vm, depth));
+	EndGraph(vm);
+	return vm;
+}
+
+// one big array of small arrays
+static VM* BuildWide(int length)
+{
+	VM* vm = BeginGraph();
+
+	Object* root = PushArray(vm, length);
+	for(int i = 0; i < length; ++i)
+	{
+		Object* obj = PushArray(vm, 4);
+		for(int j = 0; j < 4; ++j)
+			obj->array.members[j] = NUMBER_VAL(j);
+		root->array.members[i] = PopValue(vm);
+	}
+
+	EndGraph(vm);
+	return vm;
+}
+
+// builds a fresh graph for every run so minor collections have a whole nursery to trace
+static void Run(const char* name, VM* (*build)(int), int size, void (*collect)(VM*))
+{
+	double best = 0;
+	int numObjects = 0;
+
+	for(int i = 0; i < NUM_RUNS; ++i)
+	{
+		VM* vm = build(size);
+		numObjects = vm->numObjects;
+
+		clock_t start = clock();
+		collect(vm);
+		double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		if(i == 0 || elapsed < best)
+			best = elapsed;
+
+		vm->thread = NULL;
+		DeleteVM(vm);
+	}
+
+	printf("%-32s %9d objects %9.2f ms %8.2f M objects/s\n", name, numObjects,
+		best * 1000.0, numObjects / best / 1e6);
+}
+
+int main(int argc, char** argv)
+{
+	int scale = argc > 1 ? atoi(argv[1]) : 1;
+	MarkThreads = argc > 2 ? atoi(argv[2]) : 0;
+
+	Run("major: deep (dict list)", BuildList, 100000 * scale, CollectGarbage);
+	Run("major: deep+wide (binary tree)", BuildWideTree, 17 + (scale > 1), CollectGarbage);
+	Run("major: wide (array of arrays)", BuildWide, 500000 * scale, CollectGarbage);
+	Run("minor: deep (dict list)", BuildList, 100000 * scale, CollectGarbageMinor);
+	Run("minor: deep+wide (binary tree)", BuildWideTree, 17 + (scale > 1), CollectGarbageMinor);
+	Run("minor: wide (array of arrays)", BuildWide, 500000 * scale, CollectGarbageMinor);
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+// memory.c -- measures how many bytes a live object of each type takes up
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define NUM_OBJECTS 100000
+#define NUM_THREADS 1000
+
+// the keys of the dicts and the fields of the struct type
+static const char* FieldNames[] = { "x", "y", "z", "w" };
+
+// bytes currently allocated through malloc (heap pages included)
+static size_t AllocatedBytes(void)
+{
+#ifdef __GLIBC__
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+static void MakeShortString(VM* vm, int i)
+{
+	char buf[32];
+	sprintf(buf, "s%07d", i);
+	PushString(vm, buf);
+}
+
+static void MakeLongString(VM* vm, int i)
+{
+	char buf[256];
+	sprintf(buf, "%0200d", i);
+	PushString(vm, buf);
+}
+
+static void MakeEmptyArray(VM* vm, int i)
+{
+	PushArray(vm, 0);
+}
+
+static void MakeArray(VM* vm, int i)
+{
+	Object* obj = PushArray(vm, 4);
+	for(int j = 0; j < 4; ++j)
+		obj->array.members[j] = NUMBER_VAL(i + j);
+}
+
+static void MakeEmptyDict(VM* vm, int i)
+{
+	PushDict(vm);
+}
+
+static void MakeDict(VM* vm, int i)
+{
+	Object* obj = PushDict(vm);
+	for(int j = 0; j < 4; ++j)
+		DictPut(obj->dict, InternString(vm, FieldNames[j], 1), NUMBER_VAL(i + j));
+}
+
+static void MakeStruct(VM* vm, int i)
+{
+	Object* obj = PushStruct(vm, 0);
+	for(int j = 0; j < 4; ++j)
+		obj->structure.members[j] = NUMBER_VAL(i + j);
+}
+
+static void MakeFunc(VM* vm, int i)
+{
+	PushFunc(vm, 0, MINT_FALSE, NULL);
+}
+
+static void MakeNative(VM* vm, int i)
+{
+	PushNative(vm, NULL, NULL, NULL);
+}
+
+static void MakeThread(VM* vm, int i)
+{
+	PushFunc(vm, 0, MINT_FALSE, NULL);
+	PushThread(vm, PopObject(vm));
+}
+
+// creates count objects (with the collector disabled) and roots them in an array
+static void Measure(const char* name, void (*make)(VM*, int), int count)
+{
+	VM* vm = NewVM();
+	vm->thread = &vm->mainThread;
+	vm->inExternBody = MINT_TRUE;
+
+	// PushThread looks up the pc of the function
+	vm->functionPcs = calloc(1, sizeof(int));
+
+	// MakeStruct's objects are all of this type
+	vm->numStructTypes = 1;
+	vm->structTypes = calloc(1, sizeof(StructType));
+	vm->structTypes->name = calloc(1, 1);
+	vm->structTypes->numFields = 4;
+	vm->structTypes->keys = malloc(sizeof(Object*) * 4);
+	for(int j = 0; j < 4; ++j)
+		vm->structTypes->keys[j] = InternString(vm, FieldNames[j], 1);
+
+	Object* root = PushArray(vm, count);
+
+	size_t before = AllocatedBytes();
+	int pagesBefore = vm->heap.numPages;
+
+	for(int i = 0; i < count; ++i)
+	{
+		make(vm, i);
+		root->array.members[i] = PopValue(vm);
+	}
+
+	// everything is reachable, so this just shows what the heap looks like after a collection
+	CollectGarbage(vm);
+
+	double total = (double)(AllocatedBytes() - before) / count;
+	double pages = (double)(vm->heap.numPages - pagesBefore) * GC_PAGE_SIZE / count;
+
+	printf("%-24s %10.1f bytes/object %8.1f in heap pages %10.1f out of line\n", name, total, pages, total - pages);
+
+	vm->thread = NULL;
+	DeleteVM(vm);
+}
+
+int main(int argc, char** argv)
+{
+	printf("sizeof(Object) = %d, slot size = %d\n", (int)sizeof(Object), GC_SLOT_SIZE);
+
+	Measure("string (short)", MakeShortString, NUM_OBJECTS);
+	Measure("string (200 chars)", MakeLongString, NUM_OBJECTS);
+	Measure("array (empty)", MakeEmptyArray, NUM_OBJECTS);
+	Measure("array (4 numbers)", MakeArray, NUM_OBJECTS);
+	Measure("dict (empty)", MakeEmptyDict, NUM_OBJECTS);
+	Measure("dict (4 keys)", MakeDict, NUM_OBJECTS);
+	Measure("struct (4 fields)", MakeStruct, NUM_OBJECTS);
+	Measure("func", MakeFunc, NUM_OBJECTS);
+	Measure("native", MakeNative, NUM_OBJECTS);
+	Measure("thread", MakeThread, NUM_THREADS);
+
+	return 0;
+}
@@ -0,0 +1,89 @@
+// pause.c -- measures how long a major collection stops the program for when
+// most of the heap is garbage, and how long the (lazy) sweep takes afterwards
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_RUNS 5
+
+// small live set rooted on the stack and lots of dicts full of long strings
+// (which are expensive to free) that nothing references
+static VM* BuildHeap(int numLive, int numGarbage)
+{
+	VM* vm = NewVM();
+	vm->thread = &vm->mainThread;
+	vm->inExternBody = MINT_TRUE;
+	vm->heap.stepWork = 0;
+
+	Object* key = InternString(vm, "name", 4);
+
+	Object* root = PushArray(vm, numLive);
+	for(int i = 0; i < numLive; ++i)
+	{
+		PushArray(vm, 2);
+		root->array.members[i] = PopValue(vm);
+	}
+
+	char buf[128];
+	for(int i = 0; i < numGarbage; ++i)
+	{
+		Object* obj = PushDict(vm);
+		sprintf(buf, "%0100d", i);
+		PushString(vm, buf);
+		DictPut(obj->dict, key, PopValue(vm));
+		PopValue(vm);
+	}
+
+	vm->inExternBody = MINT_FALSE;
+	return vm;
+}
+
+static void Run(const char* name, int numLive, int numGarbage)
+{
+	double bestPause = 0, bestSweep = 0;
+	int numAllocs = 0;
+
+	for(int i = 0; i < NUM_RUNS; ++i)
+	{
+		VM* vm = BuildHeap(numLive, numGarbage);
+
+		clock_t start = clock();
+		CollectGarbage(vm);
+		double pause = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		// the sweep is paid for by the allocations which follow the collection
+		start = clock();
+		numAllocs = 0;
+		while(vm->heap.state == GC_SWEEPING)
+		{
+			PushArray(vm, 0);
+			PopValue(vm);
+			++numAllocs;
+		}
+		double sweep = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		if(i == 0 || pause < bestPause)
+			bestPause = pause;
+		if(i == 0 || sweep < bestSweep)
+			bestSweep = sweep;
+
+		vm->thread = NULL;
+		DeleteVM(vm);
+	}
+
+	printf("%-24s pause %8.2f ms, swept over %8d allocations in %8.2f ms\n", name,
+		bestPause * 1000.0, numAllocs, bestSweep * 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+	int scale = argc > 1 ? atoi(argv[1]) : 1;
+
+	Run("mostly garbage", 10000 * scale, 200000 * scale);
+	Run("half garbage", 100000 * scale, 100000 * scale);
+	Run("no garbage", 200000 * scale, 0);
+
+	return 0;
+}